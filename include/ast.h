@@ -1,9 +1,11 @@
 #ifndef _MATHVM_AST_H
 #define _MATHVM_AST_H
 
+#include <deque>
 #include <map>
 
 #include "mathvm.h"
+#include "symbols.h"
 
 namespace mathvm {
 
@@ -51,21 +53,30 @@ enum TokenKind {
 };
 
 #define FOR_KEYWORDS(DO)                        \
-    DO("int")                                   \
-    DO("double")                                \
-    DO("string")                                \
-    DO("for")                                   \
-    DO("while")                                 \
-    DO("if")                                    \
-    DO("print")                                 \
-    DO("function")                              \
-    DO("native")                                \
-    DO("return")
+    DO(kINT, "int")                             \
+    DO(kDOUBLE, "double")                       \
+    DO(kSTRING, "string")                       \
+    DO(kFOR, "for")                             \
+    DO(kWHILE, "while")                         \
+    DO(kIF, "if")                               \
+    DO(kPRINT, "print")                         \
+    DO(kFUNCTION, "function")                   \
+    DO(kNATIVE, "native")                       \
+    DO(kRETURN, "return")
+
+enum Keyword {
+#define ENUM_KEYWORD(k, w) k,
+    FOR_KEYWORDS(ENUM_KEYWORD)
+#undef ENUM_KEYWORD
+    kNONE
+};
+
+// The keyword spelled by the length bytes at word, kNONE for others.
+// A perfect hash picks the only candidate, one compare confirms it.
+Keyword keywordOf(const char* word, uint32_t length);
 
 static inline bool isKeyword(const string& word) {
-#define CHECK_WORD(w) if (word == w) return true;
-    FOR_KEYWORDS(CHECK_WORD);
-    return false;
+    return keywordOf(word.data(), word.size()) != kNONE;
 }
 
 #define FOR_NODES(DO)                           \
@@ -92,6 +103,86 @@ FOR_NODES(FORWARD_DECLARATION)
 
 class Scope;
 
+// Bump allocator the parser places the whole tree in, so it comes from
+// a few large chunks and goes with them. Objects placed here are never
+// destroyed one by one: strings and signatures they refer to are kept
+// by the arena as well, and only scopes, for their symbol maps, are
+// destroyed with it.
+class AstArena {
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    vector<char*> _chunks;
+    char* _top;
+    char* _end;
+    deque<string> _strings;
+    deque<Signature> _signatures;
+    vector<Scope*> _scopes;
+
+    AstArena(const AstArena&);
+    AstArena& operator=(const AstArena&);
+
+  public:
+    AstArena() : _top(0), _end(0) {
+    }
+    ~AstArena();
+
+    void* allocate(size_t size);
+
+    // copies living as long as the arena
+    const string& keep(const string& str) {
+        _strings.push_back(str);
+        return _strings.back();
+    }
+    const Signature& keep(const Signature& signature) {
+        _signatures.push_back(signature);
+        return _signatures.back();
+    }
+
+    // destroyed with the arena
+    void adopt(Scope* scope) {
+        _scopes.push_back(scope);
+    }
+};
+
+// Made only with new (arena), delete does nothing.
+class ArenaObject {
+  public:
+    static void* operator new(size_t size, AstArena& arena) {
+        return arena.allocate(size);
+    }
+    // if a constructor throws
+    static void operator delete(void*, AstArena&) {
+    }
+    static void operator delete(void*) {
+    }
+};
+
+// Children of a node, grown in the arena by doubling.
+template<class T> class ArenaList {
+    T* _items;
+    uint32_t _size;
+    uint32_t _capacity;
+
+  public:
+    ArenaList() : _items(0), _size(0), _capacity(0) {
+    }
+
+    uint32_t size() const { return _size; }
+    T operator[](uint32_t index) const { return _items[index]; }
+
+    void add(T item, AstArena& arena) {
+        if (_size == _capacity) {
+            _capacity = _capacity == 0 ? 4 : _capacity * 2;
+            T* items = (T*) arena.allocate(_capacity * sizeof (T));
+            for (uint32_t i = 0; i < _size; i++) {
+                items[i] = _items[i];
+            }
+            _items = items;
+        }
+        _items[_size++] = item;
+    }
+};
+
 class CustomDataHolder {
     void* _info;
   public:
@@ -108,21 +199,22 @@ class CustomDataHolder {
  * Generally, every variable must be guaranteed to be available
  * for at least lifetime of its scope.
  */
-class AstVar : public CustomDataHolder {
-    const string _name;
+class AstVar : public CustomDataHolder, public ArenaObject {
+    Symbol _symbol;
     VarType _type;
     Scope* _owner;
   public:
-    AstVar(const string& name, VarType type, Scope* owner) :
-    _name(name), _type(type), _owner(owner) {
+    AstVar(Symbol symbol, VarType type, Scope* owner) :
+    _symbol(symbol), _type(type), _owner(owner) {
     }
-    const string& name() const { return _name; }
+    const string& name() const { return Symbols::name(_symbol); }
+    Symbol symbol() const { return _symbol; }
     VarType type() const { return _type; }
     Scope* owner() const { return _owner; }
 };
 
 class FunctionNode;
-class AstFunction : public CustomDataHolder {
+class AstFunction : public CustomDataHolder, public ArenaObject {
     FunctionNode* _function;
     Scope* _owner;
   public:
@@ -130,7 +222,6 @@ class AstFunction : public CustomDataHolder {
         _function(function), _owner(owner) {
           assert(_function != 0);
     }
-    ~AstFunction();
 
     const string& name() const;
     VarType returnType() const;
@@ -144,56 +235,68 @@ class AstFunction : public CustomDataHolder {
     static const string invalid;
 };
 
-class Scope {
-    typedef std::map<string, AstVar* > VarMap;
-    typedef std::map<string, AstFunction* > FunctionMap;
+class Scope : public ArenaObject {
+    typedef SymbolMap<AstVar*> VarMap;
+    typedef SymbolMap<AstFunction*> FunctionMap;
 
     VarMap _vars;
     FunctionMap _functions;
     Scope* _parent;
     vector<Scope*> _children;
+    // where its variables and functions go
+    AstArena& _arena;
 
   public:
-    Scope(Scope* parent): _parent(parent) {}
-    ~Scope();
+    Scope(Scope* parent, AstArena& arena): _parent(parent), _arena(arena) {
+        arena.adopt(this);
+    }
 
     uint32_t childScopeNumber() { return _children.size(); }
     Scope* childScopeAt(uint32_t index) { return _children[index]; }
     void addChildScope(Scope* scope) { _children.push_back(scope); }
 
-    bool declareVariable(const string& name, VarType type);
+    bool declareVariable(Symbol name, VarType type);
+    bool declareVariable(const string& name, VarType type) {
+        return declareVariable(Symbols::intern(name), type);
+    }
     bool declareFunction(FunctionNode* node);
 
-    AstVar* lookupVariable(const string& name, bool useParent = true);
-    AstFunction* lookupFunction(const string& name, bool useParent = true);
+    AstVar* lookupVariable(Symbol name, bool useParent = true);
+    AstVar* lookupVariable(const string& name, bool useParent = true) {
+        return lookupVariable(Symbols::intern(name), useParent);
+    }
+    AstFunction* lookupFunction(Symbol name, bool useParent = true);
+    AstFunction* lookupFunction(const string& name, bool useParent = true) {
+        return lookupFunction(Symbols::intern(name), useParent);
+    }
 
     uint32_t variablesCount() const { return _vars.size(); }
     uint32_t functionsCount() const { return _functions.size(); }
 
     Scope* parent() const { return _parent; }
 
+    // in declaration order
     class VarIterator {
-        VarMap::iterator _it;
+        uint32_t _index;
         Scope* _scope;
         bool _includeOuter;
     public:
         VarIterator(Scope* scope, bool includeOuter = false) :
-            _scope(scope), _includeOuter(includeOuter) {
-            _it = _scope->_vars.begin();
+            _index(0), _scope(scope), _includeOuter(includeOuter) {
         }
 
         bool hasNext();
         AstVar* next();
     };
 
+    // in declaration order
     class FunctionIterator {
-        FunctionMap::iterator _it;
+        uint32_t _index;
         Scope* _scope;
         bool _includeOuter;
     public:
         FunctionIterator(Scope* scope, bool includeOuter = false) :
-            _scope(scope), _includeOuter(includeOuter) {
-            _it = _scope->_functions.begin();
+            _index(0), _scope(scope), _includeOuter(includeOuter) {
         }
 
         bool hasNext();
@@ -221,7 +324,7 @@ class AstVisitor {
     virtual bool is##type() const { return true; }            \
     virtual type* as##type() { return this; }
 
-class AstNode : public CustomDataHolder {
+class AstNode : public CustomDataHolder, public ArenaObject {
     uint32_t _index;
         
   protected:
@@ -301,10 +404,11 @@ class UnaryOpNode : public AstNode {
 
 
 class StringLiteralNode : public AstNode {
-    const string _stringLiteral;
+    const string& _stringLiteral;
   public:
-    StringLiteralNode(uint32_t index, const string& stringLiteral) :
-        AstNode(index), _stringLiteral(stringLiteral) {
+    StringLiteralNode(uint32_t index, const string& stringLiteral,
+                      AstArena& arena) :
+        AstNode(index), _stringLiteral(arena.keep(stringLiteral)) {
     }
 
     const string& literal() const {
@@ -403,7 +507,7 @@ class StoreNode : public AstNode {
 };
 
 class BlockNode : public AstNode {
-    vector<AstNode*> _nodes;
+    ArenaList<AstNode*> _nodes;
     Scope* _scope;
 
   public:
@@ -412,9 +516,6 @@ class BlockNode : public AstNode {
     AstNode(index), _scope(scope) {
     }
 
-    ~BlockNode() {
-    }
-
     Scope* scope() const {
         return _scope;
     }
@@ -427,8 +528,8 @@ class BlockNode : public AstNode {
         return _nodes[index];
     }
 
-    virtual void add(AstNode* node) {
-        _nodes.push_back(node);
+    virtual void add(AstNode* node, AstArena& arena) {
+        _nodes.add(node, arena);
     }
 
     virtual void visitChildren(AstVisitor* visitor) const {
@@ -441,16 +542,15 @@ class BlockNode : public AstNode {
 };
 
 class NativeCallNode : public AstNode {
-    string _nativeName;
-    Signature _signature;
+    const string& _nativeName;
+    const Signature& _signature;
   public:
     NativeCallNode(uint32_t index,
                    const string& nativeName,
-                   vector<pair<VarType,string> >& signature) :
-    AstNode(index), _nativeName(nativeName), _signature(signature) {
-    }
-
-    ~NativeCallNode() {
+                   vector<pair<VarType,string> >& signature,
+                   AstArena& arena) :
+    AstNode(index), _nativeName(arena.keep(nativeName)),
+    _signature(arena.keep(signature)) {
     }
 
     const string& nativeName() const {
@@ -596,16 +696,18 @@ class ReturnNode : public AstNode {
 };
 
 class FunctionNode : public AstNode {
-    const string _name;
-    Signature _signature;
+    const string& _name;
+    const Signature& _signature;
     BlockNode* _body;
 
   public:
     FunctionNode(uint32_t index,
                  const string& name,
                  Signature& signature,
-                 BlockNode* body) :
-    AstNode(index), _name(name), _signature(signature), _body(body) {
+                 BlockNode* body,
+                 AstArena& arena) :
+    AstNode(index), _name(arena.keep(name)), _signature(arena.keep(signature)),
+    _body(body) {
         assert(_body != 0);
         assert(signature.size() > 0);
     }
@@ -646,16 +748,17 @@ class FunctionNode : public AstNode {
 };
 
 class CallNode : public AstNode {
-    const string _name;
-    vector<AstNode*> _parameters;
+    const string& _name;
+    ArenaList<AstNode*> _parameters;
 
 public:
    CallNode(uint32_t index,
             const string& name,
-            vector<AstNode*>& parameters) :
-       AstNode(index), _name(name) {
+            vector<AstNode*>& parameters,
+            AstArena& arena) :
+       AstNode(index), _name(arena.keep(name)) {
         for (uint32_t i = 0; i < parameters.size(); i++) {
-          _parameters.push_back(parameters[i]);
+          _parameters.add(parameters[i], arena);
         }
     }
 
@@ -682,7 +785,7 @@ public:
 };
 
 class PrintNode : public AstNode {
-    vector<AstNode*> _operands;
+    ArenaList<AstNode*> _operands;
 
   public:
     PrintNode(uint32_t index) :
@@ -697,8 +800,8 @@ class PrintNode : public AstNode {
         return _operands[index];
     }
 
-    void add(AstNode* node) {
-        _operands.push_back(node);
+    void add(AstNode* node, AstArena& arena) {
+        _operands.add(node, arena);
     }
 
     virtual void visitChildren(AstVisitor* visitor) const {
@@ -47,9 +47,33 @@ namespace mathvm {
     class Bytecode {
     protected:
         vector<uint8_t> _data;
+        // code someone else keeps in memory, a mapped bytecode file;
+        // _data is empty meanwhile and the first change copies it there
+        const uint8_t* _view;
+        uint32_t _viewLength;
+
+        void detach() {
+            if (_view != 0) {
+                _data.assign(_view, _view + _viewLength);
+                _view = 0;
+                _viewLength = 0;
+            }
+        }
+
     public:
 
+        Bytecode() : _view(0), _viewLength(0) {
+        }
+
+        // runs the length bytes at code in place, they must outlive this
+        void setView(const uint8_t* code, uint32_t length) {
+            _data.clear();
+            _view = code;
+            _viewLength = length;
+        }
+
         void put(uint32_t index, uint8_t b) {
+            detach();
             if (index >= _data.size()) {
                 _data.resize(index + 1);
             }
@@ -57,6 +81,7 @@ namespace mathvm {
         }
 
         void add(uint8_t b) {
+            detach();
             _data.push_back(b);
         }
 
@@ -65,10 +90,11 @@ namespace mathvm {
         }
 
         uint8_t get(uint32_t index) const {
-            return _data[index];
+            return _view != 0 ? _view[index] : _data[index];
         }
 
         void set(uint32_t index, uint8_t v) {
+            detach();
             _data[index] = v;
         }
 
@@ -176,7 +202,24 @@ namespace mathvm {
         }
 
         uint32_t length() const {
-            return _data.size();
+            return _view != 0 ? _viewLength : _data.size();
+        }
+
+        // where the 2-byte offset sits inside a jumping insn, 0 for
+        // the others; destination is that position plus the offset
+        static uint32_t jumpOffsetPos(Instruction insn);
+
+        uint32_t jumpTarget(uint32_t bci) const {
+            uint32_t pos = bci + jumpOffsetPos(getInsn(bci));
+            return pos + getInt16(pos);
+        }
+
+        // raw instruction stream, used by the interpreter dispatch loop
+        const uint8_t* raw() const {
+            if (_view != 0) {
+                return _view;
+            }
+            return _data.empty() ? 0 : &_data[0];
         }
 
         Label currentLabel() {
@@ -6,14 +6,56 @@
 #include "bytecode.h"
 
 namespace mathvm {
+
+    struct CompiledRuntime;
+    class SamplingProfiler;
+    class OutputBuffer;
+
+    // Machine code of a function, see jit.h. Returns false when
+    // execution has to stop, on an error or STOP.
+    typedef bool (*CompiledFunction)(CompiledRuntime*);
     
+    // What the interpreter counted for one function while profiling.
+    struct FunctionProfile {
+        uint64_t calls;
+        // backward jumps taken, i.e. loop iterations
+        uint64_t backEdges;
+        uint64_t instructions;
+
+        FunctionProfile() : calls(0), backEdges(0), instructions(0) {
+        }
+    };
+
+    // A variable of the top level, other functions reach it through
+    // display[0]; slot among the variables of its type in the top frame.
+    struct GlobalVar {
+        VarType type;
+        uint16_t slot;
+
+        GlobalVar() : type(VT_INVALID), slot(0) {
+        }
+
+        GlobalVar(VarType type_, uint16_t slot_) : type(type_), slot(slot_) {
+        }
+    };
+
     class BytecodeFunction : public TranslatedFunction {
         Bytecode _bytecode;
+        uint16_t _depth;
+        Instruction _intrinsic;
+        // (first bci, source offset) wherever the offset changes,
+        // ascending bci
+        vector<pair<uint32_t, uint32_t> > _positions;
 
     public:
 
         BytecodeFunction(AstFunction* function) :
-        TranslatedFunction(function) {
+        TranslatedFunction(function), _depth(0), _intrinsic(BC_INVALID) {
+        }
+
+        BytecodeFunction(const string& name, const Signature& signature) :
+        TranslatedFunction(name, signature), _depth(0),
+        _intrinsic(BC_INVALID) {
         }
 
         Bytecode* bytecode() {
@@ -24,6 +66,42 @@ namespace mathvm {
             return &_bytecode;
         }
 
+        // lexical nesting level, 0 for the top level function;
+        // LOADCTX*/STORECTX* address outer frames by it
+        uint16_t depth() const {
+            return _depth;
+        }
+
+        void setDepth(uint16_t depth) {
+            _depth = depth;
+        }
+
+        // the instruction a call of this function is translated to, its
+        // arguments already converted to the parameter types; BC_INVALID
+        // when it is called
+        Instruction intrinsic() const {
+            return _intrinsic;
+        }
+
+        void setIntrinsic(Instruction intrinsic) {
+            _intrinsic = intrinsic;
+        }
+
+        // code from bci on comes from the source at offset, until the
+        // next call; bci never goes down
+        void setPosition(uint32_t bci, uint32_t offset);
+
+        // source offset of the instruction at bci,
+        // Status::INVALID_POSITION if unknown
+        uint32_t position(uint32_t bci) const;
+
+        // after the bytecode was rewritten, newBci[old bci] is the new one
+        void remapPositions(const vector<uint32_t>& newBci);
+
+        const vector<pair<uint32_t, uint32_t> >& positions() const {
+            return _positions;
+        }
+
         virtual void disassemble(ostream& out) const {
             _bytecode.dump(out);
         }
@@ -32,18 +110,97 @@ namespace mathvm {
     };
 
     class BytecodeCode : public Code {
-        map<string, uint16_t> globalVars_;
+        map<string, GlobalVar> globalVars_;
+        size_t stackSize_;
+        bool profiling_;
+        vector<FunctionProfile> profile_;
+        SamplingProfiler* sampler_;
+        OutputBuffer* output_;
+        size_t callsCount_;
+        size_t frameAllocations_;
+        // the bytecode file function bodies point into, see bytecodeFile.h
+        void* mapping_;
+        size_t mappingSize_;
     public:
+
+        BytecodeCode() : stackSize_(0), profiling_(false), sampler_(NULL),
+        output_(NULL), callsCount_(0), frameAllocations_(0), mapping_(NULL),
+        mappingSize_(0) {
+        }
+
+        virtual ~BytecodeCode();
+
+        // unmapped with the code
+        void adoptMapping(void* address, size_t size);
+
         virtual Status* execute(vector<Var*>& vars);
 
-        inline map<string, uint16_t>* globalVars() {
+        // operand stack capacity in slots, 0 means interpreter default
+        inline void setStackSize(size_t slots) {
+            stackSize_ = slots;
+        }
+
+        inline size_t stackSize() const {
+            return stackSize_;
+        }
+
+        // Counts calls, loop iterations and instructions per function
+        // during execute(). Profiled runs are interpreted throughout,
+        // compiled code isn't counted.
+        inline void setProfiling(bool profiling) {
+            profiling_ = profiling;
+        }
+
+        inline bool profiling() const {
+            return profiling_;
+        }
+
+        // by function id, from the last profiled execute()
+        inline const vector<FunctionProfile>& profile() const {
+            return profile_;
+        }
+
+        // function calls the last execute() made, the top level included
+        inline size_t callsCount() const {
+            return callsCount_;
+        }
+
+        // frame chunks the last execute() allocated, see FrameStack;
+        // nothing else on the call path is counted
+        inline size_t frameAllocations() const {
+            return frameAllocations_;
+        }
+
+        // samples execute() with it, interpreted throughout as when
+        // profiling; the caller owns it, NULL stops sampling
+        inline void setSampler(SamplingProfiler* sampler) {
+            sampler_ = sampler;
+        }
+
+        // what execute() prints goes there, the caller owns it; NULL
+        // is the process' standard output
+        inline void setOutput(OutputBuffer* output) {
+            output_ = output;
+        }
+
+        inline OutputBuffer* output() const {
+            return output_;
+        }
+
+        inline map<string, GlobalVar>* globalVars() {
             return &globalVars_;
         }
 
-        inline const map<string, uint16_t>* globalVars() const {
+        inline const map<string, GlobalVar>* globalVars() const {
             return &globalVars_;
         }
 
+        // per function id, NULL entries are interpreted; NULL when
+        // nothing is compiled
+        virtual const CompiledFunction* compiledFunctions() const {
+            return NULL;
+        }
+
     };
 }
 
@@ -0,0 +1,61 @@
+/*
+ * File:   bytecodeFile.h
+ *
+ * Translated programs on disk (.mvmb), to run them again without the
+ * scanner, parser and translator.
+ */
+
+#ifndef BYTECODEFILE_H
+#define	BYTECODEFILE_H
+
+#include "mathvm.h"
+#include "bytecodeCode.h"
+
+#include <string>
+
+namespace mathvm {
+
+    using namespace std;
+
+    // Layout, all numbers in host byte order, strings as a uint32_t
+    // length and the bytes:
+    //
+    //   header     magic "MVMB", uint32_t VERSION, uint32_t BC_LAST,
+    //              uint32_t counts of constants, globals, functions
+    //              and natives
+    //   constants  string each, in id order from 1
+    //   globals    string name, uint8_t type, uint16_t slot each
+    //   natives    in id order, string name and signature each
+    //   functions  in id order, each
+    //                string name, signature
+    //                uint32_t locals, uint16_t scope id, uint16_t depth
+    //                uint32_t sizeDoubles, sizeInts, sizeStrings, maxStack
+    //                uint32_t position count, (bci, offset) pairs
+    //                uint32_t bytecode length, the bytecode
+    //
+    // A signature is a uint32_t length and (uint8_t type, string name)
+    // per element, the return type first. Natives are looked up by name
+    // again on load.
+    //
+    // A file from a build with another instruction set is refused, the
+    // opcode count being part of the header.
+    class BytecodeFile {
+    public:
+
+        static const uint32_t VERSION = 3;
+
+        // NULL when written
+        static Status* save(const BytecodeCode* code, const string& path);
+
+        // Maps path and fills code, which must be empty, with what it
+        // holds. Bytecode bodies are run from the mapping, code keeps it
+        // until deleted. The result is verified like translated code.
+        static Status* load(const string& path, BytecodeCode* code);
+
+        // whether path starts like a bytecode file
+        static bool isBytecodeFile(const string& path);
+    };
+
+}
+
+#endif	/* BYTECODEFILE_H */
@@ -10,83 +10,190 @@
 
 #include "mathvm.h"
 #include "bytecodeCode.h"
+#include "nativeCall.h"
+#include "outputBuffer.h"
+#include "stringHeap.h"
+#include "sampler.h"
 #include <map>
+#include <new>
+#include <stddef.h>
 #include <typeinfo>
+#include <vector>
 
 namespace mathvm {
 
     using namespace std;
 
-    class DataBytecode : public Bytecode {
+    // Operand stack: one preallocated block of 8-byte slots, every value
+    // takes a whole slot whatever its type. Reserving past maxSize throws
+    // Overflow, which the interpreter turns into an error Status.
+    class DataBytecode {
     public:
 
-        DataBytecode() {
+        union Slot {
+            int64_t i;
+            double d;
+            StringHandle id;
+        };
+
+    private:
+        Slot* _base;
+        Slot* _top;
+        Slot* _limit;
+
+        DataBytecode(const DataBytecode&);
+        DataBytecode& operator=(const DataBytecode&);
+
+    public:
+
+        static const size_t DEFAULT_MAX_SIZE = 1 << 20;
+
+        struct Overflow {
+        };
+
+        explicit DataBytecode(size_t maxSize = DEFAULT_MAX_SIZE) {
+            _base = _top = new Slot[maxSize];
+            _limit = _base + maxSize;
         }
 
-        DataBytecode(size_t size) {
-            _data.resize(size);
+        ~DataBytecode() {
+            delete[] _base;
         }
 
         int64_t popi() {
-            return pop<int64_t>();
+            return (--_top)->i;
         }
 
         void pushi(int64_t v) {
-            push<int64_t>(v);
+            (_top++)->i = v;
         }
 
         int64_t getTopI() {
-            return getTyped<int64_t>(length() - (uint32_t)sizeof (int64_t));
+            return _top[-1].i;
         }
 
         int64_t getTopI2() {
-            return getTyped<int64_t>(length() -
-                    2 * ((uint32_t)sizeof (int64_t)));
+            return _top[-2].i;
         }
 
         double popd() {
-            return pop<double>();
+            return (--_top)->d;
         }
 
         void pushd(double v) {
-            push<double>(v);
+            (_top++)->d = v;
         }
 
-        uint16_t popid() {
-            return pop<uint16_t>();
+        StringHandle popid() {
+            return (--_top)->id;
         }
 
-        void pushid(uint16_t v) {
-            push<uint16_t>(v);
+        void pushid(StringHandle v) {
+            (_top++)->id = v;
         }
 
-        template<class T> T pop() {
-            T value = getTyped<T>(length() - (uint32_t)sizeof (T));
-            _data.resize(length() - (uint32_t)sizeof (T));
-            return value;
+        // number of occupied slots
+        inline size_t length() const {
+            return _top - _base;
         }
 
-        template<class T> void push(T value) {
-            addTyped(value);
+        inline size_t maxSize() const {
+            return _limit - _base;
         }
 
         inline void dropToSize(size_t to) {
-            _data.resize(to);
+            _top = _base + to;
+        }
+
+        inline void drop() {
+            --_top;
+        }
+
+        inline void drop(size_t slots) {
+            _top -= slots;
+        }
+
+        // one past the top value, what a NativeTrampoline reads from
+        inline const void* top() const {
+            return _top;
+        }
+
+        // compiled code keeps the top in a register, loads it from
+        // here and writes it back around calls
+        inline void* topAddress() {
+            return &_top;
+        }
+
+        // pushes aren't checked, a function makes room for its
+        // TranslatedFunction::maxStack values once on entry
+        inline void reserve(size_t slots) {
+            if ((size_t) (_limit - _top) < slots) {
+                throw Overflow();
+            }
         }
 
     };
 
+    // Activation record. It lives in a FrameStack block and is followed
+    // by its slots: sizeDoubles doubles, sizeInts ints, sizeStrings string
+    // handles.
     class FunctionContex {
         double* ddata;
         int64_t* idata;
-        uint16_t* sdata;
+        StringHandle* sdata;
+        // display entry at this function's depth before the call,
+        // put back on return
+        FunctionContex* shadowed_;
 
     public:
 
-        inline FunctionContex(const BytecodeFunction* fun)  {
-            ddata = new double[fun->sizeDoubles];
-            idata = new int64_t[fun->sizeInts];
-            sdata = new uint16_t[fun->sizeStrings];
+        inline FunctionContex(const BytecodeFunction* fun) {
+            ddata = (double*) ((uint8_t*) this + doublesOffset(fun));
+            idata = (int64_t*) ((uint8_t*) this + intsOffset(fun));
+            sdata = (StringHandle*) ((uint8_t*) this + stringsOffset(fun));
+        }
+
+        // bytes taken by the header and the slots, rounded up to 8
+        static inline size_t frameSize(const BytecodeFunction* fun) {
+            size_t size = stringsOffset(fun)
+                    + fun->sizeStrings * sizeof (StringHandle);
+            return (size + 7) & ~(size_t) 7;
+        }
+
+        // slot arrays from the start of the frame, compiled code
+        // addresses own frame slots with them
+        static inline size_t doublesOffset(const BytecodeFunction*) {
+            return sizeof (FunctionContex);
+        }
+
+        static inline size_t intsOffset(const BytecodeFunction* fun) {
+            return doublesOffset(fun) + fun->sizeDoubles * sizeof (double);
+        }
+
+        static inline size_t stringsOffset(const BytecodeFunction* fun) {
+            return intsOffset(fun) + fun->sizeInts * sizeof (int64_t);
+        }
+
+        // where the slot array pointers are, for outer frames
+        // whose function compiled code doesn't know
+        static inline size_t doublesPointerOffset() {
+            return offsetof(FunctionContex, ddata);
+        }
+
+        static inline size_t intsPointerOffset() {
+            return offsetof(FunctionContex, idata);
+        }
+
+        static inline size_t stringsPointerOffset() {
+            return offsetof(FunctionContex, sdata);
+        }
+
+        inline FunctionContex* shadowed() const {
+            return shadowed_;
+        }
+
+        inline void setShadowed(FunctionContex* frame) {
+            shadowed_ = frame;
         }
 
         inline void setd(uint32_t id, double v) {
@@ -97,7 +204,7 @@ namespace mathvm {
             idata[id] = v;
         }
 
-        inline void sets(uint32_t id, uint16_t v) {
+        inline void sets(uint32_t id, StringHandle v) {
             sdata[id] = v;
         }
 
@@ -109,34 +216,259 @@ namespace mathvm {
             return idata[id];
         }
 
-        inline uint16_t gets(uint32_t id) {
+        inline StringHandle gets(uint32_t id) {
             return sdata[id];
         }
-        
-        inline ~FunctionContex(){
-            delete[] ddata;
-            delete[] idata;
-            delete[] sdata;
+
+    };
+
+    // Frames are bump-allocated from big chunks and released in LIFO
+    // order. Chunks are kept once allocated, so after warm-up a call
+    // doesn't touch the heap; allocations() counts the chunk requests.
+    class FrameStack {
+
+        struct Chunk {
+            uint8_t* begin;
+            uint8_t* end;
+            // where top was when the next chunk was started
+            uint8_t* savedTop;
+        };
+
+        vector<Chunk> chunks;
+        size_t current;
+        uint8_t* top;
+        uint8_t* end;
+        size_t allocations_;
+
+        FrameStack(const FrameStack&);
+        FrameStack& operator=(const FrameStack&);
+
+        void nextChunk(size_t size);
+
+    public:
+
+        static const size_t CHUNK_SIZE = 1 << 20;
+
+        FrameStack();
+        ~FrameStack();
+
+        inline FunctionContex* push(const BytecodeFunction* fun) {
+            size_t size = FunctionContex::frameSize(fun);
+            if ((size_t) (end - top) < size) {
+                nextChunk(size);
+            }
+            FunctionContex* frame = new (top) FunctionContex(fun);
+            top += size;
+            return frame;
+        }
+
+        // frame must be the latest one pushed
+        inline void pop(FunctionContex* frame) {
+            top = (uint8_t*) frame;
+            if (top == chunks[current].begin && current > 0) {
+                current--;
+                top = chunks[current].savedTop;
+                end = chunks[current].end;
+            }
+        }
+
+        // drops every frame, the chunks stay
+        inline void clear() {
+            current = 0;
+            top = chunks[0].begin;
+            end = chunks[0].end;
+        }
+
+        inline size_t allocations() const {
+            return allocations_;
         }
 
     };
 
-    typedef map<uint16_t, FunctionContex*> OuterContexts;
+    class BytecodeInterpretator;
+
+#ifdef MATHVM_OPCODE_STATS
+    // Dynamic counts of each instruction and of each pair of adjacent
+    // ones, to choose superinstructions from. Built in only with
+    // -DMATHVM_OPCODE_STATS, see tests/perf/opstats.py.
+    class OpcodeStats {
+        vector<uint64_t> singles;
+        // first * BC_LAST + second
+        vector<uint64_t> pairs;
+        // BC_LAST where a call or return breaks the sequence
+        size_t previous;
+
+    public:
+        OpcodeStats() : singles(BC_LAST), pairs(BC_LAST * BC_LAST),
+        previous(BC_LAST) {
+        }
+
+        void count(uint8_t insn) {
+            singles[insn]++;
+            if (previous != BC_LAST) {
+                pairs[previous * BC_LAST + insn]++;
+            }
+            previous = insn;
+        }
+
+        void breakSequence() {
+            previous = BC_LAST;
+        }
+
+        // "opcode NAME count" and "pair NAME NAME count" lines, most
+        // frequent first
+        void report(ostream& out) const;
+    };
+#endif
+
+    // What compiled code gets in its only argument, see jit.h.
+    struct CompiledRuntime {
+        // DataBytecode top, a Slot*
+        void* top;
+        FunctionContex** display;
+        BytecodeInterpretator* interpreter;
+        // compiled functions entered with the native stack below this
+        // run in the interpreter, which keeps its calls off that stack
+        const void* stackLimit;
+        // where the PRINT instructions write
+        OutputBuffer* output;
+    };
 
     class BytecodeInterpretator {
+
+        // a native function ready to call, by its id in the code
+        struct NativeCall {
+            const void* code;
+            NativeTrampoline trampoline;
+            const Signature* signature;
+            const string* name;
+        };
+
         DataBytecode dstack;
+        FrameStack frames;
+        // NULL until prepare()
+        const BytecodeCode* prepared;
         vector<const BytecodeFunction*> functions;
-        vector<const string*> constants;
-
-        void execFunction(const BytecodeFunction* fun, OuterContexts contexts);
-        void setRootVars(const BytecodeCode& code, vector<Var*>& vars);
+        // the code's constants, then the globals' and arguments' values
+        // and what natives returned
+        StringHeap strings;
+        // where the constants end
+        StringHeap::Mark constantsEnd;
+        // a frame of the top function, first on the frame stack; it holds
+        // the globals between runs and is display[0] outside of them
+        FunctionContex* globals;
+        vector<NativeCall> natives;
+        // innermost active frame per lexical depth
+        vector<FunctionContex*> display;
+        // per function id, NULL where it is interpreted
+        const CompiledFunction* compiled;
+        CompiledRuntime runtime;
+        // by function id, NULL when not profiling
+        vector<FunctionProfile>* profile;
+        SamplingProfiler* sampler;
+        OutputBuffer* output;
+
+        // False when stopped before returning. The function runs in
+        // entered if given, a frame the caller pushed and filled, which
+        // is left on the frame stack.
+        bool execFunction(const BytecodeFunction* fun,
+                FunctionContex* entered = NULL);
+        // the dispatch loop, counting only when PROFILE, showing the
+        // sampler where it is only when SAMPLE
+        template<bool PROFILE, bool SAMPLE>
+        bool runFunction(const BytecodeFunction* fun, FunctionContex* entered);
+        Status* prepareNatives(const BytecodeCode& code);
+        void clearGlobals();
+        // the global's slot if it has var's name and type
+        Status* findGlobal(const Var& var, const GlobalVar** global) const;
+        void popParameters(const BytecodeFunction* fun, FunctionContex* context);
+        static const void* nativeStackLimit();
 
         Status* execStatus;
+        size_t calls;
+#ifdef MATHVM_OPCODE_STATS
+        OpcodeStats stats;
+#endif
 
     public:
+        explicit BytecodeInterpretator(
+                size_t stackSize = DataBytecode::DEFAULT_MAX_SIZE) :
+        dstack(stackSize), prepared(NULL), globals(NULL), compiled(NULL),
+        profile(NULL), sampler(NULL), output(&OutputBuffer::standard()),
+        calls(0) {
+        }
+
+        // Runs the top level once, vars giving globals their values
+        // first, the other globals start zero. Numeric vars get the
+        // globals' values back when it's done.
         Status* interpretate(const BytecodeCode& code, vector<Var*>& vars);
-        ~BytecodeInterpretator();
-        
+
+        // What an ExecutionContext does, see mathvm.h. prepare() comes
+        // first, it sets up code's functions, constants and natives for
+        // this interpreter, which then runs only code; the setters come
+        // before it. Strings given to the interpreter are copied,
+        // those it gives back stay valid until reset().
+        Status* prepare(const BytecodeCode& code);
+        Status* setGlobal(const Var& var);
+        Status* getGlobal(Var* var) const;
+        // the top level in the globals frame
+        Status* runTop();
+        Status* call(uint16_t id, const vector<Var*>& args, Var* result);
+        // Back to how prepare() left it: globals zero, the strings made
+        // since dropped. Runs that fail do it too.
+        void reset();
+
+        // machine code to run instead of these functions, by id
+        void setCompiled(const CompiledFunction* functions) {
+            compiled = functions;
+        }
+
+        // filled by interpretate(), one entry per function
+        void setProfile(vector<FunctionProfile>* functions) {
+            profile = functions;
+        }
+
+        // kept up to date with the calls and bci, the caller starts it
+        void setSampler(SamplingProfiler* sampler_) {
+            sampler = sampler_;
+        }
+
+        // what the program prints goes there, flushed before natives
+        // run and when interpretate() returns
+        void setOutput(OutputBuffer* output_) {
+            output = output_;
+        }
+
+        // function calls made by the last run, the top level included
+        size_t callsCount() const {
+            return calls;
+        }
+
+        size_t frameAllocations() const {
+            return frames.allocations();
+        }
+
+#ifdef MATHVM_OPCODE_STATS
+        // what this interpreter ran, compiled code not included
+        const OpcodeStats& opcodeStats() const {
+            return stats;
+        }
+#endif
+
+        // Compiled code calls back for what it doesn't do inline. A
+        // compiled function enters with its arguments on the operand
+        // stack and gets its frame, NULL when it must not run; the
+        // error, if any, is then in execStatus as with a false return.
+        FunctionContex* enterCompiled(const BytecodeFunction* fun);
+        void leaveCompiled(const BytecodeFunction* fun, FunctionContex* context);
+        bool callInterpreted(uint16_t id);
+        // pops the arguments of native function id and pushes its result
+        bool callNative(uint16_t id);
+
+        const char* stringAt(StringHandle handle) const {
+            return strings.get(handle);
+        }
+
         size_t callDepth;
         
     };
@@ -144,4 +476,3 @@ namespace mathvm {
 
 
 #endif	/* BYTECODEINTERPRETATOR_H */
-
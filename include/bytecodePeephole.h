@@ -0,0 +1,86 @@
+/*
+ * File:   bytecodePeephole.h
+ *
+ * Superinstruction fusion and cast placeholder removal over the bytecode
+ * emitted by the translator.
+ */
+
+#ifndef BYTECODEPEEPHOLE_H
+#define	BYTECODEPEEPHOLE_H
+
+#include "mathvm.h"
+#include "bytecodeCode.h"
+
+#include <vector>
+
+namespace mathvm {
+
+    using namespace std;
+
+    // Rewrites every function, replacing the sequences the translator
+    // produces for loop conditions, counter updates and unary minus by
+    // single instructions:
+    //
+    //   LOADIVAR a; LOADIVAR b; IFICMPxx                  -> IFICMPxxVAR a b
+    //   IFxx L; JA M; L:                                  -> IF!xx M
+    //   LOADIVAR x; <const>; IADD; STOREIVAR x            -> IINCVAR x c
+    //   <const>; LOADIVAR x; IADD; STOREIVAR x            -> IINCVAR x c
+    //   <const>; LOADIVAR x; ISWAP; ISUB; STOREIVAR x     -> IINCVAR x -c
+    //   ILOAD -1; IMUL / DLOAD -1.0; DMUL                 -> INEG / DNEG
+    //
+    // Unpatched cast placeholders (INVALID) inside a sequence are
+    // dropped with it; with compact set the remaining ones are dropped
+    // too. Nothing is fused across a jump destination, jumps are
+    // relocated to the shorter code.
+    class BytecodePeephole {
+        BytecodeCode* code;
+        bool compact;
+
+        // per source bci: some jump lands here
+        vector<bool> targets;
+        // source bci -> bci in the rewritten code
+        vector<uint32_t> newBci;
+        // (offset position in the rewritten code, source destination)
+        vector<pair<uint32_t, uint32_t> > jumps;
+        // bcis of the instructions looked at by the patterns
+        vector<uint32_t> window;
+
+        size_t fused_;
+        size_t stripped_;
+
+        void fillWindow(const Bytecode* from, uint32_t bci);
+        size_t fuse(const Bytecode* from, Bytecode* to);
+        bool fallsThrough(const Bytecode* from, uint32_t bci,
+                uint32_t target) const;
+        size_t branchOver(const Bytecode* from, size_t at,
+                Instruction* jump, uint32_t* target) const;
+        size_t fuseCompare(const Bytecode* from, Bytecode* to);
+        size_t fuseBranch(const Bytecode* from, Bytecode* to);
+        size_t fuseIncrement(const Bytecode* from, Bytecode* to);
+        size_t fuseNegate(const Bytecode* from, Bytecode* to);
+        void addJump(Bytecode* to, uint32_t offsetPos, uint32_t target);
+
+    public:
+
+        BytecodePeephole(BytecodeCode* code_, bool compact_ = true) :
+        code(code_), compact(compact_), fused_(0), stripped_(0) {
+        }
+
+        void optimize();
+        void optimizeFunction(BytecodeFunction* fun);
+
+        // sequences replaced so far
+        size_t fused() const {
+            return fused_;
+        }
+
+        // placeholders removed so far
+        size_t stripped() const {
+            return stripped_;
+        }
+    };
+
+}
+
+#endif	/* BYTECODEPEEPHOLE_H */
+
@@ -0,0 +1,72 @@
+/*
+ * File:   bytecodeProgram.h
+ *
+ * Program and ExecutionContext (see mathvm.h) over bytecode, compiled
+ * functions included: a context is an interpreter prepared once, runs
+ * reuse its stacks and don't copy the code.
+ */
+
+#ifndef BYTECODEPROGRAM_H
+#define	BYTECODEPROGRAM_H
+
+#include "mathvm.h"
+#include "bytecodeCode.h"
+#include "bytecodeInterpretator.h"
+
+namespace mathvm {
+
+    using namespace std;
+
+    class BytecodeProgram : public Program {
+        BytecodeCode* _code;
+
+    public:
+
+        // takes code
+        explicit BytecodeProgram(BytecodeCode* code) : _code(code) {
+        }
+
+        virtual ~BytecodeProgram() {
+            delete _code;
+        }
+
+        virtual Code* code() {
+            return _code;
+        }
+
+        // with the code's stack size and output as they are now,
+        // never profiled nor sampled
+        virtual ExecutionContext* createContext();
+    };
+
+    class BytecodeExecutionContext : public ExecutionContext {
+        const BytecodeCode* code;
+        BytecodeInterpretator interpreter;
+        // from prepare(), returned by every call until fixed
+        Status* prepareStatus;
+
+        Status* prepared() const {
+            return prepareStatus != NULL
+                    ? new Status(prepareStatus->getError()) : NULL;
+        }
+
+    public:
+
+        explicit BytecodeExecutionContext(const BytecodeCode* code_);
+
+        virtual ~BytecodeExecutionContext() {
+            delete prepareStatus;
+        }
+
+        virtual Status* setGlobal(const Var& var);
+        virtual Status* getGlobal(Var* var);
+        virtual Status* execute();
+        virtual Status* call(const string& name, const vector<Var*>& args,
+                Var* result);
+        virtual Status* call(const TranslatedFunction* function,
+                const vector<Var*>& args, Var* result);
+        virtual void reset();
+    };
+}
+
+#endif	/* BYTECODEPROGRAM_H */
@@ -0,0 +1,116 @@
+/*
+ * File:   bytecodeResolver.h
+ *
+ * Declares the functions, constants and natives of a program in its code
+ * and binds variables, calls and literals to them before translation,
+ * so translating a function body reads bindings and changes nothing
+ * shared.
+ */
+
+#ifndef BYTECODERESOLVER_H
+#define	BYTECODERESOLVER_H
+
+#include "mathvm.h"
+#include "visitors.h"
+#include "bytecodeCode.h"
+
+#include <deque>
+#include <vector>
+
+namespace mathvm {
+
+    using namespace std;
+
+    // AstVar::info() once resolved
+    struct VarBinding {
+        // of the function owning the variable, the top being 0; the
+        // context operand of LOADCTX*VAR / STORECTX*VAR
+        uint16_t depth;
+        // among the variables of its type in that function
+        uint16_t slot;
+        VarType type;
+    };
+
+    // Walks the program in the order the translator used to emit it, so
+    // ids come out as they did: functions of a block in declaration
+    // order before those nested in them, constants and natives as first
+    // met. Once resolved
+    //
+    //   AstFunction::info()        its BytecodeFunction, depth, slot
+    //                              counts and intrinsic set
+    //   AstVar::info()             its VarBinding
+    //   CallNode::info()           the TranslatedFunction called
+    //   StringLiteralNode::info()  its constant id
+    //   NativeCallNode::info()     its native function id, the symbol
+    //                              looked up then
+    //
+    // Parameters take the first slots of their type in signature order,
+    // then the variables of each block in declaration order, blocks in
+    // source order. A block and its nested blocks share the function's
+    // frame, an inner declaration taking a new slot rather than the
+    // outer one's.
+    //
+    // The records live as long as the resolver.
+    class BytecodeResolver : public AstBaseVisitor {
+        BytecodeCode* code;
+        Status* status;
+        deque<VarBinding> bindings;
+        deque<uint16_t> ids;
+        // by function id
+        vector<AstFunction*> functions;
+        BytecodeFunction* frame;
+
+        void declareFunction(AstFunction* function);
+        void bindScope(Scope* scope);
+        void resolveFunction(AstFunction* function);
+
+        const uint16_t* keepId(uint16_t id) {
+            ids.push_back(id);
+            return &ids.back();
+        }
+
+    public:
+
+        explicit BytecodeResolver(BytecodeCode* code_) :
+        code(code_), status(NULL), frame(NULL) {
+        }
+
+        // Declares top, which becomes function 0, and everything in it.
+        // NULL when all calls and natives resolve, otherwise the error of
+        // the first.
+        Status* resolve(AstFunction* top);
+
+        uint32_t functionsNumber() const {
+            return functions.size();
+        }
+
+        AstFunction* functionById(uint16_t id) const {
+            return functions[id];
+        }
+
+        virtual void visitBlockNode(BlockNode* node);
+        virtual void visitCallNode(CallNode* node);
+        virtual void visitStringLiteralNode(StringLiteralNode* node);
+        virtual void visitNativeCallNode(NativeCallNode* node);
+
+        static const VarBinding& bindingOf(const AstVar* var) {
+            return *(const VarBinding*) var->info();
+        }
+
+        static BytecodeFunction* functionOf(const AstFunction* function) {
+            return (BytecodeFunction*) function->info();
+        }
+
+        static BytecodeFunction* calleeOf(const CallNode* node) {
+            return (BytecodeFunction*) node->info();
+        }
+
+        // of a string literal or a native call
+        static uint16_t idOf(const AstNode* node) {
+            return *(const uint16_t*) node->info();
+        }
+    };
+
+}
+
+#endif	/* BYTECODERESOLVER_H */
@@ -4,6 +4,7 @@
 #include "mathvm.h"
 #include "visitors.h"
 #include "bytecodeCode.h"
+#include "bytecodeResolver.h"
 #include <string>
 #include <stack>
 #include <map>
@@ -11,37 +12,82 @@
 
 namespace mathvm {
 
+    class Parser;
+    class CompileCache;
+
     class BytecodeTranslator : public Translator {
-        Status* translateBytecode(
-                const string& program,
-                Code** code);
+        bool optimize_;
+        CompileCache* cache_;
+        uint32_t threads_;
+
+    protected:
+
+        // fills code, which the caller owns either way
+        Status* translateBytecode(const string& program, BytecodeCode* code);
+
+        // the empty code translate() and load() fill
+        virtual BytecodeCode* createCode() {
+            return new BytecodeCode();
+        }
 
     public:
 
-        BytecodeTranslator() {
+        BytecodeTranslator() : optimize_(true), cache_(NULL),
+        threads_(defaultThreads()) {
+        }
+
+        // one per online CPU
+        static uint32_t defaultThreads();
+
+        // false leaves the bytecode as the AST visitor emitted it:
+        // no fusion, cast placeholders stay, for debugging the translator
+        void setOptimize(bool optimize) {
+            optimize_ = optimize;
+        }
+
+        // Function bodies are translated by up to that many threads, the
+        // calling one included; 1 translates them one by one. The code is
+        // the same whatever the number.
+        void setThreads(uint32_t threads) {
+            threads_ = threads < 1 ? 1 : threads;
+        }
+
+        // translate() looks programs up there first and stores what it
+        // translated; the caller owns it, NULL translates everything
+        void setCache(CompileCache* cache) {
+            cache_ = cache;
         }
 
         virtual ~BytecodeTranslator() {
         }
 
         virtual Status* translate(const string& program, Code** code);
+
+        // takes the code from a bytecode file instead, see bytecodeFile.h
+        virtual Status* load(const string& path, Code** code);
         
     };
 
     class BytecodeAstVisitor : public AstVisitor {
         friend BytecodeTranslator;
         BytecodeCode* code;
-        vector<uint16_t> functionsStack;
-        vector<uint16_t> contextsStack;
+        // turns node positions into source offsets, NULL records none
+        const Parser* parser;
+        // of the node being translated
+        uint32_t sourceOffset;
         BytecodeFunction* currentFunction;
         Status* status;
         set<TokenKind> logicKinds;
         set<TokenKind> logicCompareKinds;
         map<TokenKind, Instruction> logicKindToJump;
+        map<TokenKind, Instruction> logicKindToDoubleJump;
 
     public:
 
-        BytecodeAstVisitor(BytecodeCode* code_) : code(code_), status(NULL) {
+        BytecodeAstVisitor(BytecodeCode* code_, const Parser* parser_ = NULL) :
+        code(code_), parser(parser_), sourceOffset(Status::INVALID_POSITION),
+        currentFunction(NULL), status(NULL),
+        trueIdUnsettedPos(0), falseIdUnsettedPos(0) {
             logicCompareKinds.insert(tEQ);
             logicCompareKinds.insert(tNEQ);
             logicCompareKinds.insert(tGT);
@@ -57,6 +103,13 @@ namespace mathvm {
             logicKindToJump[tGE] = BC_IFICMPGE;
             logicKindToJump[tLT] = BC_IFICMPL;
             logicKindToJump[tLE] = BC_IFICMPLE;
+
+            logicKindToDoubleJump[tEQ] = BC_DIFCMPE;
+            logicKindToDoubleJump[tNEQ] = BC_DIFCMPNE;
+            logicKindToDoubleJump[tGT] = BC_DIFCMPG;
+            logicKindToDoubleJump[tGE] = BC_DIFCMPGE;
+            logicKindToDoubleJump[tLT] = BC_DIFCMPL;
+            logicKindToDoubleJump[tLE] = BC_DIFCMPLE;
         }
 
         void addTrueFalseJumpRegion(Instruction jumpInsn);
@@ -87,21 +140,29 @@ namespace mathvm {
                 addInsn(BC_SSWAP);
         }
 
-        void visitAst(AstFunction*);
+        // Emits the body of function, resolved by a BytecodeResolver, into
+        // its BytecodeFunction. NULL when translated; the visitor can
+        // translate another function then.
+        Status* translateFunction(AstFunction* function);
         bool beforeVisit();
+        // what follows comes from node, returns the offset to go back to
+        uint32_t enterNode(AstNode* node);
+        void leaveNode(uint32_t outerOffset);
 
 #define VISITOR_FUNCTION(type, name) \
         virtual void visit##type##_(type* node); \
         inline virtual void visit##type(type* node){ \
                 if(beforeVisit()) \
                         return; \
+                uint32_t outerOffset = enterNode(node); \
                 visit##type##_(node); \
+                leaveNode(outerOffset); \
         } 
         FOR_NODES(VISITOR_FUNCTION)
 #undef VISITOR_FUNCTION
 
         void visitBinaryLogicOpNode(BinaryOpNode* node);
-        void fillAstFunction(AstFunction*, BytecodeFunction*);
+        void dropUnusedValue(AstNode* statement);
 
     private:
 
@@ -125,11 +186,6 @@ namespace mathvm {
             return currentBytecode()->current();
         }
 
-        uint16_t allocateVar(AstVar& var);
-
-        map<uint16_t, map<string, uint16_t> > contextVarIds;
-        map<uint16_t, map<string, uint16_t> > functionParamIds;
-
         stack<VarType> typesStack;
 
         void addTypedOpInsn(VarType type, TokenKind op);
@@ -138,11 +194,12 @@ namespace mathvm {
             return typesStack.top();
         }
 
-        inline uint16_t findVarLocal(const string& name) {
-            return findVar(name, true).second;
-        }
+        // slot of a variable of the current function
+        uint16_t localSlot(const AstVar* var);
 
-        pair<uint16_t, uint16_t> findVar(const string& name, bool onlyCurrentContext = false);
+        inline uint16_t currentDepth() {
+            return currentFunction->depth();
+        }
 
         void loadVar(const AstVar* var);
 
@@ -170,7 +227,6 @@ namespace mathvm {
 
 
 
-        uint16_t currentContext; // aka function
         uint16_t trueIdUnsettedPos;
         uint16_t falseIdUnsettedPos;
         
@@ -0,0 +1,77 @@
+/*
+ * File:   bytecodeVerifier.h
+ *
+ * Abstract interpretation of emitted bytecode over operand stack heights.
+ */
+
+#ifndef BYTECODEVERIFIER_H
+#define	BYTECODEVERIFIER_H
+
+#include "mathvm.h"
+#include "bytecodeCode.h"
+
+#include <vector>
+
+namespace mathvm {
+
+    using namespace std;
+
+    // Follows every reachable path of each function and checks that
+    // the stack height at an instruction doesn't depend on the path,
+    // nothing is popped from an empty stack and jumps land on
+    // instruction boundaries. The deepest height seen is stored to
+    // TranslatedFunction::maxStack, which the interpreter relies on.
+    //
+    // Variable slots, string constants and callees have to exist. The
+    // file doesn't say which function encloses which, so an access to
+    // an outer frame is checked against every function of that depth
+    // a call path can lead from without passing another one.
+    class BytecodeVerifier {
+        // LOADCTX*/STORECTX* of a frame below the function's own
+        struct ContextAccess {
+            uint16_t function;
+            uint32_t bci;
+            uint16_t depth;
+            VarType type;
+            uint16_t slot;
+        };
+
+        const BytecodeCode* code;
+
+        // per bci: height on entry, -1 while unreached
+        vector<int32_t> heights;
+        // per bci: INSN_START, INSN_OPERAND or 0 while unreached
+        vector<uint8_t> marks;
+        vector<uint32_t> worklist;
+        // per function id: ids of the functions calling it
+        vector<vector<uint16_t> > callers;
+        vector<ContextAccess> contextAccesses;
+
+        static const uint8_t INSN_START = 1;
+        static const uint8_t INSN_OPERAND = 2;
+
+        Status* error(const BytecodeFunction* fun, uint32_t bci,
+                const string& message);
+        Status* enqueue(const BytecodeFunction* fun, uint32_t from,
+                int64_t to, int32_t height);
+        Status* stackEffect(const BytecodeFunction* fun, uint32_t bci,
+                int32_t* pops, int32_t* pushes);
+        Status* checkOperands(const BytecodeFunction* fun, uint32_t bci);
+        Status* checkSlot(const BytecodeFunction* fun, uint32_t bci,
+                const BytecodeFunction* owner, VarType type, uint16_t slot);
+        Status* checkContextAccess(const ContextAccess& access);
+
+    public:
+
+        BytecodeVerifier(const BytecodeCode* code_) : code(code_) {
+        }
+
+        // returns NULL when all functions are fine
+        Status* verify();
+        Status* verifyFunction(BytecodeFunction* fun);
+    };
+
+}
+
+#endif	/* BYTECODEVERIFIER_H */
+
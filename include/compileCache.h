@@ -0,0 +1,74 @@
+/*
+ * File:   compileCache.h
+ *
+ * On-disk cache of translated programs, keyed by the source text, so
+ * running the same script again skips the front end.
+ */
+
+#ifndef COMPILECACHE_H
+#define	COMPILECACHE_H
+
+#include "mathvm.h"
+#include "bytecodeCode.h"
+
+#include <iostream>
+#include <string>
+
+namespace mathvm {
+
+    using namespace std;
+
+    // Entries are bytecode files (see bytecodeFile.h) in one directory,
+    // named after a 128-bit hash of the source, the translator options
+    // and the running executable, so a rebuilt VM doesn't see entries
+    // of an older one.
+    //
+    // Entries are written to a temporary file and renamed into place,
+    // processes sharing the directory see an entry whole or not at all.
+    // A hit touches the entry; when a store takes the directory past
+    // the size limit the least recently used entries go.
+    //
+    // Hits, misses, stores and evictions are counted per process and
+    // added to the directory's totals when the cache is deleted.
+    class CompileCache {
+        string directory;
+        uint64_t sizeLimit;
+
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t stores;
+        uint64_t evictions;
+
+        void evict();
+        void addTotals();
+
+    public:
+
+        static const uint64_t DEFAULT_SIZE_LIMIT = 64 << 20;
+
+        // the directory is created when missing
+        explicit CompileCache(const string& directory,
+                uint64_t sizeLimit = DEFAULT_SIZE_LIMIT);
+        ~CompileCache();
+
+        // file of the entry for program translated with options,
+        // whether it exists or not
+        string entryPath(const string& program, uint32_t options) const;
+
+        // Fills code, which must be empty, from the entry. False on a
+        // miss, code may then hold part of the entry and has to go;
+        // an unreadable entry is removed.
+        bool load(const string& entry, BytecodeCode* code);
+
+        // best effort, a failed write is a later miss
+        void store(const string& entry, const BytecodeCode* code);
+
+        // Totals of all processes, this one included, and the size of
+        // the directory, as lines of "name value" in the Prometheus
+        // text format.
+        void report(ostream& out);
+    };
+
+}
+
+#endif	/* COMPILECACHE_H */
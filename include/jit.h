@@ -3,36 +3,76 @@
 
 #include "mathvm.h"
 #include "bytecodeCode.h"
+#include "bytecodeTranslator.h"
+
+#include <set>
 
 namespace mathvm {
 
-class MachCodeFunction;
+// Baseline JIT: every BytecodeFunction whose instructions it knows is
+// translated one instruction at a time to x86-64 through AsmJit, the
+// rest stays with the interpreter. Compiled code works on the
+// interpreter's operand stack and frames, so either kind of function
+// can call the other.
+//
+// Baseline code counts calls and loop iterations; a function that
+// reaches the hot threshold is compiled again with its operand stack
+// and variables in registers, and later calls run that.
+class MachCodeImpl : public BytecodeCode {
+    // by function id, NULL where not compiled
+    vector<CompiledFunction> _compiled;
+    // what register tier code calls, see genCallStub()
+    vector<void*> _entries;
+    vector<uint32_t> _counters;
+    vector<bool> _tieredUp;
+    // all the machine code, address and size
+    vector<pair<void*, size_t> > _blocks;
+    // variables some function reaches through the display, see
+    // capturedKey(); the register tier keeps them in the frame
+    // around calls
+    set<uint64_t> _captured;
+    uint32_t _hotThreshold;
+
+    void* allocate(size_t size);
+    void findCaptured(const BytecodeFunction* fun);
 
-class MachCodeImpl : public Code {
-    void* _code;
   public:
+    static const uint32_t DEFAULT_HOT_THRESHOLD = 1000;
+
     MachCodeImpl();
     virtual ~MachCodeImpl();
 
-    virtual Status* execute(vector<Var*>& vars);
+    // 0 keeps everything in the baseline; before compile()
+    void setHotThreshold(uint32_t threshold) {
+        _hotThreshold = threshold;
+    }
+
+    // returns the number of functions compiled
+    size_t compile();
 
-    MachCodeFunction* functionByName(const string& name);
-    MachCodeFunction* functionById(uint16_t id);
-    void error(const char* format, ...);
+    // called by baseline code of the function when it gets hot
+    void tierUp(uint16_t id);
 
-    void setCode(void* code) { _code = code; }
+    virtual const CompiledFunction* compiledFunctions() const;
 };
 
-class MachCodeFunction : public TranslatedFunction {
-public:
-    MachCodeFunction(MachCodeImpl* owner, BytecodeFunction* bytecode);
-    virtual ~MachCodeFunction();
+class MachCodeTranslatorImpl : public BytecodeTranslator {
+    uint32_t _hotThreshold;
 
-    virtual Status* execute(vector<Var*>* vars = 0);
-    virtual void disassemble(ostream& out) const;
-};
+  protected:
+    virtual BytecodeCode* createCode();
+
+  public:
+    MachCodeTranslatorImpl();
+    virtual ~MachCodeTranslatorImpl();
 
+    void setHotThreshold(uint32_t threshold) {
+        _hotThreshold = threshold;
+    }
 
+    virtual Status* translate(const string& program, Code* *code);
+    virtual Status* load(const string& path, Code* *code);
+};
 
 }
 
@@ -15,98 +15,117 @@ namespace mathvm {
 
 using namespace std;
 
+// DO(name, description, length, pops, pushes): pops and pushes count
+// operand stack values, -1 means it depends on the callee signature.
 #define FOR_BYTECODES(DO)                                               \
-        DO(INVALID, "Invalid instruction.", 1)                          \
-        DO(DLOAD, "Load double on TOS, inlined into insn stream.", 9)   \
-        DO(ILOAD, "Load int on TOS, inlined into insn stream.", 9)      \
-        DO(SLOAD, "Load string reference on TOS, next two bytes - constant id.", 3)   \
-        DO(DLOAD0, "Load double 0 on TOS.", 1)                          \
-        DO(ILOAD0, "Load int 0 on TOS.", 1)                             \
-        DO(SLOAD0, "Load empty string on TOS.", 1)                      \
-        DO(DLOAD1, "Load double 1 on TOS.", 1)                          \
-        DO(ILOAD1, "Load int 1 on TOS.", 1)                             \
-        DO(DLOADM1, "Load double -1 on TOS.", 1)                        \
-        DO(ILOADM1, "Load int -1 on TOS.", 1)                           \
-        DO(DADD, "Add 2 doubles on TOS, push value back.", 1)           \
-        DO(IADD, "Add 2 ints on TOS, push value back.", 1)              \
-        DO(DSUB, "Subtract 2 doubles on TOS (lower from upper), push value back.", 1) \
-        DO(ISUB, "Subtract 2 ints on TOS (lower from upper), push value back.", 1) \
-        DO(DMUL, "Multiply 2 doubles on TOS, push value back.", 1)      \
-        DO(IMUL, "Multiply 2 ints on TOS, push value back.", 1)         \
-        DO(DDIV, "Divide 2 doubles on TOS (upper to lower), push value back.", 1) \
-        DO(IDIV, "Divide 2 ints on TOS (upper to lower), push value back.", 1) \
-        DO(IMOD, "Modulo operation on 2 ints on TOS (upper to lower), push value back.", 1) \
-        DO(DNEG, "Negate double on TOS.", 1)                            \
-        DO(INEG, "Negate int on TOS.", 1)                               \
-        DO(IAOR, "Arithmetic OR of 2 ints on TOS, push value back.", 1) \
-        DO(IAAND, "Arithmetic AND of 2 ints on TOS, push value back.", 1)  \
-        DO(IAXOR, "Arithmetic XOR of 2 ints on TOS, push value back.", 1)  \
-        DO(IPRINT, "Pop and print integer TOS.", 1)                     \
-        DO(DPRINT, "Pop and print double TOS.", 1)                      \
-        DO(SPRINT, "Pop and print string TOS.", 1)                      \
-        DO(I2D,  "Convert int on TOS to double.", 1)                    \
-        DO(D2I,  "Convert double on TOS to int.", 1)                    \
-        DO(S2I,  "Convert string on TOS to int.", 1)                    \
-        DO(ISWAP, "Swap 2 topmost ints on TOP.", 1)                           \
-        DO(DSWAP, "Swap 2 topmost doubles on TOP.", 1)                           \
-        DO(SSWAP, "Swap 2 topmost values.", 1)                           \
-        DO(POP, "Remove topmost value.", 1)                             \
-        DO(LOADDVAR0, "Load double from variable 0, push on TOS.", 1)   \
-        DO(LOADDVAR1, "Load double from variable 1, push on TOS.", 1)   \
-        DO(LOADDVAR2, "Load double from variable 2, push on TOS.", 1)   \
-        DO(LOADDVAR3, "Load double from variable 3, push on TOS.", 1)   \
-        DO(LOADIVAR0, "Load int from variable 0, push on TOS.", 1)      \
-        DO(LOADIVAR1, "Load int from variable 1, push on TOS.", 1)      \
-        DO(LOADIVAR2, "Load int from variable 2, push on TOS.", 1)      \
-        DO(LOADIVAR3, "Load int from variable 3, push on TOS.", 1)      \
-        DO(LOADSVAR0, "Load string from variable 0, push on TOS.", 1)   \
-        DO(LOADSVAR1, "Load string from variable 1, push on TOS.", 1)   \
-        DO(LOADSVAR2, "Load string from variable 2, push on TOS.", 1)   \
-        DO(LOADSVAR3, "Load string from variable 3, push on TOS.", 1)   \
-        DO(STOREDVAR0, "Pop TOS and store to double variable 0.", 1)    \
-        DO(STOREDVAR1, "Pop TOS and store to double variable 1.", 1)    \
-        DO(STOREDVAR2, "Pop TOS and store to double variable 0.", 1)    \
-        DO(STOREDVAR3, "Pop TOS and store to double variable 3.", 1)    \
-        DO(STOREIVAR0, "Pop TOS and store to int variable 0.", 1)       \
-        DO(STOREIVAR1, "Pop TOS and store to int variable 1.", 1)       \
-        DO(STOREIVAR2, "Pop TOS and store to int variable 0.", 1)       \
-        DO(STOREIVAR3, "Pop TOS and store to int variable 3.", 1)       \
-        DO(STORESVAR0, "Pop TOS and store to string variable 0.", 1)    \
-        DO(STORESVAR1, "Pop TOS and store to string variable 1.", 1)    \
-        DO(STORESVAR2, "Pop TOS and store to string variable 0.", 1)    \
-        DO(STORESVAR3, "Pop TOS and store to string variable 3.", 1)    \
-        DO(LOADDVAR, "Load double from variable, whose 2-byte is id inlined to insn stream, push on TOS.", 3) \
-        DO(LOADIVAR, "Load int from variable, whose 2-byte id is inlined to insn stream, push on TOS.", 3) \
-        DO(LOADSVAR, "Load string from variable, whose 2-byte id is inlined to insn stream, push on TOS.", 3) \
-        DO(STOREDVAR, "Pop TOS and store to double variable, whose 2-byte id is inlined to insn stream.", 3) \
-        DO(STOREIVAR, "Pop TOS and store to int variable, whose 2-byte id is inlined to insn stream.", 3) \
-        DO(STORESVAR, "Pop TOS and store to string variable, whose 2-byte id is inlined to insn stream.", 3) \
-        DO(LOADCTXDVAR, "Load double from variable, whose 2-byte context and 2-byte id inlined to insn stream, push on TOS.", 5) \
-        DO(LOADCTXIVAR, "Load int from variable, whose 2-byte context and 2-byte id is inlined to insn stream, push on TOS.", 5) \
-        DO(LOADCTXSVAR, "Load string from variable, whose 2-byte context and 2-byte id is inlined to insn stream, push on TOS.", 5) \
-        DO(STORECTXDVAR, "Pop TOS and store to double variable, whose 2-byte context and 2-byte id is inlined to insn stream.", 5) \
-        DO(STORECTXIVAR, "Pop TOS and store to int variable, whose 2-byte context and 2-byte id is inlined to insn stream.", 5) \
-        DO(STORECTXSVAR, "Pop TOS and store to string variable, whose 2-byte context and 2-byte id is inlined to insn stream.", 5) \
-        DO(DCMP, "Compare 2 topmost doubles, pushing libc-stryle comparator value cmp(upper, lower) as integer.", 1) \
-        DO(ICMP, "Compare 2 topmost ints, pushing libc-style comparator value cmp(upper, lower) as integer.", 1) \
-        DO(JA, "Jump always, next two bytes - signed offset of jump destination.", 3) \
-        DO(IFICMPNE, "Compare two topmost integers and jump if upper != lower, next two bytes - signed offset of jump destination. Pop two ints on TOP.", 3) \
-        DO(IFICMPE, "Compare two topmost integers and jump if upper == lower, next two bytes - signed offset of jump destination.  Pop two ints on TOP.", 3) \
-        DO(IFICMPG, "Compare two topmost integers and jump if upper > lower, next two bytes - signed offset of jump destination.  Pop two ints on TOP.", 3) \
-        DO(IFICMPGE, "Compare two topmost integers and jump if upper >= lower, next two bytes - signed offset of jump destination.  Pop two ints on TOP.", 3) \
-        DO(IFICMPL, "Compare two topmost integers and jump if upper < lower, next two bytes - signed offset of jump destination.  Pop two ints on TOP.", 3) \
-        DO(IFICMPLE, "Compare two topmost integers and jump if upper <= lower, next two bytes - signed offset of jump destination.  Pop two ints on TOP.", 3) \
-        DO(DUMP, "Dump value on TOS, without removing it.", 1)        \
-        DO(STOP, "Stop execution.", 1)                                  \
-        DO(CALL, "Call function, next two bytes - unsigned function id.", 3) \
-        DO(CALLNATIVE, "Call native function, next two bytes - id of the native function.", 3)  \
-        DO(RETURN, "Return to call location", 1) \
-        DO(BREAK, "Breakpoint for the debugger.", 1)
+        DO(INVALID, "Invalid instruction.", 1, 0, 0)                    \
+        DO(DLOAD, "Load double on TOS, inlined into insn stream.", 9, 0, 1) \
+        DO(ILOAD, "Load int on TOS, inlined into insn stream.", 9, 0, 1) \
+        DO(SLOAD, "Load string reference on TOS, next two bytes - constant id.", 3, 0, 1) \
+        DO(DLOAD0, "Load double 0 on TOS.", 1, 0, 1)                    \
+        DO(ILOAD0, "Load int 0 on TOS.", 1, 0, 1)                       \
+        DO(SLOAD0, "Load empty string on TOS.", 1, 0, 1)                \
+        DO(DLOAD1, "Load double 1 on TOS.", 1, 0, 1)                    \
+        DO(ILOAD1, "Load int 1 on TOS.", 1, 0, 1)                       \
+        DO(DLOADM1, "Load double -1 on TOS.", 1, 0, 1)                  \
+        DO(ILOADM1, "Load int -1 on TOS.", 1, 0, 1)                     \
+        DO(DADD, "Add 2 doubles on TOS, push value back.", 1, 2, 1)     \
+        DO(IADD, "Add 2 ints on TOS, push value back.", 1, 2, 1)        \
+        DO(DSUB, "Subtract 2 doubles on TOS (lower from upper), push value back.", 1, 2, 1) \
+        DO(ISUB, "Subtract 2 ints on TOS (lower from upper), push value back.", 1, 2, 1) \
+        DO(DMUL, "Multiply 2 doubles on TOS, push value back.", 1, 2, 1) \
+        DO(IMUL, "Multiply 2 ints on TOS, push value back.", 1, 2, 1)   \
+        DO(DDIV, "Divide 2 doubles on TOS (upper to lower), push value back.", 1, 2, 1) \
+        DO(IDIV, "Divide 2 ints on TOS (upper to lower), push value back.", 1, 2, 1) \
+        DO(IMOD, "Modulo operation on 2 ints on TOS (upper to lower), push value back.", 1, 2, 1) \
+        DO(DNEG, "Negate double on TOS.", 1, 1, 1)                      \
+        DO(INEG, "Negate int on TOS.", 1, 1, 1)                         \
+        DO(IAOR, "Arithmetic OR of 2 ints on TOS, push value back.", 1, 2, 1) \
+        DO(IAAND, "Arithmetic AND of 2 ints on TOS, push value back.", 1, 2, 1) \
+        DO(IAXOR, "Arithmetic XOR of 2 ints on TOS, push value back.", 1, 2, 1) \
+        DO(IPRINT, "Pop and print integer TOS.", 1, 1, 0)               \
+        DO(DPRINT, "Pop and print double TOS.", 1, 1, 0)                \
+        DO(SPRINT, "Pop and print string TOS.", 1, 1, 0)                \
+        DO(I2D,  "Convert int on TOS to double.", 1, 1, 1)              \
+        DO(D2I,  "Convert double on TOS to int.", 1, 1, 1)              \
+        DO(S2I,  "Convert string on TOS to int.", 1, 1, 1)              \
+        DO(ISWAP, "Swap 2 topmost ints on TOP.", 1, 2, 2)               \
+        DO(DSWAP, "Swap 2 topmost doubles on TOP.", 1, 2, 2)            \
+        DO(SSWAP, "Swap 2 topmost values.", 1, 2, 2)                    \
+        DO(POP, "Remove topmost value.", 1, 1, 0)                       \
+        DO(LOADDVAR0, "Load double from variable 0, push on TOS.", 1, 0, 1) \
+        DO(LOADDVAR1, "Load double from variable 1, push on TOS.", 1, 0, 1) \
+        DO(LOADDVAR2, "Load double from variable 2, push on TOS.", 1, 0, 1) \
+        DO(LOADDVAR3, "Load double from variable 3, push on TOS.", 1, 0, 1) \
+        DO(LOADIVAR0, "Load int from variable 0, push on TOS.", 1, 0, 1) \
+        DO(LOADIVAR1, "Load int from variable 1, push on TOS.", 1, 0, 1) \
+        DO(LOADIVAR2, "Load int from variable 2, push on TOS.", 1, 0, 1) \
+        DO(LOADIVAR3, "Load int from variable 3, push on TOS.", 1, 0, 1) \
+        DO(LOADSVAR0, "Load string from variable 0, push on TOS.", 1, 0, 1) \
+        DO(LOADSVAR1, "Load string from variable 1, push on TOS.", 1, 0, 1) \
+        DO(LOADSVAR2, "Load string from variable 2, push on TOS.", 1, 0, 1) \
+        DO(LOADSVAR3, "Load string from variable 3, push on TOS.", 1, 0, 1) \
+        DO(STOREDVAR0, "Pop TOS and store to double variable 0.", 1, 1, 0) \
+        DO(STOREDVAR1, "Pop TOS and store to double variable 1.", 1, 1, 0) \
+        DO(STOREDVAR2, "Pop TOS and store to double variable 0.", 1, 1, 0) \
+        DO(STOREDVAR3, "Pop TOS and store to double variable 3.", 1, 1, 0) \
+        DO(STOREIVAR0, "Pop TOS and store to int variable 0.", 1, 1, 0) \
+        DO(STOREIVAR1, "Pop TOS and store to int variable 1.", 1, 1, 0) \
+        DO(STOREIVAR2, "Pop TOS and store to int variable 0.", 1, 1, 0) \
+        DO(STOREIVAR3, "Pop TOS and store to int variable 3.", 1, 1, 0) \
+        DO(STORESVAR0, "Pop TOS and store to string variable 0.", 1, 1, 0) \
+        DO(STORESVAR1, "Pop TOS and store to string variable 1.", 1, 1, 0) \
+        DO(STORESVAR2, "Pop TOS and store to string variable 0.", 1, 1, 0) \
+        DO(STORESVAR3, "Pop TOS and store to string variable 3.", 1, 1, 0) \
+        DO(LOADDVAR, "Load double from variable, whose 2-byte is id inlined to insn stream, push on TOS.", 3, 0, 1) \
+        DO(LOADIVAR, "Load int from variable, whose 2-byte id is inlined to insn stream, push on TOS.", 3, 0, 1) \
+        DO(LOADSVAR, "Load string from variable, whose 2-byte id is inlined to insn stream, push on TOS.", 3, 0, 1) \
+        DO(STOREDVAR, "Pop TOS and store to double variable, whose 2-byte id is inlined to insn stream.", 3, 1, 0) \
+        DO(STOREIVAR, "Pop TOS and store to int variable, whose 2-byte id is inlined to insn stream.", 3, 1, 0) \
+        DO(STORESVAR, "Pop TOS and store to string variable, whose 2-byte id is inlined to insn stream.", 3, 1, 0) \
+        DO(LOADCTXDVAR, "Load double from variable, whose 2-byte context and 2-byte id inlined to insn stream, push on TOS.", 5, 0, 1) \
+        DO(LOADCTXIVAR, "Load int from variable, whose 2-byte context and 2-byte id is inlined to insn stream, push on TOS.", 5, 0, 1) \
+        DO(LOADCTXSVAR, "Load string from variable, whose 2-byte context and 2-byte id is inlined to insn stream, push on TOS.", 5, 0, 1) \
+        DO(STORECTXDVAR, "Pop TOS and store to double variable, whose 2-byte context and 2-byte id is inlined to insn stream.", 5, 1, 0) \
+        DO(STORECTXIVAR, "Pop TOS and store to int variable, whose 2-byte context and 2-byte id is inlined to insn stream.", 5, 1, 0) \
+        DO(STORECTXSVAR, "Pop TOS and store to string variable, whose 2-byte context and 2-byte id is inlined to insn stream.", 5, 1, 0) \
+        DO(DCMP, "Compare 2 topmost doubles, pushing libc-stryle comparator value cmp(upper, lower) as integer.", 1, 2, 1) \
+        DO(ICMP, "Compare 2 topmost ints, pushing libc-style comparator value cmp(upper, lower) as integer.", 1, 2, 1) \
+        DO(JA, "Jump always, next two bytes - signed offset of jump destination.", 3, 0, 0) \
+        DO(IFICMPNE, "Compare two topmost integers and jump if upper != lower, next two bytes - signed offset of jump destination. Pop two ints on TOP.", 3, 2, 0) \
+        DO(IFICMPE, "Compare two topmost integers and jump if upper == lower, next two bytes - signed offset of jump destination.  Pop two ints on TOP.", 3, 2, 0) \
+        DO(IFICMPG, "Compare two topmost integers and jump if upper > lower, next two bytes - signed offset of jump destination.  Pop two ints on TOP.", 3, 2, 0) \
+        DO(IFICMPGE, "Compare two topmost integers and jump if upper >= lower, next two bytes - signed offset of jump destination.  Pop two ints on TOP.", 3, 2, 0) \
+        DO(IFICMPL, "Compare two topmost integers and jump if upper < lower, next two bytes - signed offset of jump destination.  Pop two ints on TOP.", 3, 2, 0) \
+        DO(IFICMPLE, "Compare two topmost integers and jump if upper <= lower, next two bytes - signed offset of jump destination.  Pop two ints on TOP.", 3, 2, 0) \
+        DO(DIFCMPNE, "Compare two topmost doubles and jump if upper != lower, next two bytes - signed offset of jump destination. Pop two doubles on TOP.", 3, 2, 0) \
+        DO(DIFCMPE, "Compare two topmost doubles and jump if upper == lower, next two bytes - signed offset of jump destination. Pop two doubles on TOP.", 3, 2, 0) \
+        DO(DIFCMPG, "Compare two topmost doubles and jump if upper > lower, next two bytes - signed offset of jump destination. Pop two doubles on TOP.", 3, 2, 0) \
+        DO(DIFCMPGE, "Compare two topmost doubles and jump if upper >= lower, next two bytes - signed offset of jump destination. Pop two doubles on TOP.", 3, 2, 0) \
+        DO(DIFCMPL, "Compare two topmost doubles and jump if upper < lower, next two bytes - signed offset of jump destination. Pop two doubles on TOP.", 3, 2, 0) \
+        DO(DIFCMPLE, "Compare two topmost doubles and jump if upper <= lower, next two bytes - signed offset of jump destination. Pop two doubles on TOP.", 3, 2, 0) \
+        DO(IFICMPNEVAR, "Compare two int variables, whose 2-byte ids are inlined to insn stream, and jump if first != second, next two bytes - signed offset of jump destination.", 7, 0, 0) \
+        DO(IFICMPEVAR, "Compare two int variables, whose 2-byte ids are inlined to insn stream, and jump if first == second, next two bytes - signed offset of jump destination.", 7, 0, 0) \
+        DO(IFICMPGVAR, "Compare two int variables, whose 2-byte ids are inlined to insn stream, and jump if first > second, next two bytes - signed offset of jump destination.", 7, 0, 0) \
+        DO(IFICMPGEVAR, "Compare two int variables, whose 2-byte ids are inlined to insn stream, and jump if first >= second, next two bytes - signed offset of jump destination.", 7, 0, 0) \
+        DO(IFICMPLVAR, "Compare two int variables, whose 2-byte ids are inlined to insn stream, and jump if first < second, next two bytes - signed offset of jump destination.", 7, 0, 0) \
+        DO(IFICMPLEVAR, "Compare two int variables, whose 2-byte ids are inlined to insn stream, and jump if first <= second, next two bytes - signed offset of jump destination.", 7, 0, 0) \
+        DO(IINCVAR, "Add a constant to int variable, whose 2-byte id and signed 2-byte constant are inlined to insn stream.", 5, 0, 0) \
+        DO(DSQRT, "Replace double on TOS with its square root.", 1, 1, 1) \
+        DO(DSIN, "Replace double on TOS with its sine.", 1, 1, 1)       \
+        DO(DCOS, "Replace double on TOS with its cosine.", 1, 1, 1)     \
+        DO(DPOW, "Pop double x from TOS and y below it, push x raised to the power y.", 1, 2, 1) \
+        DO(DUMP, "Dump value on TOS, without removing it.", 1, 1, 1)    \
+        DO(STOP, "Stop execution.", 1, 0, 0)                            \
+        DO(CALL, "Call function, next two bytes - unsigned function id.", 3, -1, -1) \
+        DO(CALLNATIVE, "Call native function, next two bytes - id of the native function.", 3, -1, -1) \
+        DO(RETURN, "Return to call location", 1, -1, -1)                \
+        DO(BREAK, "Breakpoint for the debugger.", 1, 0, 0)
         
         
 
 typedef enum {
-#define ENUM_ELEM(b, d, l) BC_##b,
+#define ENUM_ELEM(b, d, l, o, u) BC_##b,
     FOR_BYTECODES(ENUM_ELEM)
 #undef ENUM_ELEM
     BC_LAST
@@ -279,7 +298,9 @@ public:
     size_t sizeDoubles;
     size_t sizeInts;
     size_t sizeStrings;
-    
+    // deepest operand stack the body can reach, in values
+    size_t maxStack;
+
 };
 
 class FunctionFilter {
@@ -331,6 +352,9 @@ public:
     const void* nativeById(uint16_t id,
                            const Signature** signature,
                            const string** name) const;
+    uint16_t nativesNumber() const { return _natives.size(); }
+    // including the empty string of id 0
+    size_t constantsNumber() const { return _constants.size(); }
 
     /**
      * Execute this code with passed parameters, and update vars
@@ -406,19 +430,66 @@ class Translator {
     virtual Status* translate(const string& program, Code* *code) = 0;
 };
 
+/**
+ * What running a Program changes: the stacks, the values of the globals
+ * and the strings made while running. Globals keep their values from one
+ * run to the next until reset().
+ */
+class ExecutionContext {
+  public:
+    virtual ~ExecutionContext() {}
+
+    /**
+     * Give the global of var's name and type var's value, or put its
+     * value in var. Strings passed in are copied, strings given back
+     * stay valid until reset().
+     */
+    virtual Status* setGlobal(const Var& var) = 0;
+    virtual Status* getGlobal(Var* var) = 0;
+
+    /**
+     * Run the top level.
+     */
+    virtual Status* execute() = 0;
+
+    /**
+     * Call a function declared in the top level with args, in order and
+     * of the types of its parameters.
+     * result, of its return type or NULL when it returns void, gets the
+     * return value. The function is looked up by name on every call, by
+     * pointer (from code()->functionByName()) it isn't.
+     */
+    virtual Status* call(const string& name, const vector<Var*>& args,
+                         Var* result) = 0;
+    virtual Status* call(const TranslatedFunction* function,
+                         const vector<Var*>& args, Var* result) = 0;
 
-class MachCodeImpl;
-class MachCodeTranslatorImpl : public Translator {
-    Status* translateMachCode(const string& program,
-                              MachCodeImpl* *code);
+    /**
+     * Zero the globals and drop the strings made by the runs so far.
+     * Done after a run that fails.
+     */
+    virtual void reset() = 0;
+};
 
+/**
+ * Code translated once to be run many times, each time in a context of
+ * its own or in one that is reused. Contexts of a program run one at a
+ * time and don't outlive it.
+ */
+class Program {
   public:
-    MachCodeTranslatorImpl();
-    virtual ~MachCodeTranslatorImpl();
+    /**
+     * Translate source with Translator::create(impl), NULL when done.
+     */
+    static Status* create(const string& source, Program* *program,
+                          const string& impl = "");
 
-    virtual Status* translate(const string& program, Code* *code);
+    virtual ~Program() {}
+    virtual Code* code() = 0;
+    virtual ExecutionContext* createContext() = 0;
 };
 
+
 class ErrorInfoHolder {
   protected:
     char _msgBuffer[512];
@@ -0,0 +1,42 @@
+/*
+ * File:   nativeCall.h
+ *
+ * Calls of C functions declared with 'native': the symbol is looked up
+ * once when the program is translated or loaded, and called through a
+ * small machine code stub per signature that moves the arguments from
+ * the operand stack to where the C calling convention wants them.
+ */
+
+#ifndef NATIVECALL_H
+#define	NATIVECALL_H
+
+#include "mathvm.h"
+
+#include <string>
+
+namespace mathvm {
+
+    using namespace std;
+
+    // Calls code with the signature's arguments taken from the operand
+    // stack below top, the first parameter on top, each in an 8-byte
+    // slot. Strings are StringHandles there and are passed as
+    // strings[handle]. Ints are passed and returned whole as 64 bits,
+    // doubles in SSE registers, string results as the pointer returned;
+    // nothing is stored to result for void.
+    typedef void (*NativeTrampoline)(const void* code, const void* top,
+            const char* const* strings, void* result);
+
+    // The address of the C function name in the process and the
+    // libraries it has loaded, NULL when there is none.
+    const void* resolveNative(const string& name);
+
+    // The stub for signature, made on first use and kept for the life
+    // of the process, shared by all signatures with the same types.
+    // NULL when it can't be made: a parameter of type void or more
+    // arguments than the stub handles.
+    NativeTrampoline nativeTrampoline(const Signature& signature);
+
+}
+
+#endif	/* NATIVECALL_H */
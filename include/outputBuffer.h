@@ -0,0 +1,91 @@
+/*
+ * File:   outputBuffer.h
+ *
+ * Where IPRINT, DPRINT and SPRINT go: values are formatted straight into
+ * a large buffer that is handed to a writer when it fills up, before a
+ * native function runs, when execution ends and at exit. Hosts capture
+ * a program's output with a writer of their own.
+ */
+
+#ifndef OUTPUTBUFFER_H
+#define	OUTPUTBUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace mathvm {
+
+    class OutputWriter {
+    public:
+
+        virtual ~OutputWriter() {
+        }
+
+        // all of data, length is never 0
+        virtual void write(const char* data, size_t length) = 0;
+    };
+
+    // Writes through a stdio stream, so the output stays in order with
+    // what natives print with printf.
+    class FileWriter : public OutputWriter {
+        FILE* file;
+    public:
+
+        explicit FileWriter(FILE* file_) : file(file_) {
+        }
+
+        virtual void write(const char* data, size_t length);
+    };
+
+    // Formats as an ostream with default flags does: doubles with six
+    // significant digits as %g. Not thread safe, one execution writes to
+    // a buffer at a time.
+    class OutputBuffer {
+        OutputWriter* writer;
+        char* data;
+        size_t used;
+        size_t capacity;
+
+        // room for the longest formatted number
+        static const size_t NUMBER_SIZE = 32;
+
+        char* reserve(size_t length) {
+            if (capacity - used < length) {
+                flush();
+            }
+            return data + used;
+        }
+
+        OutputBuffer(const OutputBuffer&);
+        OutputBuffer& operator=(const OutputBuffer&);
+
+    public:
+
+        static const size_t DEFAULT_CAPACITY = 64 << 10;
+
+        // the writer is the caller's and outlives the buffer
+        explicit OutputBuffer(OutputWriter* writer_,
+                size_t capacity_ = DEFAULT_CAPACITY);
+        // flushes
+        ~OutputBuffer();
+
+        void writeInt(int64_t value);
+        void writeDouble(double value);
+        void writeString(const char* value);
+
+        // hands what is buffered to the writer
+        void flush() {
+            if (used != 0) {
+                writer->write(data, used);
+                used = 0;
+            }
+        }
+
+        // to stdout, flushed at exit
+        static OutputBuffer& standard();
+    };
+
+}
+
+#endif	/* OUTPUTBUFFER_H */
@@ -9,6 +9,8 @@ namespace mathvm {
 
 // We implement simple top down parser.
 class Parser : public ErrorInfoHolder {
+    // all of the tree, freed with the parser
+    AstArena _arena;
     AstFunction* _top;
     Scope* _currentScope;
     Scope* _topmostScope;
@@ -19,10 +21,12 @@ class Parser : public ErrorInfoHolder {
     void error(const char* msg, ...);
     TokenKind currentToken();
     TokenKind lookaheadToken(uint32_t count);
-    string currentTokenValue();
+    TokenValue currentTokenValue();
+    // the current identifier, interned
+    Symbol currentTokenSymbol();
     void consumeToken();
     void ensureToken(TokenKind token);
-    void ensureKeyword(const string& keyword);
+    void ensureKeyword(const char* keyword);
 
     void pushScope();
     void popScope();
@@ -43,8 +47,8 @@ class Parser : public ErrorInfoHolder {
     BlockNode* parseBlock(bool needBraces);
     AstNode* parseDeclaration(VarType type);
 
-    static int64_t parseInt(const string& str);
-    static double  parseDouble(const string& str);
+    static int64_t parseInt(const TokenValue& value);
+    static double  parseDouble(const TokenValue& value);
   public:
     Parser();
     ~Parser();
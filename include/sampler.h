@@ -0,0 +1,107 @@
+/*
+ * File:   sampler.h
+ *
+ * Sampling profiler for interpreted code: SIGPROF fires every interval
+ * of CPU time and the handler copies the interpreter's call stack of
+ * (function, bci) pairs. Source lines come from the functions' position
+ * tables.
+ */
+
+#ifndef SAMPLER_H
+#define	SAMPLER_H
+
+#include "mathvm.h"
+#include "bytecodeCode.h"
+
+#include <signal.h>
+#include <vector>
+
+namespace mathvm {
+
+    using namespace std;
+
+    class SamplingProfiler {
+    public:
+
+        // frames of the interpreter, written as it calls and returns
+        struct Frame {
+            uint32_t function;
+            volatile uint32_t bci;
+        };
+
+        static const uint32_t DEFAULT_INTERVAL_US = 1000;
+        // frames past it share one slot, a sample there shows the
+        // outermost MAX_DEPTH and the innermost
+        static const size_t MAX_DEPTH = 1024;
+
+    private:
+
+        Frame frames[MAX_DEPTH + 1];
+        volatile sig_atomic_t depth;
+        uint32_t interval;
+
+        // samples, each its depth followed by (function, bci) pairs
+        // from the outermost frame; filled by the signal handler only
+        vector<uint32_t> samples;
+        volatile size_t used;
+        volatile size_t dropped;
+        size_t count;
+        struct sigaction previous;
+
+        static SamplingProfiler* active;
+        static void onSignal(int signal);
+        void record();
+
+    public:
+
+        explicit SamplingProfiler(uint32_t intervalUs = DEFAULT_INTERVAL_US);
+        ~SamplingProfiler();
+
+        // one profiler samples at a time; false if the timer can't be set
+        bool start();
+        void stop();
+
+        // the interpreter's side, cheap enough to do on every instruction
+        Frame* enter(uint16_t function) {
+            Frame* frame = &frames[depth < (sig_atomic_t) MAX_DEPTH ? depth : MAX_DEPTH];
+            frame->function = function;
+            frame->bci = 0;
+            // the frame is complete before a sample can see it
+            __asm__ __volatile__("" ::: "memory");
+            depth = depth + 1;
+            return frame;
+        }
+
+        Frame* leave() {
+            depth = depth - 1;
+            return depth == 0 ? NULL
+                    : &frames[depth <= (sig_atomic_t) MAX_DEPTH ? depth - 1 : MAX_DEPTH];
+        }
+
+        // back to depth frames, after an error unwound the rest
+        void unwind(sig_atomic_t depth_) {
+            depth = depth_;
+        }
+
+        sig_atomic_t currentDepth() const {
+            return depth;
+        }
+
+        // samples taken, those that didn't fit included
+        size_t samplesCount() const {
+            return count;
+        }
+
+        // Self and inclusive samples per function, then self samples per
+        // source line, lines resolved in source.
+        void reportFlat(ostream& out, const Code& code,
+                const string& source) const;
+        // one "outer;...;inner count" line per distinct stack, frames as
+        // function:line, the input flamegraph.pl takes
+        void reportCollapsed(ostream& out, const Code& code,
+                const string& source) const;
+    };
+
+}
+
+#endif	/* SAMPLER_H */
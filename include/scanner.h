@@ -4,29 +4,72 @@
 #include "mathvm.h"
 #include "ast.h"
 
+#include <string.h>
+
 namespace mathvm {
 
+// Text of a token, in the source or in the token list; valid as long
+// as both are.
+class TokenValue {
+    const char* _data;
+    uint32_t _length;
+
+  public:
+    TokenValue(const char* data = "", uint32_t length = 0) :
+        _data(data), _length(length) {
+    }
+
+    const char* data() const { return _data; }
+    uint32_t length() const { return _length; }
+    string str() const { return string(_data, _length); }
+
+    bool operator==(const char* word) const {
+        return strncmp(_data, word, _length) == 0 && word[_length] == '\0';
+    }
+    bool operator!=(const char* word) const {
+        return !(*this == word);
+    }
+};
+
+// Tokens refer to the source scanned, which has to outlive the list,
+// instead of holding copies of their text.
 class TokenList {
     struct TokenInfo {
         TokenKind _kind;
-        string _value;
         uint32_t _position;
+        // the value: _length bytes of the source at _position, or of
+        // _text at _textOffset for strings with escapes
+        uint32_t _length;
+        uint32_t _textOffset;
 
-        TokenInfo(TokenKind kind,
-                  const string& value,
-                  uint32_t position) :
-            _kind(kind), _value(value), _position(position) {
+        TokenInfo(TokenKind kind, uint32_t position, uint32_t length,
+                  uint32_t textOffset) :
+            _kind(kind), _position(position), _length(length),
+            _textOffset(textOffset) {
         }
     };
+    static const uint32_t IN_SOURCE = 0xffffffff;
+
+    const string* _source;
     vector<TokenInfo> _tokens;
+    string _text;
 
   public:
-    TokenList() {
+    TokenList() : _source(0) {
     }
-    void add(uint32_t position, TokenKind kind, const string& value = "");
+    // before the tokens of source are added
+    void setSource(const string* source, size_t expectedTokens);
+    void add(uint32_t position, TokenKind kind, uint32_t length = 0);
+    // a value the source doesn't spell, copied
+    void add(uint32_t position, TokenKind kind, const string& value);
     uint32_t positionOf(uint32_t index) const;
-    TokenKind kindAt(uint32_t index);
-    const string valueAt(uint32_t index);
+    TokenKind kindAt(uint32_t index) const {
+        if (index >= _tokens.size()) {
+            return tEOF;
+        }
+        return _tokens[index]._kind;
+    }
+    TokenValue valueAt(uint32_t index) const;
     void dump();
 };
 
@@ -38,6 +81,10 @@ class Scanner : ErrorInfoHolder {
     TokenKind _kind;
     TokenList* _tokens;
 
+    // a bit under what the test programs average, the token vector is
+    // sized from it once
+    static const size_t BYTES_PER_TOKEN = 3;
+
     static bool isLetter(char ch);
     static bool isDigit(char ch);
     static bool isWhitespace(char ch);
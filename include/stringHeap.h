@@ -0,0 +1,105 @@
+/*
+ * File:   stringHeap.h
+ *
+ * The strings of one execution, referred to by handles: the code's
+ * constants and whatever comes up while running, such as the root vars'
+ * values and what natives return.
+ */
+
+#ifndef STRINGHEAP_H
+#define	STRINGHEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <vector>
+
+namespace mathvm {
+
+    using namespace std;
+
+    // What operand stack and frame slots of type string hold. Handles
+    // below the number of constants are the constants' ids.
+    typedef uint32_t StringHandle;
+
+    // A handle and the pointer get() returns for it stay valid as long
+    // as the heap. Strings the heap copies are packed into big chunks
+    // and interned: the same text gets the same handle. What natives
+    // return is kept by address instead, C code may write to it or free
+    // it, and the same address gets the same handle, so a native called
+    // in a loop takes one handle per distinct result, not one per call.
+    class StringHeap {
+        // by handle, what natives get passed as strings
+        vector<const char*> strings;
+        vector<uint32_t> hashes;
+        // by handle, whether its text is in slots
+        vector<bool> indexed;
+        // handle + 1 per slot, 0 when free, at most half used
+        vector<uint32_t> slots;
+        map<const char*, StringHandle> foreign;
+        vector<char*> chunks;
+        char* cursor;
+        size_t left;
+
+        static const size_t CHUNK_SIZE = 64 << 10;
+
+        void grow();
+        // puts the indexed strings in that many slots
+        void rehash(size_t size);
+        // slot of the string, or the free one it would go to
+        uint32_t slotOf(const char* str, size_t length, uint32_t hash) const;
+        StringHandle add(const char* str, uint32_t hash, uint32_t slot);
+        char* allocate(size_t size);
+
+        StringHeap(const StringHeap&);
+        StringHeap& operator=(const StringHeap&);
+
+    public:
+
+        // how far the heap went, see release()
+        struct Mark {
+            size_t size;
+            size_t chunks;
+            char* cursor;
+            size_t left;
+        };
+
+        StringHeap();
+        ~StringHeap();
+
+        // A new handle for str, which isn't copied and has to outlive
+        // the heap, even if the text is there already; constants go in
+        // this way in id order so their handles are their ids.
+        StringHandle adopt(const char* str);
+
+        // The handle of the text of str, a copy of it if new.
+        StringHandle intern(const char* str);
+
+        // The handle of the string at str, not copied nor looked at;
+        // whoever made it keeps it alive while the heap is used.
+        StringHandle wrap(const char* str);
+
+        const char* get(StringHandle handle) const {
+            return strings[handle];
+        }
+
+        // indexed by handle
+        const char* const* table() const {
+            return &strings[0];
+        }
+
+        size_t size() const {
+            return strings.size();
+        }
+
+        Mark mark() const;
+
+        // Forgets the handles made since mark was taken and frees the
+        // copies made for them, what get() returned for those dangles.
+        void release(const Mark& mark);
+    };
+
+}
+
+#endif	/* STRINGHEAP_H */
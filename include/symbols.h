@@ -0,0 +1,115 @@
+/*
+ * File:   symbols.h
+ *
+ * Interned names, so symbol tables compare and hash small integers
+ * instead of strings.
+ */
+
+#ifndef SYMBOLS_H
+#define	SYMBOLS_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace mathvm {
+
+    using namespace std;
+
+    // Ids of interned strings, dense from 0 in the order first seen.
+    typedef uint32_t Symbol;
+
+    // The process-wide interner. Names are never dropped, the
+    // references name() returns stay valid. Not synchronized: symbols
+    // are made by the parser, later passes only look names up.
+    class Symbols {
+    public:
+        static Symbol intern(const char* data, uint32_t length);
+
+        static Symbol intern(const string& str) {
+            return intern(str.data(), str.size());
+        }
+
+        static const string& name(Symbol symbol);
+
+        static uint32_t count();
+    };
+
+    // Open addressing table from symbols to values, iterated in the
+    // order keys were first inserted, so what is built from it does not
+    // depend on the hash. Entries are never removed.
+    template<class V> class SymbolMap {
+        vector<pair<Symbol, V> > _entries;
+        // entry index + 1 per slot, 0 when free; a power of two sized
+        // at least twice the entries
+        vector<uint32_t> _slots;
+
+        static uint32_t hash(Symbol symbol) {
+            return symbol * 0x9e3779b1u;
+        }
+
+        // slot of symbol, or the free one it would go to
+        uint32_t slotOf(Symbol symbol) const {
+            uint32_t mask = _slots.size() - 1;
+            uint32_t slot = hash(symbol) & mask;
+            while (_slots[slot] != 0 && _entries[_slots[slot] - 1].first != symbol) {
+                slot = (slot + 1) & mask;
+            }
+            return slot;
+        }
+
+        void grow() {
+            _slots.assign(_slots.empty() ? 8 : _slots.size() * 2, 0);
+            for (uint32_t i = 0; i < _entries.size(); i++) {
+                _slots[slotOf(_entries[i].first)] = i + 1;
+            }
+        }
+
+    public:
+
+        uint32_t size() const {
+            return _entries.size();
+        }
+
+        Symbol symbolAt(uint32_t index) const {
+            return _entries[index].first;
+        }
+
+        V valueAt(uint32_t index) const {
+            return _entries[index].second;
+        }
+
+        // NULL when absent
+        V* find(Symbol symbol) {
+            if (_entries.empty()) {
+                return NULL;
+            }
+            uint32_t index = _slots[slotOf(symbol)];
+            return index == 0 ? NULL : &_entries[index - 1].second;
+        }
+
+        // false, leaving the value, when symbol is there already
+        bool insert(Symbol symbol, V value) {
+            if (2 * (_entries.size() + 1) > _slots.size()) {
+                grow();
+            }
+            uint32_t slot = slotOf(symbol);
+            if (_slots[slot] != 0) {
+                return false;
+            }
+            _entries.push_back(make_pair(symbol, value));
+            _slots[slot] = _entries.size();
+            return true;
+        }
+
+        void set(Symbol symbol, V value) {
+            if (!insert(symbol, value)) {
+                *find(symbol) = value;
+            }
+        }
+    };
+
+}
+
+#endif	/* SYMBOLS_H */
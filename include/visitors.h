@@ -20,26 +20,6 @@ class AstBaseVisitor : public AstVisitor {
 #undef VISITOR_FUNCTION
 };
 
-class DeleteVisitor : public AstVisitor {
-public:
-    DeleteVisitor() {}
-
-    void performDelete(AstNode* root) {
-        if (root) {
-            root->visit(this);
-        }
-    }
-
-#define VISITOR_FUNCTION(type, name)            \
-    virtual void visit##type(type* node) {      \
-      assert(!node->isFunctionNode());          \
-      node->visitChildren(this);                \
-      delete node;                              \
-    }
-    FOR_NODES(VISITOR_FUNCTION)
-#undef VISITOR_FUNCTION
-};
-
 class AstDumper : public AstVisitor {
 public:
     AstDumper() {}
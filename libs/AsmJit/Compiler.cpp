@@ -264,10 +264,17 @@ Emittable* ETarget::translate(CompilerContext& cc) ASMJIT_NOTHROW
 
   if (cc._unrecheable)
   {
+    // Only jumps not translated yet lead here, one of them will give the
+    // state. Come back when it does, see CompilerContext::addDeferredTarget().
+    if (_state == NULL)
+    {
+      cc.addDeferredTarget(this);
+      return NULL;
+    }
+
     cc._unrecheable = 0;
 
     // Assign state to the compiler context. 
-    ASMJIT_ASSERT(_state != NULL);
     cc._assignState(_state);
   }
   else
@@ -3597,7 +3597,14 @@ Emittable* ECall::translate(CompilerContext& cc) ASMJIT_NOTHROW
       {
         VarCallRecord* rdst = reinterpret_cast<VarCallRecord*>(vdst->tempPtr);
 
-        if (rdst->inDone >= rdst->inCount && (rdst->flags & VarCallRecord::FLAG_CALL_OPERAND_REG) == 0)
+        if (rdst < _variables || rdst >= _variables + variablesCount)
+        {
+          // Not used by this call, tempPtr may be left over from a state
+          // switch. The register is needed for the argument, spill it.
+          cc.spillVar(vdst);
+          vdst = NULL;
+        }
+        else if (rdst->inDone >= rdst->inCount && (rdst->flags & VarCallRecord::FLAG_CALL_OPERAND_REG) == 0)
         {
           // Safe to spill.
           if (rdst->outCount || vdst->lastEmittable == this)
@@ -5109,6 +5116,8 @@ void CompilerContext::_clear() ASMJIT_NOTHROW
 
   _backCode.clear();
   _backPos = 0;
+
+  _deferredTargets.clear();
 }
 
 // ============================================================================
@@ -6418,17 +6427,44 @@ void CompilerContext::addForwardJump(EJmp* inst) ASMJIT_NOTHROW
   _forwardJumps = j;
 }
 
+void CompilerContext::addDeferredTarget(ETarget* target) ASMJIT_NOTHROW
+{
+  _deferredTargets.append(target);
+}
+
+ETarget* CompilerContext::nextDeferredTarget() ASMJIT_NOTHROW
+{
+  ETarget* dead = NULL;
+  sysuint_t len = _deferredTargets.getLength();
+
+  for (sysuint_t i = 0; i < len; i++)
+  {
+    ETarget* target = _deferredTargets[i];
+    if (target->isTranslated()) continue;
+    if (target->getState() != NULL) return target;
+    if (dead == NULL) dead = target;
+  }
+
+  // Never executed, any state does.
+  if (dead != NULL) _unrecheable = 0;
+  return dead;
+}
+
 StateData* CompilerContext::_saveState() ASMJIT_NOTHROW
 {
-  // Get count of variables stored in memory.
+  // Get count of variables stored in memory. All variables of the function
+  // are checked, not only the active ones, because the code after a jump may
+  // be translated before the code in between, ending the scope of a variable
+  // which is still used there.
   uint32_t memVarsCount = 0;
-  VarData* cur = _active;
-  if (cur)
+  uint32_t variablesCount = (uint32_t)_compiler->_varData.getLength();
+  uint32_t v;
+  VarData* cur;
+
+  for (v = 0; v < variablesCount; v++)
   {
-    do {
-      if (cur->state == VARIABLE_STATE_MEMORY) memVarsCount++;
-      cur = cur->nextActive;
-    } while (cur != _active);
+    cur = _compiler->_varData[v];
+    if (cur->scope == _function && cur->state == VARIABLE_STATE_MEMORY) memVarsCount++;
   }
 
   // Alloc StateData structure (using zone allocator) and copy current state into it.
@@ -6463,13 +6499,10 @@ StateData* CompilerContext::_saveState() ASMJIT_NOTHROW
   state->memVarsCount = memVarsCount;
   memVarsCount = 0;
 
-  cur = _active;
-  if (cur)
+  for (v = 0; v < variablesCount; v++)
   {
-    do {
-      if (cur->state == VARIABLE_STATE_MEMORY) state->memVarsData[memVarsCount++] = cur;
-      cur = cur->nextActive;
-    } while (cur != _active);
+    cur = _compiler->_varData[v];
+    if (cur->scope == _function && cur->state == VARIABLE_STATE_MEMORY) state->memVarsData[memVarsCount++] = cur;
   }
 
   // Finished.
@@ -6486,14 +6519,16 @@ void CompilerContext::_assignState(StateData* state) ASMJIT_NOTHROW
   uint i, mask;
   VarData* vdata;
 
-  // Unuse all variables first.
-  vdata = _active;
-  if (vdata)
+  // Unuse all variables first, see _saveState() why not only the active ones.
+  uint32_t variablesCount = (uint32_t)compiler->_varData.getLength();
+  for (i = 0; i < variablesCount; i++)
   {
-    do {
+    vdata = compiler->_varData[i];
+    if (vdata->scope == _function)
+    {
       vdata->state = VARIABLE_STATE_UNUSED;
-      vdata = vdata->nextActive;
-    } while (vdata != _active);
+      vdata->registerIndex = INVALID_VALUE;
+    }
   }
 
   // Assign variables stored in memory which are not unused.
@@ -6652,8 +6687,12 @@ void CompilerContext::_restoreState(StateData* state, uint32_t targetOffset) ASM
     else if (fromVar != NULL)
     {
       uint32_t mask = Util::maskFromIndex(regIndex);
-      // Variables are the same, we just need to compare changed flags.
-      if ((fromState->changedGP & mask) && !(toState->changedGP & mask))
+      uint32_t toChanged = (i < 16) ? toState->changedGP :
+                           (i < 24) ? toState->changedMM : toState->changedXMM;
+      // Variables are the same, we just need to compare changed flags. The
+      // current state's masks are only set by _assignState(), the variable
+      // knows whether it changed since.
+      if (fromVar->changed && !(toChanged & mask))
       {
         saveVar(fromVar);
       }
@@ -7723,6 +7762,8 @@ void CompilerCore::serialize(Assembler& a) ASMJIT_NOTHROW
 
         cur = NULL;
       }
+
+      if (cur == NULL) cur = cc.nextDeferredTarget();
     } while (cur);
 
     // Translate forward jumps.
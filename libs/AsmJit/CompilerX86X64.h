@@ -1507,6 +1507,19 @@ struct ASMJIT_API CompilerContext
 
   void addForwardJump(EJmp* inst) ASMJIT_NOTHROW;
 
+  // --------------------------------------------------------------------------
+  // [Deferred Target]
+  // --------------------------------------------------------------------------
+
+  //! @brief Target met in unreachable code before any jump to it was
+  //! translated, so without a state to translate it with.
+  void addDeferredTarget(ETarget* target) ASMJIT_NOTHROW;
+
+  //! @brief Untranslated deferred target to go on from, one with a state if
+  //! any, NULL when none is left. Targets no translated jump leads to are
+  //! dead code and get translated with the current state.
+  ETarget* nextDeferredTarget() ASMJIT_NOTHROW;
+
   // --------------------------------------------------------------------------
   // [State]
   // --------------------------------------------------------------------------
@@ -1609,6 +1622,9 @@ struct ASMJIT_API CompilerContext
   PodVector<EJmp*> _backCode;
   //! @brief Backward code position (starts at 0).
   sysuint_t _backPos;
+
+  //! @brief Targets filled by @c addDeferredTarget().
+  PodVector<ETarget*> _deferredTargets;
 };
 
 // ============================================================================
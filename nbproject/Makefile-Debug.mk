@@ -52,14 +52,25 @@ OBJECTFILES= \
 	${OBJECTDIR}/src/ast.o \
 	${OBJECTDIR}/src/bytecode.o \
 	${OBJECTDIR}/src/bytecodeCode.o \
+	${OBJECTDIR}/src/bytecodeFile.o \
 	${OBJECTDIR}/src/bytecodeInterpretator.o \
+	${OBJECTDIR}/src/bytecodePeephole.o \
+	${OBJECTDIR}/src/bytecodeProgram.o \
+	${OBJECTDIR}/src/bytecodeResolver.o \
 	${OBJECTDIR}/src/bytecodeTranslator.o \
+	${OBJECTDIR}/src/bytecodeVerifier.o \
 	${OBJECTDIR}/src/interpreter.o \
+	${OBJECTDIR}/src/compileCache.o \
 	${OBJECTDIR}/src/jit.o \
 	${OBJECTDIR}/src/main.o \
 	${OBJECTDIR}/src/mathvm.o \
+	${OBJECTDIR}/src/nativeCall.o \
+	${OBJECTDIR}/src/outputBuffer.o \
 	${OBJECTDIR}/src/parser.o \
+	${OBJECTDIR}/src/sampler.o \
 	${OBJECTDIR}/src/scanner.o \
+	${OBJECTDIR}/src/stringHeap.o \
+	${OBJECTDIR}/src/symbols.o \
 	${OBJECTDIR}/src/translator.o \
 	${OBJECTDIR}/src/utils.o
 
@@ -78,7 +89,7 @@ FFLAGS=
 ASFLAGS=
 
 # Link Libraries and Options
-LDLIBSOPTIONS=
+LDLIBSOPTIONS=-lpthread -ldl
 
 # Build Targets
 .build-conf: ${BUILD_SUBPROJECTS}
@@ -173,21 +184,51 @@ ${OBJECTDIR}/src/bytecodeCode.o: src/bytecodeCode.cpp
 	${RM} $@.d
 	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/bytecodeCode.o src/bytecodeCode.cpp
 
+${OBJECTDIR}/src/bytecodeFile.o: src/bytecodeFile.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src
+	${RM} $@.d
+	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/bytecodeFile.o src/bytecodeFile.cpp
+
 ${OBJECTDIR}/src/bytecodeInterpretator.o: src/bytecodeInterpretator.cpp 
 	${MKDIR} -p ${OBJECTDIR}/src
 	${RM} $@.d
 	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/bytecodeInterpretator.o src/bytecodeInterpretator.cpp
 
+${OBJECTDIR}/src/bytecodePeephole.o: src/bytecodePeephole.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src
+	${RM} $@.d
+	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/bytecodePeephole.o src/bytecodePeephole.cpp
+
+${OBJECTDIR}/src/bytecodeProgram.o: src/bytecodeProgram.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src
+	${RM} $@.d
+	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/bytecodeProgram.o src/bytecodeProgram.cpp
+
+${OBJECTDIR}/src/bytecodeResolver.o: src/bytecodeResolver.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src
+	${RM} $@.d
+	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/bytecodeResolver.o src/bytecodeResolver.cpp
+
 ${OBJECTDIR}/src/bytecodeTranslator.o: src/bytecodeTranslator.cpp 
 	${MKDIR} -p ${OBJECTDIR}/src
 	${RM} $@.d
 	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/bytecodeTranslator.o src/bytecodeTranslator.cpp
 
+${OBJECTDIR}/src/bytecodeVerifier.o: src/bytecodeVerifier.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src
+	${RM} $@.d
+	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/bytecodeVerifier.o src/bytecodeVerifier.cpp
+
 ${OBJECTDIR}/src/interpreter.o: src/interpreter.cpp 
 	${MKDIR} -p ${OBJECTDIR}/src
 	${RM} $@.d
 	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/interpreter.o src/interpreter.cpp
 
+${OBJECTDIR}/src/compileCache.o: src/compileCache.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src
+	${RM} $@.d
+	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/compileCache.o src/compileCache.cpp
+
 ${OBJECTDIR}/src/jit.o: src/jit.cpp 
 	${MKDIR} -p ${OBJECTDIR}/src
 	${RM} $@.d
@@ -203,16 +244,41 @@ ${OBJECTDIR}/src/mathvm.o: src/mathvm.cpp
 	${RM} $@.d
 	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/mathvm.o src/mathvm.cpp
 
+${OBJECTDIR}/src/nativeCall.o: src/nativeCall.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src
+	${RM} $@.d
+	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/nativeCall.o src/nativeCall.cpp
+
+${OBJECTDIR}/src/outputBuffer.o: src/outputBuffer.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src
+	${RM} $@.d
+	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/outputBuffer.o src/outputBuffer.cpp
+
 ${OBJECTDIR}/src/parser.o: src/parser.cpp 
 	${MKDIR} -p ${OBJECTDIR}/src
 	${RM} $@.d
 	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/parser.o src/parser.cpp
 
+${OBJECTDIR}/src/sampler.o: src/sampler.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src
+	${RM} $@.d
+	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/sampler.o src/sampler.cpp
+
 ${OBJECTDIR}/src/scanner.o: src/scanner.cpp 
 	${MKDIR} -p ${OBJECTDIR}/src
 	${RM} $@.d
 	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/scanner.o src/scanner.cpp
 
+${OBJECTDIR}/src/stringHeap.o: src/stringHeap.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src
+	${RM} $@.d
+	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/stringHeap.o src/stringHeap.cpp
+
+${OBJECTDIR}/src/symbols.o: src/symbols.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src
+	${RM} $@.d
+	$(COMPILE.cc) -g -Iinclude -Ilibs -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/symbols.o src/symbols.cpp
+
 ${OBJECTDIR}/src/translator.o: src/translator.cpp 
 	${MKDIR} -p ${OBJECTDIR}/src
 	${RM} $@.d
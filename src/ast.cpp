@@ -2,9 +2,53 @@
 #include "visitors.h"
 
 #include <iostream>
+#include <string.h>
 
 namespace mathvm {
 
+// (first byte + length) mod KEYWORD_SLOTS differs for all keywords,
+// the constructor asserts it stays so
+static const uint32_t KEYWORD_SLOTS = 32;
+
+static inline uint32_t keywordSlot(const char* word, uint32_t length) {
+    return ((uint8_t) word[0] + length) % KEYWORD_SLOTS;
+}
+
+static const char* const keywordWords[] = {
+#define KEYWORD_WORD(k, w) w,
+    FOR_KEYWORDS(KEYWORD_WORD)
+#undef KEYWORD_WORD
+};
+
+static struct KeywordTable {
+    Keyword slots[KEYWORD_SLOTS];
+
+    KeywordTable() {
+        for (uint32_t i = 0; i < KEYWORD_SLOTS; i++) {
+            slots[i] = kNONE;
+        }
+        for (uint32_t k = 0; k < kNONE; k++) {
+            const char* word = keywordWords[k];
+            uint32_t slot = keywordSlot(word, strlen(word));
+            assert(slots[slot] == kNONE);
+            slots[slot] = (Keyword) k;
+        }
+    }
+} keywordTable;
+
+Keyword keywordOf(const char* word, uint32_t length) {
+    if (length == 0) {
+        return kNONE;
+    }
+    Keyword keyword = keywordTable.slots[keywordSlot(word, length)];
+    if (keyword == kNONE
+            || strncmp(keywordWords[keyword], word, length) != 0
+            || keywordWords[keyword][length] != '\0') {
+        return kNONE;
+    }
+    return keyword;
+}
+
 #define VISIT_FUNCTION(type, name)           \
     void type::visit(AstVisitor* visitor) {  \
         visitor->visit##type(this);          \
@@ -14,15 +58,39 @@ FOR_NODES(VISIT_FUNCTION)
 
 #undef VISIT_FUNCTION
 
-const string AstFunction::top_name = "<top>";
-const string AstFunction::invalid = "<invalid>";
+const size_t AstArena::CHUNK_SIZE;
+
+AstArena::~AstArena() {
+    for (size_t i = 0; i < _scopes.size(); i++) {
+        _scopes[i]->~Scope();
+    }
+    for (size_t i = 0; i < _chunks.size(); i++) {
+        delete[] _chunks[i];
+    }
+}
 
-AstFunction::~AstFunction() {
-  DeleteVisitor terminator;
-  terminator.performDelete(node()->body());
-  delete _function;
+void* AstArena::allocate(size_t size) {
+    // enough for any node member
+    size = (size + 7) & ~(size_t) 7;
+    if ((size_t) (_end - _top) < size) {
+        if (size > CHUNK_SIZE / 4) {
+            // a long list, alone in its chunk; the current one goes on
+            char* chunk = new char[size];
+            _chunks.push_back(chunk);
+            return chunk;
+        }
+        _top = new char[CHUNK_SIZE];
+        _end = _top + CHUNK_SIZE;
+        _chunks.push_back(_top);
+    }
+    void* result = _top;
+    _top += size;
+    return result;
 }
 
+const string AstFunction::top_name = "<top>";
+const string AstFunction::invalid = "<invalid>";
+
 const string& AstFunction::name() const {
     return _function->name();
 }
@@ -47,45 +115,28 @@ Scope* AstFunction::scope() const {
     return _function->body()->scope()->parent();
 }
 
-Scope::~Scope() {
-  for (uint32_t i = 0; i < childScopeNumber(); i++) {
-    delete childScopeAt(i);
-  }
-
-  for (VarMap::iterator it = _vars.begin();
-       it != _vars.end(); ++it) {
-    AstVar* var = (*it).second;
-    delete var;
-  }
-
-  for (FunctionMap::iterator it = _functions.begin();
-       it != _functions.end(); ++it) {
-    AstFunction* function = (*it).second;
-    delete function;
-  }
-}
-
-bool Scope::declareVariable(const string& name, VarType type) {
-    if (lookupVariable(name, false) != 0) {
+bool Scope::declareVariable(Symbol name, VarType type) {
+    if (_vars.find(name) != 0) {
         return false;
     }
-   _vars[name] = new AstVar(name, type, this);
-   return true;
+    _vars.insert(name, new (_arena) AstVar(name, type, this));
+    return true;
 }
 
 bool Scope::declareFunction(FunctionNode* node) {
-    if (lookupFunction(node->name()) != 0) {
+    Symbol name = Symbols::intern(node->name());
+    if (lookupFunction(name) != 0) {
         return false;
     }
-   _functions[node->name()] = new AstFunction(node, this);
+   _functions.insert(name, new (_arena) AstFunction(node, this));
     return true;
 }
 
-AstVar* Scope::lookupVariable(const string& name, bool useParent) {
+AstVar* Scope::lookupVariable(Symbol name, bool useParent) {
     AstVar* result = 0;
-    VarMap::iterator it = _vars.find(name);
-    if (it != _vars.end()) {
-        result = (*it).second;
+    AstVar** found = _vars.find(name);
+    if (found != 0) {
+        result = *found;
     }
     if (!result && useParent && _parent) {
         result = _parent->lookupVariable(name, useParent);
@@ -93,11 +144,11 @@ AstVar* Scope::lookupVariable(const string& name, bool useParent) {
     return result;
 }
 
-  AstFunction* Scope::lookupFunction(const string& name, bool useParent) {
+  AstFunction* Scope::lookupFunction(Symbol name, bool useParent) {
     AstFunction* result = 0;
-    FunctionMap::iterator it = _functions.find(name);
-    if (it != _functions.end()) {
-        result = (*it).second;
+    AstFunction** found = _functions.find(name);
+    if (found != 0) {
+        result = *found;
     }
 
     if (!result && useParent && _parent) {
@@ -108,7 +159,7 @@ AstVar* Scope::lookupVariable(const string& name, bool useParent) {
 }
 
 bool Scope::VarIterator::hasNext() {
-    if (_it != _scope->_vars.end()) {
+    if (_index < _scope->_vars.size()) {
         return true;
     }
     if (!_includeOuter) {
@@ -118,7 +169,7 @@ bool Scope::VarIterator::hasNext() {
         return false;
     }
     _scope = _scope->_parent;
-    _it = _scope->_vars.begin();
+    _index = 0;
 
     return hasNext();
 }
@@ -128,14 +179,12 @@ AstVar* Scope::VarIterator::next() {
         return 0;
     }
 
-    AstVar* next = (*_it).second;
-    _it++;
-    return next;
+    return _scope->_vars.valueAt(_index++);
 }
 
 
 bool Scope::FunctionIterator::hasNext() {
-    if (_it != _scope->_functions.end()) {
+    if (_index < _scope->_functions.size()) {
         return true;
     }
     if (!_includeOuter) {
@@ -145,7 +194,7 @@ bool Scope::FunctionIterator::hasNext() {
         return false;
     }
     _scope = _scope->_parent;
-    _it = _scope->_functions.begin();
+    _index = 0;
 
     return hasNext();
 }
@@ -155,9 +204,7 @@ AstFunction* Scope::FunctionIterator::next() {
         return 0;
     }
 
-    AstFunction* next = (*_it).second;
-    _it++;
-    return next;
+    return _scope->_functions.valueAt(_index++);
 }
 
 }
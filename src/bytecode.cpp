@@ -66,8 +66,28 @@ namespace mathvm {
                 case BC_IFICMPGE:
                 case BC_IFICMPL:
                 case BC_IFICMPLE:
+                case BC_DIFCMPNE:
+                case BC_DIFCMPE:
+                case BC_DIFCMPG:
+                case BC_DIFCMPGE:
+                case BC_DIFCMPL:
+                case BC_DIFCMPLE:
                 case BC_JA:
-                    out << name << " " << getInt16(bci + 1) + bci + 1;
+                    out << name << " " << jumpTarget(bci);
+                    break;
+                case BC_IFICMPNEVAR:
+                case BC_IFICMPEVAR:
+                case BC_IFICMPGVAR:
+                case BC_IFICMPGEVAR:
+                case BC_IFICMPLVAR:
+                case BC_IFICMPLEVAR:
+                    out << name << " @" << getUInt16(bci + 1)
+                            << " @" << getUInt16(bci + 3)
+                            << " " << jumpTarget(bci);
+                    break;
+                case BC_IINCVAR:
+                    out << name << " @" << getUInt16(bci + 1)
+                            << " " << getInt16(bci + 3);
                     break;
                 default:
                     out << name;
@@ -77,6 +97,34 @@ namespace mathvm {
         }
     }
 
+    uint32_t Bytecode::jumpOffsetPos(Instruction insn) {
+        switch (insn) {
+            case BC_JA:
+            case BC_IFICMPNE:
+            case BC_IFICMPE:
+            case BC_IFICMPG:
+            case BC_IFICMPGE:
+            case BC_IFICMPL:
+            case BC_IFICMPLE:
+            case BC_DIFCMPNE:
+            case BC_DIFCMPE:
+            case BC_DIFCMPG:
+            case BC_DIFCMPGE:
+            case BC_DIFCMPL:
+            case BC_DIFCMPLE:
+                return 1;
+            case BC_IFICMPNEVAR:
+            case BC_IFICMPEVAR:
+            case BC_IFICMPGVAR:
+            case BC_IFICMPGEVAR:
+            case BC_IFICMPLVAR:
+            case BC_IFICMPLEVAR:
+                return 5;
+            default:
+                return 0;
+        }
+    }
+
     void Bytecode::addBranch(Instruction insn, Label& target) {
         add((uint8_t) insn);
         if (target.isBound()) {
@@ -2,10 +2,86 @@
 #include "bytecodeCode.h"
 
 #include "bytecodeInterpretator.h"
+#include "sampler.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
 
 namespace mathvm{
+    void BytecodeFunction::setPosition(uint32_t bci, uint32_t offset) {
+        if (!_positions.empty() && _positions.back().first == bci) {
+            // nothing emitted for the previous one
+            _positions.pop_back();
+        }
+        if (_positions.empty() || _positions.back().second != offset) {
+            _positions.push_back(make_pair(bci, offset));
+        }
+    }
+
+    static bool bciBefore(uint32_t bci, const pair<uint32_t, uint32_t>& entry) {
+        return bci < entry.first;
+    }
+
+    uint32_t BytecodeFunction::position(uint32_t bci) const {
+        vector<pair<uint32_t, uint32_t> >::const_iterator next =
+                upper_bound(_positions.begin(), _positions.end(), bci, bciBefore);
+        if (next == _positions.begin()) {
+            return Status::INVALID_POSITION;
+        }
+        return (next - 1)->second;
+    }
+
+    void BytecodeFunction::remapPositions(const vector<uint32_t>& newBci) {
+        vector<pair<uint32_t, uint32_t> > positions;
+        positions.swap(_positions);
+        for (size_t i = 0; i < positions.size(); i++) {
+            if (positions[i].first < newBci.size()) {
+                // a fused sequence keeps the offset of its last part
+                setPosition(newBci[positions[i].first], positions[i].second);
+            }
+        }
+    }
+
+    BytecodeCode::~BytecodeCode() {
+        if (mapping_ != NULL) {
+            munmap(mapping_, mappingSize_);
+        }
+    }
+
+    void BytecodeCode::adoptMapping(void* address, size_t size) {
+        assert(mapping_ == NULL);
+        mapping_ = address;
+        mappingSize_ = size;
+    }
+
     Status* BytecodeCode::execute(vector<Var*>& vars){
-        BytecodeInterpretator inp;
-        return inp.interpretate(*this, vars);
+        BytecodeInterpretator inp(stackSize_ != 0 ?
+                stackSize_ : DataBytecode::DEFAULT_MAX_SIZE);
+        if (profiling_) {
+            inp.setProfile(&profile_);
+        }
+        if (sampler_ != NULL) {
+            inp.setSampler(sampler_);
+        }
+        if (output_ != NULL) {
+            inp.setOutput(output_);
+        }
+        if (!profiling_ && sampler_ == NULL) {
+            inp.setCompiled(compiledFunctions());
+        }
+        if (sampler_ != NULL) {
+            sampler_->start();
+        }
+        Status* status = inp.interpretate(*this, vars);
+        if (sampler_ != NULL) {
+            sampler_->stop();
+        }
+#ifdef MATHVM_OPCODE_STATS
+        inp.opcodeStats().report(cerr);
+#endif
+        callsCount_ = inp.callsCount();
+        frameAllocations_ = inp.frameAllocations();
+        return status;
     }
 }
\ No newline at end of file
@@ -0,0 +1,317 @@
+#include "bytecodeFile.h"
+
+#include "bytecodeVerifier.h"
+#include "nativeCall.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string.h>
+
+namespace mathvm {
+
+    static const char MAGIC[4] = {'M', 'V', 'M', 'B'};
+
+    const uint32_t BytecodeFile::VERSION;
+
+    class FileWriter {
+        ofstream& out;
+    public:
+
+        FileWriter(ofstream& out_) : out(out_) {
+        }
+
+        template<class T> void put(T value) {
+            out.write((const char*) &value, sizeof (value));
+        }
+
+        void putBytes(const void* bytes, uint32_t length) {
+            put<uint32_t>(length);
+            out.write((const char*) bytes, length);
+        }
+
+        void putString(const string& str) {
+            putBytes(str.data(), str.size());
+        }
+
+        void putSignature(const Signature& signature) {
+            put<uint32_t>(signature.size());
+            for (size_t j = 0; j < signature.size(); j++) {
+                put<uint8_t>(signature[j].first);
+                putString(signature[j].second);
+            }
+        }
+    };
+
+    // Reads from the mapping; past its end every read fails and
+    // leaves failed set, so the caller checks once per part.
+    class FileReader {
+        const uint8_t* at;
+        const uint8_t* end;
+    public:
+        bool failed;
+
+        FileReader(const uint8_t* begin, size_t size) :
+        at(begin), end(begin + size), failed(false) {
+        }
+
+        const uint8_t* take(size_t size) {
+            if (failed || (size_t) (end - at) < size) {
+                failed = true;
+                return NULL;
+            }
+            const uint8_t* result = at;
+            at += size;
+            return result;
+        }
+
+        template<class T> T get() {
+            T value = T();
+            const uint8_t* bytes = take(sizeof (value));
+            if (bytes != NULL) {
+                memcpy(&value, bytes, sizeof (value));
+            }
+            return value;
+        }
+
+        // the bytes stay where they are, length is set
+        const uint8_t* getBytes(uint32_t* length) {
+            *length = get<uint32_t>();
+            return take(*length);
+        }
+
+        string getString() {
+            uint32_t length;
+            const uint8_t* bytes = getBytes(&length);
+            return bytes == NULL ? string() : string((const char*) bytes, length);
+        }
+
+        // sets failed when empty or a type is unknown
+        Signature getSignature() {
+            Signature signature;
+            uint32_t size = get<uint32_t>();
+            if (size == 0 || size > (size_t) (end - at)) {
+                failed = true;
+            }
+            for (uint32_t j = 0; j < size && !failed; j++) {
+                VarType type = (VarType) get<uint8_t>();
+                signature.push_back(SignatureElement(type, getString()));
+                if (type > VT_VOID) {
+                    failed = true;
+                }
+            }
+            return signature;
+        }
+
+        bool atEnd() const {
+            return at == end;
+        }
+    };
+
+    Status* BytecodeFile::save(const BytecodeCode* code, const string& path) {
+        ofstream out(path.c_str(), ios::out | ios::binary | ios::trunc);
+        if (!out) {
+            return new Status("Cannot write file: " + path);
+        }
+        FileWriter writer(out);
+
+        vector<string> constants;
+        Code::ConstantIterator ci(code);
+        while (ci.hasNext()) {
+            constants.push_back(ci.next());
+        }
+        vector<const BytecodeFunction*> functions;
+        Code::FunctionIterator fi(code);
+        while (fi.hasNext()) {
+            functions.push_back((const BytecodeFunction*) fi.next());
+        }
+
+        out.write(MAGIC, sizeof (MAGIC));
+        writer.put<uint32_t>(VERSION);
+        writer.put<uint32_t>(BC_LAST);
+        writer.put<uint32_t>(constants.size());
+        writer.put<uint32_t>(code->globalVars()->size());
+        writer.put<uint32_t>(functions.size());
+        writer.put<uint32_t>(code->nativesNumber());
+
+        for (size_t i = 0; i < constants.size(); i++) {
+            writer.putString(constants[i]);
+        }
+        for (map<string, GlobalVar>::const_iterator it = code->globalVars()->begin();
+                it != code->globalVars()->end(); ++it) {
+            writer.putString(it->first);
+            writer.put<uint8_t>(it->second.type);
+            writer.put<uint16_t>(it->second.slot);
+        }
+        for (uint16_t i = 0; i < code->nativesNumber(); i++) {
+            const Signature* signature;
+            const string* name;
+            code->nativeById(i, &signature, &name);
+            writer.putString(*name);
+            writer.putSignature(*signature);
+        }
+        for (size_t i = 0; i < functions.size(); i++) {
+            const BytecodeFunction* fun = functions[i];
+            writer.putString(fun->name());
+            writer.putSignature(fun->signature());
+            writer.put<uint32_t>(fun->localsNumber());
+            writer.put<uint16_t>(fun->scopeId());
+            writer.put<uint16_t>(fun->depth());
+            writer.put<uint32_t>(fun->sizeDoubles);
+            writer.put<uint32_t>(fun->sizeInts);
+            writer.put<uint32_t>(fun->sizeStrings);
+            writer.put<uint32_t>(fun->maxStack);
+            const vector<pair<uint32_t, uint32_t> >& positions = fun->positions();
+            writer.put<uint32_t>(positions.size());
+            for (size_t j = 0; j < positions.size(); j++) {
+                writer.put<uint32_t>(positions[j].first);
+                writer.put<uint32_t>(positions[j].second);
+            }
+            writer.putBytes(fun->bytecode()->raw(), fun->bytecode()->length());
+        }
+
+        out.close();
+        if (!out) {
+            return new Status("Cannot write file: " + path);
+        }
+        return NULL;
+    }
+
+    static Status* corrupt(const string& path, const char* what) {
+        return new Status("Bad bytecode file " + path + ": " + what);
+    }
+
+    static Status* loadMapped(const string& path, const uint8_t* data,
+            size_t size, BytecodeCode* code) {
+        FileReader reader(data, size);
+        const uint8_t* magic = reader.take(sizeof (MAGIC));
+        if (magic == NULL || memcmp(magic, MAGIC, sizeof (MAGIC)) != 0) {
+            return corrupt(path, "not a bytecode file");
+        }
+        if (reader.get<uint32_t>() != BytecodeFile::VERSION
+                || reader.get<uint32_t>() != BC_LAST) {
+            return corrupt(path, "written by another version");
+        }
+        uint32_t constants = reader.get<uint32_t>();
+        uint32_t globals = reader.get<uint32_t>();
+        uint32_t functions = reader.get<uint32_t>();
+        uint32_t natives = reader.get<uint32_t>();
+        if (reader.failed || functions == 0 || functions > 0x10000
+                || constants >= 0x10000 || natives > 0x10000) {
+            return corrupt(path, "bad header");
+        }
+
+        for (uint32_t i = 0; i < constants; i++) {
+            string constant = reader.getString();
+            if (reader.failed || code->makeStringConstant(constant) != i + 1) {
+                return corrupt(path, "bad constants");
+            }
+        }
+        for (uint32_t i = 0; i < globals; i++) {
+            string name = reader.getString();
+            VarType type = (VarType) reader.get<uint8_t>();
+            uint16_t slot = reader.get<uint16_t>();
+            if (type != VT_DOUBLE && type != VT_INT && type != VT_STRING) {
+                reader.failed = true;
+            }
+            code->globalVars()->insert(make_pair(name, GlobalVar(type, slot)));
+        }
+        if (reader.failed) {
+            return corrupt(path, "bad globals");
+        }
+
+        // looked up again, addresses don't outlive the process
+        for (uint32_t i = 0; i < natives; i++) {
+            string name = reader.getString();
+            Signature signature = reader.getSignature();
+            if (reader.failed) {
+                return corrupt(path, "bad natives");
+            }
+            const void* address = resolveNative(name);
+            if (address == NULL) {
+                return new Status("Undefined native function " + name);
+            }
+            if (code->makeNativeFunction(name, signature, address) != i) {
+                return corrupt(path, "bad natives");
+            }
+        }
+
+        for (uint32_t i = 0; i < functions; i++) {
+            string name = reader.getString();
+            Signature signature = reader.getSignature();
+            if (reader.failed) {
+                return corrupt(path, "bad function signature");
+            }
+
+            BytecodeFunction* fun = new BytecodeFunction(name, signature);
+            code->addFunction(fun);
+            fun->setLocalsNumber(reader.get<uint32_t>());
+            fun->setScopeId(reader.get<uint16_t>());
+            fun->setDepth(reader.get<uint16_t>());
+            fun->sizeDoubles = reader.get<uint32_t>();
+            fun->sizeInts = reader.get<uint32_t>();
+            fun->sizeStrings = reader.get<uint32_t>();
+            fun->maxStack = reader.get<uint32_t>();
+            uint32_t positions = reader.get<uint32_t>();
+            for (uint32_t j = 0; j < positions && !reader.failed; j++) {
+                uint32_t bci = reader.get<uint32_t>();
+                fun->setPosition(bci, reader.get<uint32_t>());
+            }
+            uint32_t length;
+            const uint8_t* bytecode = reader.getBytes(&length);
+            if (reader.failed) {
+                return corrupt(path, "truncated function");
+            }
+            fun->bytecode()->setView(bytecode, length);
+        }
+        if (!reader.atEnd()) {
+            return corrupt(path, "junk after the functions");
+        }
+        // globals are slots of the top frame
+        const BytecodeFunction* top =
+                (const BytecodeFunction*) code->functionById(0);
+        for (map<string, GlobalVar>::const_iterator it = code->globalVars()->begin();
+                it != code->globalVars()->end(); ++it) {
+            VarType type = it->second.type;
+            uint32_t slots = type == VT_DOUBLE ? top->sizeDoubles
+                    : type == VT_INT ? top->sizeInts : top->sizeStrings;
+            if (it->second.slot >= slots) {
+                return corrupt(path, "bad globals");
+            }
+        }
+
+        BytecodeVerifier verifier(code);
+        return verifier.verify();
+    }
+
+    Status* BytecodeFile::load(const string& path, BytecodeCode* code) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return new Status("Cannot read file: " + path);
+        }
+        struct stat statBuf;
+        if (fstat(fd, &statBuf) != 0 || statBuf.st_size == 0) {
+            close(fd);
+            return corrupt(path, "empty");
+        }
+        size_t size = statBuf.st_size;
+        void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            return new Status("Cannot map file: " + path);
+        }
+        code->adoptMapping(data, size);
+        return loadMapped(path, (const uint8_t*) data, size, code);
+    }
+
+    bool BytecodeFile::isBytecodeFile(const string& path) {
+        ifstream in(path.c_str(), ios::in | ios::binary);
+        char magic[sizeof (MAGIC)];
+        return in.read(magic, sizeof (magic))
+                && memcmp(magic, MAGIC, sizeof (MAGIC)) == 0;
+    }
+
+}
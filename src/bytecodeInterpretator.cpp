@@ -1,4 +1,3 @@
-
 #include "bytecodeInterpretator.h"
 
 #include <iostream>
@@ -6,13 +5,24 @@
 
 #include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
 #include "mathvm.h"
 #include <iomanip>
+#include <math.h>
 #include <stdio.h>
-#include <stack>
+#include <algorithm>
+#include <sys/resource.h>
 
 using namespace std;
 
+// Dispatch mode is chosen at build time. With GCC/Clang we jump straight
+// from one handler to the next through a table of label addresses
+// (direct threading); elsewhere, or with -DMATHVM_SWITCH_DISPATCH, the
+// loop falls back to a portable switch.
+#if defined(__GNUC__) && !defined(MATHVM_SWITCH_DISPATCH)
+#define MATHVM_THREADED_DISPATCH
+#endif
+
 namespace mathvm {
 
     struct ExecContext {
@@ -20,531 +30,1079 @@ namespace mathvm {
         size_t bci;
         FunctionContex* context;
         const BytecodeFunction* fun;
-        OuterContexts contexts;
     };
 
+    // instruction lengths, so the loop doesn't ask bytecodeName() every time
+    static const uint8_t insnLength[BC_LAST] = {
+#define INSN_LENGTH(b, d, l, o, u) l,
+        FOR_BYTECODES(INSN_LENGTH)
+#undef INSN_LENGTH
+    };
+
+    template<class T> static inline T readTyped(const uint8_t* code, size_t bci) {
+        T value;
+        memcpy(&value, code + bci, sizeof (T));
+        return value;
+    }
+
+    const size_t DataBytecode::DEFAULT_MAX_SIZE;
+    const size_t FrameStack::CHUNK_SIZE;
+
+    FrameStack::FrameStack() : current(0), allocations_(0) {
+        top = end = NULL;
+        nextChunk(0);
+    }
+
+    FrameStack::~FrameStack() {
+        for (size_t i = 0; i < chunks.size(); i++) {
+            delete[] chunks[i].begin;
+        }
+    }
+
+    void FrameStack::nextChunk(size_t size) {
+        if (!chunks.empty()) {
+            chunks[current].savedTop = top;
+            current++;
+        }
+        if (current < chunks.size()
+                && (size_t) (chunks[current].end - chunks[current].begin) < size) {
+            // too small for this frame, replace it
+            delete[] chunks[current].begin;
+            chunks.erase(chunks.begin() + current);
+        }
+        if (current == chunks.size()) {
+            size_t chunkSize = max(size, CHUNK_SIZE);
+            Chunk chunk;
+            // uint64_t keeps frames 8-byte aligned
+            chunk.begin = (uint8_t*) new uint64_t[chunkSize / sizeof (uint64_t)];
+            chunk.end = chunk.begin + chunkSize;
+            chunk.savedTop = chunk.begin;
+            chunks.insert(chunks.begin() + current, chunk);
+            allocations_++;
+        }
+        top = chunks[current].begin;
+        end = chunks[current].end;
+    }
+
     int64_t S64(const char *s) {
         return (int64_t) strtoll(s, NULL, 0);
     }
 
     Status* BytecodeInterpretator::interpretate(const BytecodeCode& code,
             vector<Var*>& vars) {
+        Status* status = prepare(code);
+        if (status != NULL) {
+            return status;
+        }
+        for (size_t i = 0; i < vars.size(); i++) {
+            status = setGlobal(*vars[i]);
+            if (status != NULL) {
+                return status;
+            }
+        }
+
+        if (compiled != NULL && compiled[0] != NULL && vars.empty()) {
+            // in a frame of its own, the globals aren't looked at
+            execStatus = NULL;
+            compiled[0](&runtime);
+            output->flush();
+            status = execStatus;
+        } else {
+            status = runTop();
+        }
+        // strings would die with the interpreter, they keep theirs
+        for (size_t i = 0; status == NULL && i < vars.size(); i++) {
+            if (vars[i]->type() != VT_STRING) {
+                status = getGlobal(vars[i]);
+            }
+        }
+
+        callDepth = 0;
+
+        return status;
+    }
+
+    Status* BytecodeInterpretator::prepare(const BytecodeCode& code) {
+        if (prepared != NULL) {
+            assert(prepared == &code);
+            return NULL;
+        }
+
         Code::FunctionIterator fi(&code);
         while (fi.hasNext()) {
             functions.push_back((BytecodeFunction*) fi.next());
         }
 
+        // constant 0 is the empty string, iterator skips it
+        strings.adopt(code.constantById(0).c_str());
         Code::ConstantIterator ci(&code);
         while (ci.hasNext()) {
-            constants.push_back(&ci.next());
+            strings.adopt(ci.next().c_str());
         }
+        constantsEnd = strings.mark();
 
         if (functions.empty()) {
             return new Status("Nothing to execute", 0);
         }
+        Status* nativesStatus = prepareNatives(code);
+        if (nativesStatus != NULL) {
+            return nativesStatus;
+        }
 
-        execStatus = NULL;
-
-        setRootVars(code, vars);
-        execFunction(functions[0], OuterContexts());
+        uint16_t maxDepth = 0;
+        for (size_t i = 0; i < functions.size(); i++) {
+            maxDepth = max(maxDepth, functions[i]->depth());
+        }
+        display.assign(maxDepth + 1, NULL);
+
+        runtime.top = dstack.topAddress();
+        runtime.display = &display[0];
+        runtime.interpreter = this;
+        runtime.stackLimit = nativeStackLimit();
+        runtime.output = output;
+        if (profile != NULL) {
+            profile->assign(functions.size(), FunctionProfile());
+        }
 
-        callDepth = 0;
+        prepared = &code;
+        reset();
+        return NULL;
+    }
 
-        return execStatus;
+    void BytecodeInterpretator::reset() {
+        assert(prepared != NULL);
+        dstack.dropToSize(0);
+        frames.clear();
+        globals = frames.push(functions[0]);
+        clearGlobals();
+        globals->setShadowed(NULL);
+        display.assign(display.size(), NULL);
+        display[0] = globals;
+        strings.release(constantsEnd);
     }
 
-    void BytecodeInterpretator::setRootVars(const BytecodeCode& code, vector<Var*>& vars) {
-        BytecodeFunction* fun = new BytecodeFunction(*functions[0]);
-        functions[0] = fun;
+    void BytecodeInterpretator::clearGlobals() {
+        const BytecodeFunction* top = functions[0];
+        size_t offset = FunctionContex::doublesOffset(top);
+        // zero bits are 0, 0.0 and the empty string
+        memset((uint8_t*) globals + offset, 0,
+                FunctionContex::frameSize(top) - offset);
+    }
 
-        for (size_t i = 0; i < vars.size(); i++) {
-            string name(vars[i]->name());
-            assert(code.globalVars()->find(name) != code.globalVars()->end());
-            uint16_t pos = code.globalVars()->find(name)->second;
-            if (vars[i]->type() == VT_INT) {
-                fun->bytecode()->setTyped<int64_t>(pos, vars[i]->getIntValue());
-            }
-            if (vars[i]->type() == VT_DOUBLE) {
-                fun->bytecode()->setTyped<double>(pos, vars[i]->getDoubleValue());
-            }
-            if (vars[i]->type() == VT_STRING) {
-                constants.push_back(new string(vars[i]->getStringValue()));
-                uint16_t id = constants.size();
-                fun->bytecode()->setTyped<uint16_t>(pos, id);
-            }
+    Status* BytecodeInterpretator::findGlobal(const Var& var,
+            const GlobalVar** global) const {
+        map<string, GlobalVar>::const_iterator it =
+                prepared->globalVars()->find(var.name());
+        if (it == prepared->globalVars()->end()) {
+            return new Status("No global variable " + var.name());
         }
+        if (it->second.type != var.type()) {
+            return new Status(string("Global variable ") + var.name()
+                    + " is of type " + typeToName(it->second.type));
+        }
+        *global = &it->second;
+        return NULL;
     }
 
-    void BytecodeInterpretator::execFunction(const BytecodeFunction* fun, OuterContexts contexts) {
-
-        double dv;
-        double dv2;
-        int64_t iv;
-        int64_t iv2;
-        uint16_t idv;
-        uint16_t idv2;
-        DataBytecode* d = &dstack;
-        FunctionContex* context;
-        size_t beforeBci;
-        size_t bci;
-
-        stack<ExecContext> execStack;
-
-
-EXECFUNCTION:
-
-
-        context = new FunctionContex(fun);
-        OuterContexts deeperContexts(contexts);
-        deeperContexts[fun->id()] = context;
-
-        int id = fun->id();
-        if (id == 1) {
-            int kkk = 10;
+    Status* BytecodeInterpretator::setGlobal(const Var& var) {
+        const GlobalVar* global;
+        Status* status = findGlobal(var, &global);
+        if (status != NULL) {
+            return status;
         }
-
-        const Bytecode* b = fun->bytecode();
-
-        {
-            // read params 
-            size_t dc = 0, ic = 0, sc = 0;
-            for (uint16_t i = 0; i < fun->parametersNumber(); i++) {
-                VarType type = fun->parameterType(i);
-                if (type == VT_DOUBLE) {
-                    dv = d->popd();
-                    context->setd(dc++, dv);
-                }
-                if (type == VT_INT) {
-                    iv = d->popi();
-                    context->seti(ic++, iv);
-                }
-                if (type == VT_STRING) {
-                    idv = d->popid();
-                    context->sets(sc++, idv);
-                }
-            }
+        switch (var.type()) {
+            case VT_DOUBLE:
+                globals->setd(global->slot, var.getDoubleValue());
+                break;
+            case VT_INT:
+                globals->seti(global->slot, var.getIntValue());
+                break;
+            default:
+                globals->sets(global->slot,
+                        strings.intern(var.getStringValue()));
+                break;
         }
+        return NULL;
+    }
 
-        beforeBci = dstack.length();
-
-        size_t length;
-        Instruction insn;
-        const char* name;
-        bool jumpCase;
-
-        for (bci = 0; bci < b->length();) {
-
+    Status* BytecodeInterpretator::getGlobal(Var* var) const {
+        const GlobalVar* global;
+        Status* status = findGlobal(*var, &global);
+        if (status != NULL) {
+            return status;
+        }
+        switch (var->type()) {
+            case VT_DOUBLE:
+                var->setDoubleValue(globals->getd(global->slot));
+                break;
+            case VT_INT:
+                var->setIntValue(globals->geti(global->slot));
+                break;
+            default:
+                var->setStringValue(strings.get(globals->gets(global->slot)));
+                break;
+        }
+        return NULL;
+    }
 
+    Status* BytecodeInterpretator::runTop() {
+        execStatus = NULL;
+        globals->setShadowed(display[0]);
+        display[0] = globals;
+        bool returned = execFunction(functions[0], globals);
+        output->flush();
+        if (!returned && execStatus != NULL) {
+            reset();
+        }
+        return execStatus;
+    }
 
-            if (bci == 30 && fun->id() == 1) {
-                int kkk = 10;
+    Status* BytecodeInterpretator::call(uint16_t id, const vector<Var*>& args,
+            Var* result) {
+        const BytecodeFunction* fun = functions[id];
+        if (fun->depth() > 1) {
+            // its outer frames exist only while the outer function runs
+            return new Status("Function " + fun->name()
+                    + " is nested in another one");
+        }
+        if (args.size() != fun->parametersNumber()) {
+            return new Status("Function " + fun->name() + " takes a different"
+                    " number of arguments");
+        }
+        for (uint16_t i = 0; i < args.size(); i++) {
+            if (args[i]->type() != fun->parameterType(i)) {
+                return new Status("Argument " + fun->parameterName(i)
+                        + " of " + fun->name() + " is of type "
+                        + typeToName(fun->parameterType(i)));
             }
+        }
+        VarType returnType = fun->returnType();
+        if (returnType == VT_VOID ? result != NULL
+                : result == NULL || result->type() != returnType) {
+            return new Status("Function " + fun->name() + " returns "
+                    + typeToName(returnType));
+        }
 
-            insn = b->getInsn(bci);
-            name = bytecodeName(insn, &length);
-            jumpCase = false;
-
-            switch (insn) {
-                case BC_INVALID:
-                    break;
-
-                    // CASTS
-                case BC_I2D:
-                    iv = d->popi();
-                    d->pushd((double) iv);
-                    break;
-                case BC_D2I:
-                    dv = d->popd();
-                    d->pushi((int64_t) iv);
-                    break;
-                case BC_S2I:
-                    idv = d->popid();
-                    idv = b->getInt16(bci + 1) + bci + 1;
-                    d->pushd(S64(constants[iv]->c_str()));
-                    break;
-
-                    // STACK LOAD
-                case BC_DLOAD:
-                    dv = b->getDouble(bci + 1);
-                    d->pushd(dv);
-                    break;
-                case BC_ILOAD:
-                    iv = b->getInt64(bci + 1);
-                    d->pushi(iv);
-                    break;
-                case BC_SLOAD:
-                    idv = b->getUInt16(bci + 1);
-                    d->pushid(idv);
-                    break;
-
-                    // STACK LOAD
-                case BC_ILOAD0:
-                    d->pushi(0);
-                    break;
-                case BC_ILOAD1:
-                    d->pushi(1);
-                    break;
-                case BC_DLOAD0:
-                    d->pushd(0);
-                    break;
-                case BC_DLOAD1:
-                    d->pushd(1);
-                    break;
-
-                    // VAR LOADS
-                case BC_LOADIVAR:
-                    idv = b->getUInt16(bci + 1);
-                    dstack.pushi(context->geti(idv));
-                    break;
-                case BC_LOADDVAR:
-                    idv = b->getUInt16(bci + 1);
-                    dstack.pushd(context->getd(idv));
-                    break;
-                case BC_LOADSVAR:
-                    idv = b->getUInt16(bci + 1);
-                    dstack.pushid(context->gets(idv));
-                    break;
-
-                    // VAR STORES
-                case BC_STOREDVAR:
-                    idv = b->getUInt16(bci + 1);
-                    dv = dstack.popd();
-                    context->setd(idv, dv);
+        try {
+            dstack.reserve(args.size());
+        } catch (const DataBytecode::Overflow&) {
+            reset();
+            return new Status("Operand stack overflow", 0);
+        }
+        // the first parameter is popped first
+        for (size_t i = args.size(); i-- > 0;) {
+            switch (args[i]->type()) {
+                case VT_DOUBLE:
+                    dstack.pushd(args[i]->getDoubleValue());
                     break;
-                case BC_STOREIVAR:
-                    idv = b->getUInt16(bci + 1);
-                    iv = dstack.popi();
-                    context->seti(idv, iv);
+                case VT_INT:
+                    dstack.pushi(args[i]->getIntValue());
                     break;
-                case BC_STORESVAR:
-                    idv = b->getUInt16(bci + 1);
-                    idv2 = dstack.popid();
-                    context->sets(idv, idv2);
+                default:
+                    dstack.pushid(strings.intern(args[i]->getStringValue()));
                     break;
+            }
+        }
 
-                    // VAR LOAD (outer context)
-                case BC_LOADCTXDVAR:
-                {
-                    uint16_t idContext = b->getUInt16(bci + 1);
-                    uint16_t idVar = b->getUInt16(bci + 3);
-                    dv = contexts[idContext]->getd(idVar);
-                }
-                    d->pushd(dv);
-                    break;
-                case BC_LOADCTXIVAR:
-                {
-                    uint16_t idContext = b->getUInt16(bci + 1);
-                    uint16_t idVar = b->getUInt16(bci + 3);
-                    iv = contexts[idContext]->geti(idVar);
-                }
-                    d->pushi(iv);
-                    break;
-                case BC_LOADCTXSVAR:
-                {
-                    uint16_t idContext = b->getUInt16(bci + 1);
-                    uint16_t idVar = b->getUInt16(bci + 3);
-                    idv = contexts[idContext]->gets(idVar);
-                }
-                    d->pushid(idv);
-                    break;
+        execStatus = NULL;
+        bool returned = compiled != NULL && compiled[id] != NULL
+                ? compiled[id](&runtime) : execFunction(fun);
+        output->flush();
+        if (!returned) {
+            Status* status = execStatus != NULL ? execStatus
+                    : new Status("Function " + fun->name() + " stopped");
+            reset();
+            return status;
+        }
 
-                    // VAR STORE (outer context)
-                case BC_STORECTXDVAR:
-                    dv = d->popd();
-                {
-                    uint16_t idContext = b->getUInt16(bci + 1);
-                    uint16_t idVar = b->getUInt16(bci + 3);
-                    contexts[idContext]->setd(idVar, dv);
-                }
-                    break;
-                case BC_STORECTXIVAR:
-                    iv = d->popi();
-                {
-                    uint16_t idContext = b->getUInt16(bci + 1);
-                    uint16_t idVar = b->getUInt16(bci + 3);
-                    contexts[idContext]->seti(idVar, iv);
-                }
-                    break;
-                case BC_STORECTXSVAR:
-                    idv = d->popid();
-                {
-                    uint16_t idContext = b->getUInt16(bci + 1);
-                    uint16_t idVar = b->getUInt16(bci + 3);
-                    contexts[idContext]->sets(idVar, idv);
-                }
-                    break;
+        switch (returnType) {
+            case VT_DOUBLE:
+                result->setDoubleValue(dstack.popd());
+                break;
+            case VT_INT:
+                result->setIntValue(dstack.popi());
+                break;
+            case VT_STRING:
+                result->setStringValue(strings.get(dstack.popid()));
+                break;
+            default:
+                break;
+        }
+        return NULL;
+    }
 
-                    // JUMPS
-                case BC_JA:
-                    idv = b->getInt16(bci + 1) + bci + 1;
-                    bci = idv;
-                    jumpCase = true;
-                    break;
+    // A quarter of the native stack is left for what runs above compiled
+    // frames: the interpreter, helpers and whatever called execute().
+    const void* BytecodeInterpretator::nativeStackLimit() {
+        size_t size = 8 << 20;
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_STACK, &limit) == 0
+                && limit.rlim_cur != RLIM_INFINITY) {
+            size = limit.rlim_cur;
+        }
+        uintptr_t here = (uintptr_t) &limit;
+        return (const void*) (here - size / 4 * 3);
+    }
 
-                case BC_IFICMPNE:
-                    idv = b->getInt16(bci + 1) + bci + 1;
-                    iv2 = d->popi();
-                    iv = d->popi();
-                    if (iv != iv2) {
-                        bci = idv;
-                        jumpCase = true;
-                    }
-                    break;
-                case BC_IFICMPE:
-                    idv = b->getInt16(bci + 1) + bci + 1;
-                    iv2 = d->popi();
-                    iv = d->popi();
-                    if (iv == iv2) {
-                        bci = idv;
-                        jumpCase = true;
-                    }
-                    break;
-                case BC_IFICMPG:
-                    idv = b->getInt16(bci + 1) + bci + 1;
-                    iv2 = d->popi();
-                    iv = d->popi();
-                    if (iv > iv2) {
-                        bci = idv;
-                        jumpCase = true;
-                    }
-                    break;
-                case BC_IFICMPGE:
-                    idv = b->getInt16(bci + 1) + bci + 1;
-                    iv2 = d->popi();
-                    iv = d->popi();
-                    if (iv >= iv2) {
-                        bci = idv;
-                        jumpCase = true;
-                    }
-                    break;
-                case BC_IFICMPL:
-                    idv = b->getInt16(bci + 1) + bci + 1;
-                    iv2 = d->popi();
-                    iv = d->popi();
-                    if (iv < iv2) {
-                        bci = idv;
-                        jumpCase = true;
-                    }
-                    break;
-                case BC_IFICMPLE:
-                    idv = b->getInt16(bci + 1) + bci + 1;
-                    iv2 = d->popi();
-                    iv = d->popi();
-                    if (iv <= iv2) {
-                        bci = idv;
-                        jumpCase = true;
-                    }
-                    break;
+    Status* BytecodeInterpretator::prepareNatives(const BytecodeCode& code) {
+        natives.resize(code.nativesNumber());
+        for (uint16_t id = 0; id < natives.size(); id++) {
+            NativeCall& call = natives[id];
+            call.code = code.nativeById(id, &call.signature, &call.name);
+            call.trampoline = nativeTrampoline(*call.signature);
+            if (call.code == NULL || call.trampoline == NULL) {
+                return new Status("Can't call native function " + *call.name, 0);
+            }
+        }
+        return NULL;
+    }
 
-                    // ARITHMETIC
-                case BC_DADD:
-                    dv2 = d->popd();
-                    dv = d->popd();
-                    d->pushd(dv + dv2);
-                    break;
-                case BC_DSUB:
-                    dv2 = d->popd();
-                    dv = d->popd();
-                    d->pushd(dv - dv2);
-                    break;
-                case BC_DMUL:
-                    dv2 = d->popd();
-                    dv = d->popd();
-                    d->pushd(dv * dv2);
-                    break;
-                case BC_DDIV:
-                    dv2 = d->popd();
-                    dv = d->popd();
-                    d->pushd(dv / dv2);
-                    break;
-                case BC_DCMP:
-                    dv2 = d->popd();
-                    dv = d->popd();
-                    if (dv < dv2)
-                        d->pushi(-1);
-                    if (dv == dv2)
-                        d->pushi(0);
-                    if (dv > dv2)
-                        d->pushi(1);
-                    break;
+    bool BytecodeInterpretator::callNative(uint16_t id) {
+        const NativeCall& call = natives[id];
+        DataBytecode::Slot result;
+        // it may print too
+        output->flush();
+        call.trampoline(call.code, dstack.top(), strings.table(), &result);
+        dstack.drop(call.signature->size() - 1);
+
+        switch ((*call.signature)[0].first) {
+            case VT_DOUBLE:
+                dstack.pushd(result.d);
+                break;
+            case VT_INT:
+                dstack.pushi(result.i);
+                break;
+            case VT_STRING:
+                // NULL, like getenv() of an unset variable, reads as the
+                // empty string constant
+                dstack.pushid(result.i == 0 ? 0
+                        : strings.wrap((const char*) result.i));
+                break;
+            default:
+                break;
+        }
+        return true;
+    }
 
+    bool BytecodeInterpretator::execFunction(const BytecodeFunction* fun,
+            FunctionContex* entered) {
+        if (sampler != NULL) {
+            return profile != NULL ? runFunction<true, true>(fun, entered)
+                    : runFunction<false, true>(fun, entered);
+        }
+        return profile != NULL ? runFunction<true, false>(fun, entered)
+                : runFunction<false, false>(fun, entered);
+    }
 
-                case BC_IADD:
-                    iv2 = d->popi();
-                    iv = d->popi();
-                    d->pushi(iv + iv2);
-                    break;
-                case BC_ISUB:
-                    iv2 = d->popi();
-                    iv = d->popi();
-                    d->pushi(iv - iv2);
-                    break;
-                case BC_IMUL:
-                    iv2 = d->popi();
-                    iv = d->popi();
-                    d->pushi(iv * iv2);
-                    break;
-                case BC_IDIV:
-                    iv2 = d->popi();
-                    iv = d->popi();
-                    d->pushi(iv / iv2);
-                    break;
-                case BC_IAAND:
-                    iv2 = d->popi();
-                    iv = d->popi();
-                    d->pushi(iv & iv2);
-                    break;
-                case BC_IAOR:
-                    iv2 = d->popi();
-                    iv = d->popi();
-                    d->pushi(iv | iv2);
-                    break;
-                case BC_IAXOR:
-                    iv2 = d->popi();
-                    iv = d->popi();
-                    d->pushi(iv ^ iv2);
-                    break;
-                case BC_ICMP:
-                    iv2 = d->popi();
-                    iv = d->popi();
-                    if (iv < iv2)
-                        d->pushi(-1);
-                    if (iv == iv2)
-                        d->pushi(0);
-                    if (iv > iv2)
-                        d->pushi(1);
-                    break;
+    template<bool PROFILE, bool SAMPLE>
+    bool BytecodeInterpretator::runFunction(const BytecodeFunction* fun,
+            FunctionContex* entered) {
 
-                    // SWAP
-                case BC_ISWAP:
-                    iv = d->popi();
-                    iv2 = d->popi();
-                    d->pushi(iv);
-                    d->pushi(iv2);
-                    break;
-                case BC_DSWAP:
-                    dv = d->popd();
-                    dv2 = d->popd();
-                    d->pushi(dv);
-                    d->pushi(dv2);
-                    break;
-                case BC_SSWAP:
-                    idv = d->popid();
-                    idv2 = d->popid();
-                    d->pushid(idv);
-                    d->pushid(idv2);
-                    break;
+        double dv;
+        double dv2;
+        int64_t iv;
+        int64_t iv2;
+        uint16_t idv;
+        uint16_t idv2;
+        StringHandle sv;
+        StringHandle sv2;
+        DataBytecode* d = &dstack;
+        FunctionContex* context;
+        FunctionContex** outer = &display[0];
+        size_t beforeBci;
+        size_t bci;
+        const uint8_t* code;
+        // counts of the running function, used only when PROFILE
+        FunctionProfile* counts = NULL;
+        // the sampler's frame of the running function, only when SAMPLE
+        SamplingProfiler::Frame* sampled = NULL;
+        sig_atomic_t sampledDepth = SAMPLE ? sampler->currentDepth() : 0;
+
+        vector<ExecContext> execStack;
+        // compiled callees would grow the native stack, past the limit
+        // this loop runs everything
+        bool native = compiled != NULL
+                && (const void*) &execStack > runtime.stackLimit;
+
+#ifdef MATHVM_THREADED_DISPATCH
+        static void* const dispatchTable[BC_LAST] = {
+#define LABEL_ADDRESS(b, d, l, o, u) &&L_##b,
+            FOR_BYTECODES(LABEL_ADDRESS)
+#undef LABEL_ADDRESS
+        };
+#define INSN(b) L_##b:
+#define DISPATCH() {                                              \
+            COUNT_INSN();                                         \
+            COUNT_OPCODE();                                       \
+            SAMPLE_BCI();                                         \
+            goto *dispatchTable[code[bci]];                       \
+        }
+#else
+#define INSN(b) case BC_##b:
+#define DISPATCH() { COUNT_INSN(); COUNT_OPCODE(); SAMPLE_BCI(); continue; }
+#endif
+#ifdef MATHVM_OPCODE_STATS
+#define COUNT_OPCODE() stats.count(code[bci])
+#define BREAK_SEQUENCE() stats.breakSequence()
+#else
+#define COUNT_OPCODE()
+#define BREAK_SEQUENCE()
+#endif
+// PROFILE is a constant, the counting is compiled out without it
+#define COUNT_INSN() if (PROFILE) counts->instructions++
+#define COUNT_JUMP(offset) if (PROFILE && offset < 0) counts->backEdges++
+#define SAMPLE_BCI() if (SAMPLE) sampled->bci = bci
+#define NEXT(b) { bci += insnLength[BC_##b]; DISPATCH(); }
+// offset is read at bci + at and counted from there
+#define JUMP_IF_AT(cond, at, b) {                                 \
+            if (cond) {                                           \
+                int16_t offset = readTyped<int16_t>(code, bci + at); \
+                COUNT_JUMP(offset);                               \
+                bci += offset + at;                               \
+                DISPATCH();                                       \
+            }                                                     \
+            NEXT(b);                                              \
+        }
+#define JUMP_IF(cond, b) JUMP_IF_AT(cond, 1, b)
 
-                    // PRINT
-                case BC_DPRINT:
-                    dv = d->popd();
-                    cout << dv;
-                    break;
-                case BC_IPRINT:
-                    iv = d->popi();
-                    cout << iv;
-                    break;
-                case BC_SPRINT:
-                    idv = d->popid() - 1;
-                    cout << *constants[idv];
-                    break;
+        context = NULL;
 
-                case BC_CALL:
-                    idv = b->getUInt16(bci + 1);
+        try {
 
+        if (entered != NULL) {
+            context = entered;
+            calls++;
+            goto ENTERED;
+        }
 
+EXECFUNCTION:
 
-                {
-                    ExecContext ec;
-                    ec.beforeBci = beforeBci;
-                    ec.bci = bci;
-                    ec.context = context;
-                    ec.fun = fun;
-                    ec.contexts = contexts;
-                    execStack.push(ec);
-                }
+        context = frames.push(fun);
+        calls++;
+        context->setShadowed(outer[fun->depth()]);
+        outer[fun->depth()] = context;
 
-                    fun = functions[idv];
-                    contexts = deeperContexts;
+        popParameters(fun, context);
 
+ENTERED:
 
-                    if (id == 1 && idv == 3) {
-                        int ikkkasdf = 12;
-                    }
-                    if (id == 1 && idv == 2) {
-                        int ikkkasdf = 12;
-                    }
+        beforeBci = dstack.length();
+        d->reserve(fun->maxStack);
+        code = fun->bytecode()->raw();
+        bci = 0;
+        if (PROFILE) {
+            counts = &(*profile)[fun->id()];
+            counts->calls++;
+        }
+        BREAK_SEQUENCE();
+        if (SAMPLE) {
+            sampled = sampler->enter(fun->id());
+        }
 
-                    goto EXECFUNCTION;
+#ifdef MATHVM_THREADED_DISPATCH
+        DISPATCH();
+#else
+        COUNT_INSN();
+        COUNT_OPCODE();
+        for (;;) switch (code[bci]) {
+#endif
 
-RETURNFROMEXE:
+        INSN(INVALID)
+        INSN(BREAK)
+            NEXT(INVALID);
 
+            // CASTS
+        INSN(I2D)
+            iv = d->popi();
+            d->pushd((double) iv);
+            NEXT(I2D);
+        INSN(D2I)
+            dv = d->popd();
+            d->pushi((int64_t) dv);
+            NEXT(D2I);
+        INSN(S2I)
+            sv = d->popid();
+            d->pushi(S64(strings.get(sv)));
+            NEXT(S2I);
+
+            // STACK LOAD
+        INSN(DLOAD)
+            d->pushd(readTyped<double>(code, bci + 1));
+            NEXT(DLOAD);
+        INSN(ILOAD)
+            d->pushi(readTyped<int64_t>(code, bci + 1));
+            NEXT(ILOAD);
+        INSN(SLOAD)
+            d->pushid(readTyped<uint16_t>(code, bci + 1));
+            NEXT(SLOAD);
+        INSN(DLOAD0)
+            d->pushd(0);
+            NEXT(DLOAD0);
+        INSN(ILOAD0)
+            d->pushi(0);
+            NEXT(ILOAD0);
+        INSN(SLOAD0)
+            d->pushid(0);
+            NEXT(SLOAD0);
+        INSN(DLOAD1)
+            d->pushd(1);
+            NEXT(DLOAD1);
+        INSN(ILOAD1)
+            d->pushi(1);
+            NEXT(ILOAD1);
+        INSN(DLOADM1)
+            d->pushd(-1);
+            NEXT(DLOADM1);
+        INSN(ILOADM1)
+            d->pushi(-1);
+            NEXT(ILOADM1);
+
+            // VAR LOADS
+        INSN(LOADDVAR0)
+            d->pushd(context->getd(0));
+            NEXT(LOADDVAR0);
+        INSN(LOADDVAR1)
+            d->pushd(context->getd(1));
+            NEXT(LOADDVAR1);
+        INSN(LOADDVAR2)
+            d->pushd(context->getd(2));
+            NEXT(LOADDVAR2);
+        INSN(LOADDVAR3)
+            d->pushd(context->getd(3));
+            NEXT(LOADDVAR3);
+        INSN(LOADIVAR0)
+            d->pushi(context->geti(0));
+            NEXT(LOADIVAR0);
+        INSN(LOADIVAR1)
+            d->pushi(context->geti(1));
+            NEXT(LOADIVAR1);
+        INSN(LOADIVAR2)
+            d->pushi(context->geti(2));
+            NEXT(LOADIVAR2);
+        INSN(LOADIVAR3)
+            d->pushi(context->geti(3));
+            NEXT(LOADIVAR3);
+        INSN(LOADSVAR0)
+            d->pushid(context->gets(0));
+            NEXT(LOADSVAR0);
+        INSN(LOADSVAR1)
+            d->pushid(context->gets(1));
+            NEXT(LOADSVAR1);
+        INSN(LOADSVAR2)
+            d->pushid(context->gets(2));
+            NEXT(LOADSVAR2);
+        INSN(LOADSVAR3)
+            d->pushid(context->gets(3));
+            NEXT(LOADSVAR3);
+        INSN(LOADIVAR)
+            idv = readTyped<uint16_t>(code, bci + 1);
+            d->pushi(context->geti(idv));
+            NEXT(LOADIVAR);
+        INSN(LOADDVAR)
+            idv = readTyped<uint16_t>(code, bci + 1);
+            d->pushd(context->getd(idv));
+            NEXT(LOADDVAR);
+        INSN(LOADSVAR)
+            idv = readTyped<uint16_t>(code, bci + 1);
+            d->pushid(context->gets(idv));
+            NEXT(LOADSVAR);
+
+            // VAR STORES
+        INSN(STOREDVAR0)
+            context->setd(0, d->popd());
+            NEXT(STOREDVAR0);
+        INSN(STOREDVAR1)
+            context->setd(1, d->popd());
+            NEXT(STOREDVAR1);
+        INSN(STOREDVAR2)
+            context->setd(2, d->popd());
+            NEXT(STOREDVAR2);
+        INSN(STOREDVAR3)
+            context->setd(3, d->popd());
+            NEXT(STOREDVAR3);
+        INSN(STOREIVAR0)
+            context->seti(0, d->popi());
+            NEXT(STOREIVAR0);
+        INSN(STOREIVAR1)
+            context->seti(1, d->popi());
+            NEXT(STOREIVAR1);
+        INSN(STOREIVAR2)
+            context->seti(2, d->popi());
+            NEXT(STOREIVAR2);
+        INSN(STOREIVAR3)
+            context->seti(3, d->popi());
+            NEXT(STOREIVAR3);
+        INSN(STORESVAR0)
+            context->sets(0, d->popid());
+            NEXT(STORESVAR0);
+        INSN(STORESVAR1)
+            context->sets(1, d->popid());
+            NEXT(STORESVAR1);
+        INSN(STORESVAR2)
+            context->sets(2, d->popid());
+            NEXT(STORESVAR2);
+        INSN(STORESVAR3)
+            context->sets(3, d->popid());
+            NEXT(STORESVAR3);
+        INSN(STOREDVAR)
+            idv = readTyped<uint16_t>(code, bci + 1);
+            context->setd(idv, d->popd());
+            NEXT(STOREDVAR);
+        INSN(STOREIVAR)
+            idv = readTyped<uint16_t>(code, bci + 1);
+            context->seti(idv, d->popi());
+            NEXT(STOREIVAR);
+        INSN(STORESVAR)
+            idv = readTyped<uint16_t>(code, bci + 1);
+            context->sets(idv, d->popid());
+            NEXT(STORESVAR);
+
+            // VAR LOAD (outer context)
+        INSN(LOADCTXDVAR)
+            idv = readTyped<uint16_t>(code, bci + 1);
+            idv2 = readTyped<uint16_t>(code, bci + 3);
+            d->pushd(outer[idv]->getd(idv2));
+            NEXT(LOADCTXDVAR);
+        INSN(LOADCTXIVAR)
+            idv = readTyped<uint16_t>(code, bci + 1);
+            idv2 = readTyped<uint16_t>(code, bci + 3);
+            d->pushi(outer[idv]->geti(idv2));
+            NEXT(LOADCTXIVAR);
+        INSN(LOADCTXSVAR)
+            idv = readTyped<uint16_t>(code, bci + 1);
+            idv2 = readTyped<uint16_t>(code, bci + 3);
+            d->pushid(outer[idv]->gets(idv2));
+            NEXT(LOADCTXSVAR);
+
+            // VAR STORE (outer context)
+        INSN(STORECTXDVAR)
+            idv = readTyped<uint16_t>(code, bci + 1);
+            idv2 = readTyped<uint16_t>(code, bci + 3);
+            outer[idv]->setd(idv2, d->popd());
+            NEXT(STORECTXDVAR);
+        INSN(STORECTXIVAR)
+            idv = readTyped<uint16_t>(code, bci + 1);
+            idv2 = readTyped<uint16_t>(code, bci + 3);
+            outer[idv]->seti(idv2, d->popi());
+            NEXT(STORECTXIVAR);
+        INSN(STORECTXSVAR)
+            idv = readTyped<uint16_t>(code, bci + 1);
+            idv2 = readTyped<uint16_t>(code, bci + 3);
+            outer[idv]->sets(idv2, d->popid());
+            NEXT(STORECTXSVAR);
+
+            // JUMPS
+        INSN(JA)
+        {
+            int16_t offset = readTyped<int16_t>(code, bci + 1);
+            COUNT_JUMP(offset);
+            bci += offset + 1;
+        }
+            DISPATCH();
+        INSN(IFICMPNE)
+            iv2 = d->popi();
+            iv = d->popi();
+            JUMP_IF(iv != iv2, IFICMPNE);
+        INSN(IFICMPE)
+            iv2 = d->popi();
+            iv = d->popi();
+            JUMP_IF(iv == iv2, IFICMPE);
+        INSN(IFICMPG)
+            iv2 = d->popi();
+            iv = d->popi();
+            JUMP_IF(iv > iv2, IFICMPG);
+        INSN(IFICMPGE)
+            iv2 = d->popi();
+            iv = d->popi();
+            JUMP_IF(iv >= iv2, IFICMPGE);
+        INSN(IFICMPL)
+            iv2 = d->popi();
+            iv = d->popi();
+            JUMP_IF(iv < iv2, IFICMPL);
+        INSN(IFICMPLE)
+            iv2 = d->popi();
+            iv = d->popi();
+            JUMP_IF(iv <= iv2, IFICMPLE);
 
+            // unordered doubles count as greater, as DCMP has it
+        INSN(DIFCMPNE)
+            dv2 = d->popd();
+            dv = d->popd();
+            JUMP_IF(!(dv == dv2), DIFCMPNE);
+        INSN(DIFCMPE)
+            dv2 = d->popd();
+            dv = d->popd();
+            JUMP_IF(dv == dv2, DIFCMPE);
+        INSN(DIFCMPG)
+            dv2 = d->popd();
+            dv = d->popd();
+            JUMP_IF(!(dv <= dv2), DIFCMPG);
+        INSN(DIFCMPGE)
+            dv2 = d->popd();
+            dv = d->popd();
+            JUMP_IF(!(dv < dv2), DIFCMPGE);
+        INSN(DIFCMPL)
+            dv2 = d->popd();
+            dv = d->popd();
+            JUMP_IF(dv < dv2, DIFCMPL);
+        INSN(DIFCMPLE)
+            dv2 = d->popd();
+            dv = d->popd();
+            JUMP_IF(dv <= dv2, DIFCMPLE);
+
+            // fused by the peephole pass
+        INSN(IFICMPNEVAR)
+            iv = context->geti(readTyped<uint16_t>(code, bci + 1));
+            iv2 = context->geti(readTyped<uint16_t>(code, bci + 3));
+            JUMP_IF_AT(iv != iv2, 5, IFICMPNEVAR);
+        INSN(IFICMPEVAR)
+            iv = context->geti(readTyped<uint16_t>(code, bci + 1));
+            iv2 = context->geti(readTyped<uint16_t>(code, bci + 3));
+            JUMP_IF_AT(iv == iv2, 5, IFICMPEVAR);
+        INSN(IFICMPGVAR)
+            iv = context->geti(readTyped<uint16_t>(code, bci + 1));
+            iv2 = context->geti(readTyped<uint16_t>(code, bci + 3));
+            JUMP_IF_AT(iv > iv2, 5, IFICMPGVAR);
+        INSN(IFICMPGEVAR)
+            iv = context->geti(readTyped<uint16_t>(code, bci + 1));
+            iv2 = context->geti(readTyped<uint16_t>(code, bci + 3));
+            JUMP_IF_AT(iv >= iv2, 5, IFICMPGEVAR);
+        INSN(IFICMPLVAR)
+            iv = context->geti(readTyped<uint16_t>(code, bci + 1));
+            iv2 = context->geti(readTyped<uint16_t>(code, bci + 3));
+            JUMP_IF_AT(iv < iv2, 5, IFICMPLVAR);
+        INSN(IFICMPLEVAR)
+            iv = context->geti(readTyped<uint16_t>(code, bci + 1));
+            iv2 = context->geti(readTyped<uint16_t>(code, bci + 3));
+            JUMP_IF_AT(iv <= iv2, 5, IFICMPLEVAR);
+        INSN(IINCVAR)
+            idv = readTyped<uint16_t>(code, bci + 1);
+            context->seti(idv, context->geti(idv)
+                    + readTyped<int16_t>(code, bci + 3));
+            NEXT(IINCVAR);
+
+            // ARITHMETIC
+        INSN(DADD)
+            dv2 = d->popd();
+            dv = d->popd();
+            d->pushd(dv + dv2);
+            NEXT(DADD);
+        INSN(DSUB)
+            dv2 = d->popd();
+            dv = d->popd();
+            d->pushd(dv - dv2);
+            NEXT(DSUB);
+        INSN(DMUL)
+            dv2 = d->popd();
+            dv = d->popd();
+            d->pushd(dv * dv2);
+            NEXT(DMUL);
+        INSN(DDIV)
+            dv2 = d->popd();
+            dv = d->popd();
+            d->pushd(dv / dv2);
+            NEXT(DDIV);
+        INSN(DNEG)
+            d->pushd(-d->popd());
+            NEXT(DNEG);
+        INSN(DSQRT)
+            d->pushd(sqrt(d->popd()));
+            NEXT(DSQRT);
+        INSN(DSIN)
+            d->pushd(sin(d->popd()));
+            NEXT(DSIN);
+        INSN(DCOS)
+            d->pushd(cos(d->popd()));
+            NEXT(DCOS);
+        INSN(DPOW)
+            dv = d->popd();
+            dv2 = d->popd();
+            d->pushd(pow(dv, dv2));
+            NEXT(DPOW);
+        INSN(DCMP)
+            dv2 = d->popd();
+            dv = d->popd();
+            d->pushi(dv < dv2 ? -1 : (dv == dv2 ? 0 : 1));
+            NEXT(DCMP);
 
-                    deeperContexts = contexts;
+        INSN(IADD)
+            iv2 = d->popi();
+            iv = d->popi();
+            d->pushi(iv + iv2);
+            NEXT(IADD);
+        INSN(ISUB)
+            iv2 = d->popi();
+            iv = d->popi();
+            d->pushi(iv - iv2);
+            NEXT(ISUB);
+        INSN(IMUL)
+            iv2 = d->popi();
+            iv = d->popi();
+            d->pushi(iv * iv2);
+            NEXT(IMUL);
+        INSN(IDIV)
+            iv2 = d->popi();
+            iv = d->popi();
+            d->pushi(iv / iv2);
+            NEXT(IDIV);
+        INSN(IMOD)
+            iv2 = d->popi();
+            iv = d->popi();
+            d->pushi(iv % iv2);
+            NEXT(IMOD);
+        INSN(INEG)
+            d->pushi(-d->popi());
+            NEXT(INEG);
+        INSN(IAAND)
+            iv2 = d->popi();
+            iv = d->popi();
+            d->pushi(iv & iv2);
+            NEXT(IAAND);
+        INSN(IAOR)
+            iv2 = d->popi();
+            iv = d->popi();
+            d->pushi(iv | iv2);
+            NEXT(IAOR);
+        INSN(IAXOR)
+            iv2 = d->popi();
+            iv = d->popi();
+            d->pushi(iv ^ iv2);
+            NEXT(IAXOR);
+        INSN(ICMP)
+            iv2 = d->popi();
+            iv = d->popi();
+            d->pushi(iv < iv2 ? -1 : (iv == iv2 ? 0 : 1));
+            NEXT(ICMP);
 
-                {
-                    ExecContext ec = execStack.top();
-                    execStack.pop();
-                    beforeBci = ec.beforeBci;
-                    bci = ec.bci;
-                    context = ec.context;
-                    fun = ec.fun;
-                    contexts = ec.contexts;
-                }
+            // SWAP
+        INSN(ISWAP)
+            iv = d->popi();
+            iv2 = d->popi();
+            d->pushi(iv);
+            d->pushi(iv2);
+            NEXT(ISWAP);
+        INSN(DSWAP)
+            dv = d->popd();
+            dv2 = d->popd();
+            d->pushd(dv);
+            d->pushd(dv2);
+            NEXT(DSWAP);
+        INSN(SSWAP)
+            sv = d->popid();
+            sv2 = d->popid();
+            d->pushid(sv);
+            d->pushid(sv2);
+            NEXT(SSWAP);
+
+            // PRINT
+        INSN(DPRINT)
+            output->writeDouble(d->popd());
+            NEXT(DPRINT);
+        INSN(IPRINT)
+            output->writeInt(d->popi());
+            NEXT(IPRINT);
+        INSN(SPRINT)
+            output->writeString(strings.get(d->popid()));
+            NEXT(SPRINT);
+
+        INSN(CALL)
+            idv = readTyped<uint16_t>(code, bci + 1);
+            if (native && compiled[idv] != NULL) {
+                if (!compiled[idv](&runtime))
+                    goto ABORT;
+                NEXT(CALL);
+            }
+        {
+            ExecContext ec;
+            ec.beforeBci = beforeBci;
+            ec.bci = bci;
+            ec.context = context;
+            ec.fun = fun;
+            execStack.push_back(ec);
+        }
+            fun = functions[idv];
+            goto EXECFUNCTION;
 
-                    b = fun->bytecode();
-                    insn = b->getInsn(bci);
-                    name = bytecodeName(insn, &length);
-                    jumpCase = false;
+        INSN(RETURN)
+        {
+            // dropping everything except return value
+            VarType returnType = fun->returnType();
+            if (returnType == VT_DOUBLE)
+                dv = d->popd();
+            if (returnType == VT_INT)
+                iv = d->popi();
+            if (returnType == VT_STRING)
+                sv = d->popid();
+
+            d->dropToSize(beforeBci);
+
+            if (returnType == VT_DOUBLE)
+                d->pushd(dv);
+            if (returnType == VT_INT)
+                d->pushi(iv);
+            if (returnType == VT_STRING)
+                d->pushid(sv);
+        }
+            outer[fun->depth()] = context->shadowed();
+            if (context != entered) {
+                frames.pop(context);
+            }
+            if (SAMPLE) {
+                sampled = sampler->leave();
+            }
 
-                    break;
-                case BC_CALLNATIVE:
-                    execStatus = new Status("Can't call a native function", 0);
-                    return;
-                    break;
+            if (execStack.empty())
+                return true;
 
-                case BC_RETURN:
-                    goto RETURN;
-                    break;
-                default:
-                    cout << name << endl;
-                    // assert(false);
+        {
+            ExecContext& ec = execStack.back();
+            beforeBci = ec.beforeBci;
+            bci = ec.bci;
+            context = ec.context;
+            fun = ec.fun;
+            execStack.pop_back();
+        }
+            code = fun->bytecode()->raw();
+            if (PROFILE) {
+                counts = &(*profile)[fun->id()];
             }
-            if (!jumpCase)
-                bci += length;
+            BREAK_SEQUENCE();
+            NEXT(CALL);
+
+        INSN(CALLNATIVE)
+            if (!callNative(readTyped<uint16_t>(code, bci + 1)))
+                goto ABORT;
+            NEXT(CALLNATIVE);
+
+        INSN(STOP)
+            execStatus = NULL;
+            goto ABORT;
+
+        INSN(POP)
+            d->drop();
+            NEXT(POP);
+
+        INSN(DUMP)
+#ifndef MATHVM_THREADED_DISPATCH
+        default:
+#endif
+            execStatus = new Status(string("Unsupported instruction ")
+                    + bytecodeName((Instruction) code[bci]), 0);
+            goto ABORT;
+
+#ifndef MATHVM_THREADED_DISPATCH
         }
+#endif
 
-RETURN:
-
-        // dropping everything except return value
-
-        if (fun->returnType() == VT_DOUBLE)
-            dv = d->popd();
-        if (fun->returnType() == VT_INT)
-            iv = d->popi();
-        if (fun->returnType() == VT_STRING)
-            idv = d->popid();
+        } catch (const DataBytecode::Overflow&) {
+            execStatus = new Status("Operand stack overflow", 0);
+        }
 
-        dstack.dropToSize(beforeBci);
+#undef INSN
+#undef DISPATCH
+#undef COUNT_INSN
+#undef COUNT_OPCODE
+#undef BREAK_SEQUENCE
+#undef COUNT_JUMP
+#undef SAMPLE_BCI
+#undef NEXT
+#undef JUMP_IF_AT
+#undef JUMP_IF
+
+ABORT:
+        if (SAMPLE) {
+            sampler->unwind(sampledDepth);
+        }
+        if (context != NULL && context != entered) {
+            frames.pop(context);
+        }
+        while (!execStack.empty()) {
+            if (execStack.back().context != entered) {
+                frames.pop(execStack.back().context);
+            }
+            execStack.pop_back();
+        }
+        return false;
+    }
 
-        if (fun->returnType() == VT_DOUBLE)
-            d->pushd(dv);
-        if (fun->returnType() == VT_INT)
-            d->pushi(iv);
-        if (fun->returnType() == VT_STRING)
-            d->pushid(idv);
+#ifdef MATHVM_OPCODE_STATS
+    static bool moreFrequent(const pair<uint64_t, size_t>& a,
+            const pair<uint64_t, size_t>& b) {
+        return a.first > b.first;
+    }
 
-        delete context;
+    void OpcodeStats::report(ostream& out) const {
+        vector<pair<uint64_t, size_t> > sorted;
+        for (size_t i = 0; i < singles.size(); i++) {
+            if (singles[i] != 0) {
+                sorted.push_back(make_pair(singles[i], i));
+            }
+        }
+        stable_sort(sorted.begin(), sorted.end(), moreFrequent);
+        for (size_t i = 0; i < sorted.size(); i++) {
+            out << "opcode " << bytecodeName((Instruction) sorted[i].second)
+                    << " " << sorted[i].first << endl;
+        }
 
+        sorted.clear();
+        for (size_t i = 0; i < pairs.size(); i++) {
+            if (pairs[i] != 0) {
+                sorted.push_back(make_pair(pairs[i], i));
+            }
+        }
+        stable_sort(sorted.begin(), sorted.end(), moreFrequent);
+        for (size_t i = 0; i < sorted.size(); i++) {
+            out << "pair "
+                    << bytecodeName((Instruction) (sorted[i].second / BC_LAST))
+                    << " "
+                    << bytecodeName((Instruction) (sorted[i].second % BC_LAST))
+                    << " " << sorted[i].first << endl;
+        }
+    }
+#endif
+
+    void BytecodeInterpretator::popParameters(const BytecodeFunction* fun,
+            FunctionContex* context) {
+        size_t dc = 0, ic = 0, sc = 0;
+        for (uint16_t i = 0; i < fun->parametersNumber(); i++) {
+            VarType type = fun->parameterType(i);
+            if (type == VT_DOUBLE) {
+                context->setd(dc++, dstack.popd());
+            }
+            if (type == VT_INT) {
+                context->seti(ic++, dstack.popi());
+            }
+            if (type == VT_STRING) {
+                context->sets(sc++, dstack.popid());
+            }
+        }
+    }
 
-        if (!execStack.empty())
-            goto RETURNFROMEXE;
+    FunctionContex* BytecodeInterpretator::enterCompiled(
+            const BytecodeFunction* fun) {
+        FunctionContex* context = frames.push(fun);
+        calls++;
+        context->setShadowed(display[fun->depth()]);
+        display[fun->depth()] = context;
+        popParameters(fun, context);
+        try {
+            dstack.reserve(fun->maxStack);
+        } catch (const DataBytecode::Overflow&) {
+            execStatus = new Status("Operand stack overflow", 0);
+            leaveCompiled(fun, context);
+            return NULL;
+        }
+        return context;
+    }
 
+    void BytecodeInterpretator::leaveCompiled(const BytecodeFunction* fun,
+            FunctionContex* context) {
+        display[fun->depth()] = context->shadowed();
+        frames.pop(context);
     }
 
-    BytecodeInterpretator::~BytecodeInterpretator() {
-        delete functions[0];
+    bool BytecodeInterpretator::callInterpreted(uint16_t id) {
+        return execFunction(functions[id]);
     }
 
-}
\ No newline at end of file
+}
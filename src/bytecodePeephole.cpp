@@ -0,0 +1,311 @@
+#include "bytecodePeephole.h"
+
+#include <limits>
+
+namespace mathvm {
+
+    // longest sequence the patterns look at
+    static const size_t WINDOW_SIZE = 5;
+
+    static uint32_t insnLength(const Bytecode* b, uint32_t bci) {
+        size_t length;
+        bytecodeName(b->getInsn(bci), &length);
+        return length;
+    }
+
+    static bool loadsLocalInt(const Bytecode* b, uint32_t bci, uint16_t* id) {
+        switch (b->getInsn(bci)) {
+            case BC_LOADIVAR: *id = b->getUInt16(bci + 1); return true;
+            case BC_LOADIVAR0: *id = 0; return true;
+            case BC_LOADIVAR1: *id = 1; return true;
+            case BC_LOADIVAR2: *id = 2; return true;
+            case BC_LOADIVAR3: *id = 3; return true;
+            default: return false;
+        }
+    }
+
+    static bool storesLocalInt(const Bytecode* b, uint32_t bci, uint16_t* id) {
+        switch (b->getInsn(bci)) {
+            case BC_STOREIVAR: *id = b->getUInt16(bci + 1); return true;
+            case BC_STOREIVAR0: *id = 0; return true;
+            case BC_STOREIVAR1: *id = 1; return true;
+            case BC_STOREIVAR2: *id = 2; return true;
+            case BC_STOREIVAR3: *id = 3; return true;
+            default: return false;
+        }
+    }
+
+    static bool loadsIntConst(const Bytecode* b, uint32_t bci, int64_t* value) {
+        switch (b->getInsn(bci)) {
+            case BC_ILOAD: *value = b->getInt64(bci + 1); return true;
+            case BC_ILOAD0: *value = 0; return true;
+            case BC_ILOAD1: *value = 1; return true;
+            case BC_ILOADM1: *value = -1; return true;
+            default: return false;
+        }
+    }
+
+    static Instruction varsCompareJump(Instruction jump) {
+        switch (jump) {
+            case BC_IFICMPNE: return BC_IFICMPNEVAR;
+            case BC_IFICMPE: return BC_IFICMPEVAR;
+            case BC_IFICMPG: return BC_IFICMPGVAR;
+            case BC_IFICMPGE: return BC_IFICMPGEVAR;
+            case BC_IFICMPL: return BC_IFICMPLVAR;
+            case BC_IFICMPLE: return BC_IFICMPLEVAR;
+            default: return BC_INVALID;
+        }
+    }
+
+    // the jump taken exactly when the given one is not
+    static Instruction negatedJump(Instruction jump) {
+        switch (jump) {
+            case BC_IFICMPNE: return BC_IFICMPE;
+            case BC_IFICMPE: return BC_IFICMPNE;
+            case BC_IFICMPG: return BC_IFICMPLE;
+            case BC_IFICMPGE: return BC_IFICMPL;
+            case BC_IFICMPL: return BC_IFICMPGE;
+            case BC_IFICMPLE: return BC_IFICMPG;
+            // exact for NaN too, unordered counts as greater
+            case BC_DIFCMPNE: return BC_DIFCMPE;
+            case BC_DIFCMPE: return BC_DIFCMPNE;
+            case BC_DIFCMPG: return BC_DIFCMPLE;
+            case BC_DIFCMPGE: return BC_DIFCMPL;
+            case BC_DIFCMPL: return BC_DIFCMPGE;
+            case BC_DIFCMPLE: return BC_DIFCMPG;
+            default: return BC_INVALID;
+        }
+    }
+
+    void BytecodePeephole::optimize() {
+        Code::FunctionIterator fi(code);
+        while (fi.hasNext()) {
+            optimizeFunction((BytecodeFunction*) fi.next());
+        }
+    }
+
+    void BytecodePeephole::optimizeFunction(BytecodeFunction* fun) {
+        Bytecode* from = fun->bytecode();
+        uint32_t length = from->length();
+
+        targets.assign(length + 1, false);
+        for (uint32_t bci = 0; bci < length; bci += insnLength(from, bci)) {
+            Instruction insn = from->getInsn(bci);
+            if (insn >= BC_LAST || bci + insnLength(from, bci) > length) {
+                // broken code is left to the verifier
+                return;
+            }
+            if (Bytecode::jumpOffsetPos(insn) != 0) {
+                uint32_t target = from->jumpTarget(bci);
+                if (target > length) {
+                    return;
+                }
+                targets[target] = true;
+            }
+        }
+
+        Bytecode to;
+        newBci.assign(length + 1, 0);
+        jumps.clear();
+
+        for (uint32_t bci = 0; bci < length;) {
+            uint32_t start = to.current();
+            uint32_t end;
+
+            fillWindow(from, bci);
+            size_t count = fuse(from, &to);
+            if (count != 0) {
+                uint32_t last = window[count - 1];
+                end = last + insnLength(from, last);
+                fused_++;
+            } else if (compact && from->getInsn(bci) == BC_INVALID) {
+                // jumps to it go to whatever comes next
+                end = bci + 1;
+                stripped_++;
+            } else {
+                end = bci + insnLength(from, bci);
+                for (uint32_t i = bci; i < end; i++) {
+                    to.add(from->get(i));
+                }
+                uint32_t offsetPos = Bytecode::jumpOffsetPos(from->getInsn(bci));
+                if (offsetPos != 0) {
+                    jumps.push_back(make_pair(start + offsetPos,
+                            from->jumpTarget(bci)));
+                }
+            }
+            for (uint32_t i = bci; i < end; i++) {
+                newBci[i] = start;
+            }
+            bci = end;
+        }
+        newBci[length] = to.current();
+
+        for (size_t i = 0; i < jumps.size(); i++) {
+            uint32_t offsetPos = jumps[i].first;
+            to.setInt16(offsetPos, newBci[jumps[i].second] - offsetPos);
+        }
+        *from = to;
+        fun->remapPositions(newBci);
+    }
+
+    void BytecodePeephole::fillWindow(const Bytecode* from, uint32_t bci) {
+        window.clear();
+        window.push_back(bci);
+        bci += insnLength(from, bci);
+        while (window.size() < WINDOW_SIZE && bci < from->length()
+                && !targets[bci]) {
+            // cast placeholder that nobody patched, a no-op
+            if (from->getInsn(bci) != BC_INVALID) {
+                window.push_back(bci);
+            }
+            bci += insnLength(from, bci);
+        }
+    }
+
+    bool BytecodePeephole::fallsThrough(const Bytecode* from, uint32_t bci,
+            uint32_t target) const {
+        // jumps to a stripped placeholder go to the insn after it
+        bci += insnLength(from, bci);
+        while (compact && bci < target && from->getInsn(bci) == BC_INVALID) {
+            bci++;
+        }
+        return bci == target;
+    }
+
+    size_t BytecodePeephole::branchOver(const Bytecode* from, size_t at,
+            Instruction* jump, uint32_t* target) const {
+        *jump = from->getInsn(window[at]);
+        if (negatedJump(*jump) == BC_INVALID) {
+            // not a conditional jump, no target to read
+            return 1;
+        }
+        *target = from->jumpTarget(window[at]);
+        // IFxx over JA: the false edge becomes the fall-through
+        if (at + 1 < window.size()
+                && from->getInsn(window[at + 1]) == BC_JA
+                && fallsThrough(from, window[at + 1], *target)) {
+            *jump = negatedJump(*jump);
+            *target = from->jumpTarget(window[at + 1]);
+            return 2;
+        }
+        return 1;
+    }
+
+    size_t BytecodePeephole::fuse(const Bytecode* from, Bytecode* to) {
+        size_t count = fuseCompare(from, to);
+        if (count == 0)
+            count = fuseBranch(from, to);
+        if (count == 0)
+            count = fuseIncrement(from, to);
+        if (count == 0)
+            count = fuseNegate(from, to);
+        return count;
+    }
+
+    size_t BytecodePeephole::fuseCompare(const Bytecode* from, Bytecode* to) {
+        uint16_t first, second;
+        if (window.size() < 3
+                || !loadsLocalInt(from, window[0], &first)
+                || !loadsLocalInt(from, window[1], &second)) {
+            return 0;
+        }
+        Instruction jump;
+        uint32_t target;
+        size_t count = 2 + branchOver(from, 2, &jump, &target);
+        if (varsCompareJump(jump) == BC_INVALID) {
+            return 0;
+        }
+
+        to->addInsn(varsCompareJump(jump));
+        to->addUInt16(first);
+        to->addUInt16(second);
+        addJump(to, to->current(), target);
+        return count;
+    }
+
+    size_t BytecodePeephole::fuseBranch(const Bytecode* from, Bytecode* to) {
+        Instruction jump;
+        uint32_t target;
+        if (branchOver(from, 0, &jump, &target) == 1) {
+            return 0;
+        }
+
+        to->addInsn(jump);
+        addJump(to, to->current(), target);
+        return 2;
+    }
+
+    size_t BytecodePeephole::fuseIncrement(const Bytecode* from, Bytecode* to) {
+        uint16_t var, stored;
+        int64_t value;
+        bool subtract;
+        size_t count;
+
+        if (window.size() >= 4
+                && loadsLocalInt(from, window[0], &var)
+                && loadsIntConst(from, window[1], &value)
+                && (from->getInsn(window[2]) == BC_IADD
+                || from->getInsn(window[2]) == BC_ISUB)) {
+            // x = x + c, x = x - c, for loop counter
+            subtract = from->getInsn(window[2]) == BC_ISUB;
+            count = 4;
+        } else if (window.size() >= 4
+                && loadsIntConst(from, window[0], &value)
+                && loadsLocalInt(from, window[1], &var)
+                && from->getInsn(window[2]) == BC_IADD) {
+            // x += c
+            subtract = false;
+            count = 4;
+        } else if (window.size() >= 5
+                && loadsIntConst(from, window[0], &value)
+                && loadsLocalInt(from, window[1], &var)
+                && from->getInsn(window[2]) == BC_ISWAP
+                && from->getInsn(window[3]) == BC_ISUB) {
+            // x -= c
+            subtract = true;
+            count = 5;
+        } else {
+            return 0;
+        }
+        if (!storesLocalInt(from, window[count - 1], &stored) || stored != var) {
+            return 0;
+        }
+        // negated below, so symmetric range
+        int64_t limit = numeric_limits<int16_t>::max();
+        if (value < -limit || value > limit) {
+            return 0;
+        }
+
+        to->addInsn(BC_IINCVAR);
+        to->addUInt16(var);
+        to->addInt16(subtract ? -value : value);
+        return count;
+    }
+
+    size_t BytecodePeephole::fuseNegate(const Bytecode* from, Bytecode* to) {
+        if (window.size() < 2) {
+            return 0;
+        }
+        Instruction load = from->getInsn(window[0]);
+        Instruction mul = from->getInsn(window[1]);
+
+        if (mul == BC_IMUL && (load == BC_ILOADM1
+                || (load == BC_ILOAD && from->getInt64(window[0] + 1) == -1))) {
+            to->addInsn(BC_INEG);
+            return 2;
+        }
+        if (mul == BC_DMUL && (load == BC_DLOADM1
+                || (load == BC_DLOAD && from->getDouble(window[0] + 1) == -1.0))) {
+            to->addInsn(BC_DNEG);
+            return 2;
+        }
+        return 0;
+    }
+
+    void BytecodePeephole::addJump(Bytecode* to, uint32_t offsetPos,
+            uint32_t target) {
+        jumps.push_back(make_pair(offsetPos, target));
+        to->addInt16(0);
+    }
+
+}
@@ -0,0 +1,80 @@
+#include "bytecodeProgram.h"
+
+namespace mathvm {
+
+    Status* Program::create(const string& source, Program** program,
+            const string& impl) {
+        *program = NULL;
+        Translator* translator = Translator::create(impl);
+        Code* code = NULL;
+        Status* status = translator->translate(source, &code);
+        delete translator;
+        if (status != NULL && status->isError()) {
+            delete code;
+            return status;
+        }
+        delete status;
+
+        BytecodeCode* bytecodeCode = dynamic_cast<BytecodeCode*> (code);
+        if (bytecodeCode == NULL) {
+            delete code;
+            return new Status("Only bytecode can be run as a program");
+        }
+        *program = new BytecodeProgram(bytecodeCode);
+        return NULL;
+    }
+
+    ExecutionContext* BytecodeProgram::createContext() {
+        return new BytecodeExecutionContext(_code);
+    }
+
+    BytecodeExecutionContext::BytecodeExecutionContext(
+            const BytecodeCode* code_) :
+    code(code_), interpreter(code_->stackSize() != 0 ?
+    code_->stackSize() : DataBytecode::DEFAULT_MAX_SIZE) {
+        if (code->output() != NULL) {
+            interpreter.setOutput(code->output());
+        }
+        interpreter.setCompiled(code->compiledFunctions());
+        prepareStatus = interpreter.prepare(*code);
+    }
+
+    Status* BytecodeExecutionContext::setGlobal(const Var& var) {
+        return prepareStatus != NULL ? prepared() : interpreter.setGlobal(var);
+    }
+
+    Status* BytecodeExecutionContext::getGlobal(Var* var) {
+        return prepareStatus != NULL ? prepared() : interpreter.getGlobal(var);
+    }
+
+    Status* BytecodeExecutionContext::execute() {
+        return prepareStatus != NULL ? prepared() : interpreter.runTop();
+    }
+
+    Status* BytecodeExecutionContext::call(const string& name,
+            const vector<Var*>& args, Var* result) {
+        TranslatedFunction* function = code->functionByName(name);
+        if (function == NULL) {
+            return new Status("No function " + name);
+        }
+        return call(function, args, result);
+    }
+
+    Status* BytecodeExecutionContext::call(const TranslatedFunction* function,
+            const vector<Var*>& args, Var* result) {
+        if (prepareStatus != NULL) {
+            return prepared();
+        }
+        if (code->functionById(function->id()) != function) {
+            return new Status("Function " + function->name()
+                    + " is of another program");
+        }
+        return interpreter.call(function->id(), args, result);
+    }
+
+    void BytecodeExecutionContext::reset() {
+        if (prepareStatus == NULL) {
+            interpreter.reset();
+        }
+    }
+}
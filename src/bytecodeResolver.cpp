@@ -0,0 +1,217 @@
+#include "bytecodeResolver.h"
+
+#include "nativeCall.h"
+
+#include <sstream>
+
+namespace mathvm {
+
+    // libm functions with an instruction of their own, by symbol
+    static Instruction nativeIntrinsic(const NativeCallNode* node) {
+        const Signature& signature = node->nativeSignature();
+        for (size_t i = 0; i < signature.size(); i++) {
+            if (signature[i].first != VT_DOUBLE) {
+                return BC_INVALID;
+            }
+        }
+        const string& name = node->nativeName();
+        if (signature.size() == 2) {
+            if (name == "sqrt") {
+                return BC_DSQRT;
+            }
+            if (name == "sin") {
+                return BC_DSIN;
+            }
+            if (name == "cos") {
+                return BC_DCOS;
+            }
+        }
+        if (signature.size() == 3 && name == "pow") {
+            return BC_DPOW;
+        }
+        return BC_INVALID;
+    }
+
+    static bool isZero(AstNode* node) {
+        if (node->isIntLiteralNode()) {
+            return node->asIntLiteralNode()->literal() == 0;
+        }
+        if (node->isDoubleLiteralNode()) {
+            return node->asDoubleLiteralNode()->literal() == 0.0;
+        }
+        return false;
+    }
+
+    // param, 0 + param or param + 0
+    static bool isParameter(AstNode* node, const AstVar* param) {
+        if (node->isBinaryOpNode()) {
+            BinaryOpNode* add = node->asBinaryOpNode();
+            if (add->kind() != tADD) {
+                return false;
+            }
+            if (isZero(add->left())) {
+                node = add->right();
+            } else if (isZero(add->right())) {
+                node = add->left();
+            } else {
+                return false;
+            }
+        }
+        return node->isLoadNode() && node->asLoadNode()->var() == param;
+    }
+
+    // Natives of the libm functions above, and the int <-> double
+    // conversions programs write as functions returning their
+    // parameter, such as int(double d) { return 0 + d; }.
+    static Instruction intrinsicOf(AstFunction* function) {
+        BlockNode* body = function->node()->body();
+        if (body->nodes() == 0) {
+            return BC_INVALID;
+        }
+        AstNode* first = body->nodeAt(0);
+        if (first->isNativeCallNode()) {
+            return nativeIntrinsic(first->asNativeCallNode());
+        }
+        if (function->parametersNumber() != 1 || body->nodes() != 1
+                || !first->isReturnNode()
+                || first->asReturnNode()->returnExpr() == NULL) {
+            return BC_INVALID;
+        }
+        VarType from = function->parameterType(0);
+        VarType to = function->returnType();
+        Instruction conversion = BC_INVALID;
+        if (from == VT_INT && to == VT_DOUBLE) {
+            conversion = BC_I2D;
+        } else if (from == VT_DOUBLE && to == VT_INT) {
+            conversion = BC_D2I;
+        }
+        const AstVar* param = function->scope()->lookupVariable(
+                function->parameterName(0));
+        if (conversion == BC_INVALID
+                || !isParameter(first->asReturnNode()->returnExpr(), param)) {
+            return BC_INVALID;
+        }
+        return conversion;
+    }
+
+    Status* BytecodeResolver::resolve(AstFunction* top) {
+        declareFunction(top);
+        resolveFunction(top);
+
+        // the program's globals, in the top block
+        Scope::VarIterator varIt(top->node()->body()->scope());
+        while (varIt.hasNext()) {
+            const AstVar* var = varIt.next();
+            const VarBinding& binding = bindingOf(var);
+            code->globalVars()->insert(make_pair(var->name(),
+                    GlobalVar(binding.type, binding.slot)));
+        }
+        return status;
+    }
+
+    void BytecodeResolver::declareFunction(AstFunction* function) {
+        BytecodeFunction* fun = new BytecodeFunction(function);
+        code->addFunction(fun);
+        fun->setDepth(frame == NULL ? 0 : frame->depth() + 1);
+        fun->setIntrinsic(intrinsicOf(function));
+        function->setInfo(fun);
+        functions.push_back(function);
+    }
+
+    void BytecodeResolver::bindScope(Scope* scope) {
+        Scope::VarIterator varIt(scope);
+        while (varIt.hasNext()) {
+            AstVar* var = varIt.next();
+            VarBinding binding;
+            binding.depth = frame->depth();
+            binding.type = var->type();
+            if (var->type() == VT_DOUBLE) {
+                binding.slot = frame->sizeDoubles++;
+            } else if (var->type() == VT_INT) {
+                binding.slot = frame->sizeInts++;
+            } else {
+                assert(var->type() == VT_STRING);
+                binding.slot = frame->sizeStrings++;
+            }
+            bindings.push_back(binding);
+            var->setInfo(&bindings.back());
+        }
+    }
+
+    void BytecodeResolver::resolveFunction(AstFunction* function) {
+        BytecodeFunction* outer = frame;
+        frame = functionOf(function);
+
+        bindScope(function->scope());
+        function->node()->body()->visit(this);
+
+        frame = outer;
+    }
+
+    void BytecodeResolver::visitBlockNode(BlockNode* node) {
+        if (status != NULL) {
+            return;
+        }
+        bindScope(node->scope());
+
+        vector<AstFunction*> declared;
+        Scope::FunctionIterator funIt(node->scope());
+        while (funIt.hasNext()) {
+            declared.push_back(funIt.next());
+            declareFunction(declared.back());
+        }
+        for (size_t i = 0; i < declared.size(); i++) {
+            resolveFunction(declared[i]);
+        }
+
+        node->visitChildren(this);
+    }
+
+    void BytecodeResolver::visitCallNode(CallNode* node) {
+        if (status != NULL) {
+            return;
+        }
+        // by name among those declared so far, wherever they are
+        TranslatedFunction* fun = code->functionByName(node->name());
+        if (fun == NULL) {
+            stringstream ss;
+            ss << "Undefined function call ";
+            ss << "with name " << node->name();
+            status = new Status(ss.str(), node->position());
+            return;
+        }
+        if (node->parametersNumber() != fun->parametersNumber()) {
+            stringstream ss;
+            ss << "Parameters number mismatch: " << node->parametersNumber()
+                    << " vs " << fun->parametersNumber();
+            status = new Status(ss.str());
+            return;
+        }
+        node->setInfo(fun);
+
+        // the last parameter is pushed first
+        for (int i = node->parametersNumber() - 1; i >= 0; i--) {
+            node->parameterAt(i)->visit(this);
+        }
+    }
+
+    void BytecodeResolver::visitStringLiteralNode(StringLiteralNode* node) {
+        node->setInfo((void*) keepId(code->makeStringConstant(node->literal())));
+    }
+
+    void BytecodeResolver::visitNativeCallNode(NativeCallNode* node) {
+        if (status != NULL) {
+            return;
+        }
+        const void* address = resolveNative(node->nativeName());
+        if (address == NULL) {
+            status = new Status("Undefined native function "
+                    + node->nativeName(), node->position());
+            return;
+        }
+        uint16_t id = code->makeNativeFunction(node->nativeName(),
+                node->nativeSignature(), address);
+        node->setInfo((void*) keepId(id));
+    }
+
+}
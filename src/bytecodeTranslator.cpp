@@ -1,10 +1,18 @@
 #include "bytecodeTranslator.h"
+#include "bytecodeFile.h"
+#include "compileCache.h"
+#include "bytecodePeephole.h"
+#include "bytecodeVerifier.h"
 #include "mathvm.h"
 #include "parser.h"
 #include "bytecodeCode.h"
 #include "ast.h"
 #include "AsmJit/Build.h"
 
+#include <pthread.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 #include <sstream>
@@ -14,79 +22,148 @@ using namespace std;
 namespace mathvm {
 
     Status* BytecodeTranslator::translate(const string& program, Code** code_) {
-        Parser parser;
-        Status* status = parser.parseProgram(program);
-
-        if (status != NULL && status->isError()) {
-            return status;
+        string entry;
+        if (cache_ != NULL) {
+            entry = cache_->entryPath(program, optimize_ ? 1 : 0);
+            BytecodeCode* cached = createCode();
+            if (cache_->load(entry, cached)) {
+                *code_ = cached;
+                return NULL;
+            }
+            delete cached;
         }
 
-        BytecodeCode* code = new BytecodeCode();
-
+        BytecodeCode* code = createCode();
         *code_ = code;
+        Status* status = translateBytecode(program, code);
+        if (cache_ != NULL && status == NULL) {
+            cache_->store(entry, code);
+        }
+        return status;
+    }
 
-        BytecodeAstVisitor visitor(code);
-        visitor.visitAst(parser.top());
+    Status* BytecodeTranslator::load(const string& path, Code** code_) {
+        BytecodeCode* code = createCode();
+        *code_ = code;
+        return BytecodeFile::load(path, code);
+    }
 
-        //        cout << "size::" << code->globalVars()->size() << endl;
-        if (visitor.status != NULL && visitor.status->isError()) {
-            return visitor.status;
+    // Functions left to translate, shared by the translating threads;
+    // each takes the next id until none is left.
+    struct CodegenJobs {
+        BytecodeCode* code;
+        const Parser* parser;
+        const BytecodeResolver* resolver;
+        uint32_t next;
+        // by function id, NULL where translated
+        vector<Status*> statuses;
+    };
+
+    static void translateFunctions(CodegenJobs* jobs) {
+        BytecodeAstVisitor visitor(jobs->code, jobs->parser);
+        uint32_t count = jobs->resolver->functionsNumber();
+        while (true) {
+            uint32_t id = __sync_fetch_and_add(&jobs->next, 1);
+            if (id >= count) {
+                break;
+            }
+            jobs->statuses[id] =
+                    visitor.translateFunction(jobs->resolver->functionById(id));
         }
+    }
 
+    static void* translateThread(void* jobs) {
+        translateFunctions((CodegenJobs*) jobs);
         return NULL;
+    }
 
+    uint32_t BytecodeTranslator::defaultThreads() {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        return cpus < 1 ? 1 : (uint32_t) cpus;
     }
 
-    void BytecodeAstVisitor::visitAst(AstFunction* fun) {
-        size_t bci = 0;
-        Scope::VarIterator varIt(fun->node()->body()->scope());
+    Status* BytecodeTranslator::translateBytecode(const string& program,
+            BytecodeCode* code) {
+        Parser parser;
+        Status* status = parser.parseProgram(program);
 
-        while (varIt.hasNext()) {
-            AstVar* var = varIt.next();
-            string name(var->name());
-            code->globalVars()->insert(make_pair(name, bci));
-            bci++; // load instruction
+        if (status != NULL && status->isError()) {
+            return status;
         }
 
+        BytecodeResolver resolver(code);
+        status = resolver.resolve(parser.top());
+        if (status != NULL) {
+            return status;
+        }
 
-        BytecodeFunction* bfun = new BytecodeFunction(fun);
-        code->addFunction(bfun);
-
-        fillAstFunction(fun, bfun);
-
-        currentContext = 0; // I know it.
-        currentFunction = bfun;
-
-        functionsStack.push_back(currentContext);
-        contextsStack.push_back(currentContext);
+        // each function's bytecode depends on its body and on what the
+        // resolver declared, so the order they are done in doesn't show
+        CodegenJobs jobs;
+        jobs.code = code;
+        jobs.parser = &parser;
+        jobs.resolver = &resolver;
+        jobs.next = 0;
+        jobs.statuses.assign(resolver.functionsNumber(), NULL);
+
+        uint32_t helpers = min(threads_, resolver.functionsNumber()) - 1;
+        vector<pthread_t> threads;
+        for (uint32_t i = 0; i < helpers; i++) {
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, translateThread, &jobs) != 0) {
+                break;
+            }
+            threads.push_back(thread);
+        }
+        translateFunctions(&jobs);
+        for (size_t i = 0; i < threads.size(); i++) {
+            pthread_join(threads[i], NULL);
+        }
 
+        // that of the first function, as translating one by one would
+        for (size_t i = 0; i < jobs.statuses.size(); i++) {
+            if (status == NULL) {
+                status = jobs.statuses[i];
+            } else {
+                delete jobs.statuses[i];
+            }
+        }
+        if (status != NULL) {
+            return status;
+        }
 
-        fun->node()->visit(this);
+        if (optimize_) {
+            BytecodePeephole peephole(code);
+            peephole.optimize();
+        }
 
-        // I will not drop something from stacks
+        BytecodeVerifier verifier(code);
+        return verifier.verify();
 
     }
 
-    void BytecodeAstVisitor::fillAstFunction(AstFunction* function, BytecodeFunction* fun) {
+    Status* BytecodeAstVisitor::translateFunction(AstFunction* function) {
+        currentFunction = BytecodeResolver::functionOf(function);
+        sourceOffset = Status::INVALID_POSITION;
+        status = NULL;
+        // nothing left from the function translated before
+        trueIdUnsettedPos = 0;
+        falseIdUnsettedPos = 0;
+        while (!typesStack.empty()) {
+            typesStack.pop();
+        }
 
-        map<string, uint16_t> paramIds;
-        
-        for (int i = 0; i < function->parametersNumber(); i++) {
-            if (function->parameterType(i) == VT_DOUBLE) {
-                paramIds[function->parameterName(i)] = fun->sizeDoubles++;
-            }
-            if (function->parameterType(i) == VT_INT) {
-                paramIds[function->parameterName(i)] = fun->sizeInts++;
-            }
-            if (function->parameterType(i) == VT_STRING) {
-                paramIds[function->parameterName(i)] = fun->sizeStrings++;
+        try {
+            function->node()->visit(this);
+            if (currentFunction->id() == 0) {
+                // top level code has no return statement of its own
+                addInsn(BC_RETURN);
             }
+        } catch (const exception& e) {
+            delete status;
+            status = new Status(e.what(), sourceOffset);
         }
-        
-
-        functionParamIds[fun->id()] = paramIds;
-        contextVarIds[fun->id()] = map<string, uint16_t>();
-
+        return status;
     }
 
     void BytecodeAstVisitor::visitFunctionNode_(FunctionNode* node) {
@@ -94,70 +171,33 @@ namespace mathvm {
     }
 
     void BytecodeAstVisitor::visitBlockNode_(BlockNode* node) {
-
-        Scope::VarIterator varIt(node->scope());
-        while (varIt.hasNext()) {
-            AstVar* var = varIt.next();
-            allocateVar(*var);
-        }
-
-        Scope::FunctionIterator funIt(node->scope());
-        vector<pair<AstFunction*, BytecodeFunction*> > vfuns;
-        while (funIt.hasNext()) {
-            AstFunction* function = funIt.next();
-            BytecodeFunction* fun = new BytecodeFunction(function);
-            vfuns.push_back(make_pair(function, fun));
-            code->addFunction(fun);
-            fillAstFunction(function, fun);
-        }
-
-        for (size_t i = 0; i < vfuns.size(); i++) {
-
-            AstFunction* function = vfuns[i].first;
-            BytecodeFunction* fun = vfuns[i].second;
-
-            BytecodeFunction* prevFunction = currentFunction;
-            uint16_t prevContext = currentContext;
-
-            currentContext = fun->id();
-            currentFunction = fun;
-
-            functionsStack.push_back(currentContext);
-            contextsStack.push_back(currentContext);
-
-            function->node()->visit(this);
-
-            currentFunction = prevFunction;
-            currentContext = prevContext;
-
-            functionsStack.pop_back();
-            contextsStack.pop_back();
-
-        }
-
+        // functions declared here are translated on their own
         for (uint32_t i = 0; i < node->nodes(); i++) {
             node->nodeAt(i)->visit(this);
+            dropUnusedValue(node->nodeAt(i));
         }
 
     }
 
-    uint16_t BytecodeAstVisitor::allocateVar(AstVar& var) {
-        if (var.type() == VT_DOUBLE) {
-            contextVarIds[currentContext][var.name()] = 
-                    currentFunction->sizeDoubles;
-            return currentFunction->sizeDoubles++;
+    void BytecodeAstVisitor::dropUnusedValue(AstNode* statement) {
+        // expression used as a statement, its value stays on the stack
+        if (status != NULL)
+            return;
+        if (!statement->isCallNode() && !statement->isBinaryOpNode() &&
+                !statement->isUnaryOpNode() && !statement->isLoadNode() &&
+                !statement->isIntLiteralNode() &&
+                !statement->isDoubleLiteralNode() &&
+                !statement->isStringLiteralNode()) {
+            return;
         }
-        if (var.type() == VT_INT) {
-            contextVarIds[currentContext][var.name()] = 
-                    currentFunction->sizeInts;
-            return currentFunction->sizeInts++;
+        if (topType() == VT_LOGIC) {
+            setTrueJump(current());
+            setFalseJump(current());
+            return;
         }
-        if (var.type() == VT_STRING) {
-            contextVarIds[currentContext][var.name()] = 
-                    currentFunction->sizeStrings;
-            return currentFunction->sizeStrings++;
+        if (topType() != VT_VOID) {
+            addInsn(BC_POP);
         }
-        assert(false);
     }
 
     void BytecodeAstVisitor::addTypedOpInsn(VarType type, TokenKind op) {
@@ -190,6 +230,11 @@ namespace mathvm {
                 addInsn(BC_DDIV);
         }
 
+        if (op == tMOD) {
+            if (type == VT_INT)
+                addInsn(BC_IMOD);
+        }
+
         if (op == tAAND) {
             if (type == VT_INT)
                 addInsn(BC_IAAND);
@@ -333,15 +378,11 @@ namespace mathvm {
         ensureType(rightType, maxType, trueIdUnsettedPos, falseIdUnsettedPos);
 
         if (logicCompareKinds.find(node->kind()) != logicCompareKinds.end()) {
-            //            return;
-            if (maxType == VT_INT) {
-                addInsn(BC_ICMP);
-            }
             if (maxType == VT_DOUBLE) {
-                addInsn(BC_DCMP);
+                addTrueFalseJumpRegion(logicKindToDoubleJump[node->kind()]);
+            } else {
+                addTrueFalseJumpRegion(logicKindToJump[node->kind()]);
             }
-            addInsn(BC_ILOAD0);
-            addTrueFalseJumpRegion(logicKindToJump[node->kind()]);
             typesStack.push(VT_LOGIC);
         } else {
             addTypedOpInsn(maxType, node->kind());
@@ -378,51 +419,54 @@ namespace mathvm {
             addInsn(BC_STOREDVAR);
         }
         //        addId(astVarsContext[node->var()]);
-        addId(findVarLocal(node->var()->name()));
+        addId(localSlot(node->var()));
 
 
         uint16_t forConditionId = current();
 
         if (node->var()->type() == VT_INT) {
             addInsn(BC_LOADIVAR);
-            addId(findVarLocal(node->var()->name()));
+            addId(localSlot(node->var()));
             addInsn(BC_LOADIVAR);
             addId(topVar);
         }
 
         if (node->var()->type() == VT_DOUBLE) {
             addInsn(BC_LOADDVAR);
-            addId(findVarLocal(node->var()->name()));
+            addId(localSlot(node->var()));
             addInsn(BC_LOADDVAR);
             addId(topVar);
         }
 
         addTrueFalseJumpRegion(BC_IFICMPLE);
+        // the body overwrites them
+        uint16_t conditionTrueJump = trueIdUnsettedPos;
+        uint16_t conditionFalseJump = falseIdUnsettedPos;
 
         uint16_t bodyBegin = current();
         node->body()->visit(this);
 
         if (node->var()->type() == VT_INT) {
             addInsn(BC_LOADIVAR);
-            addId(findVarLocal(node->var()->name()));
+            addId(localSlot(node->var()));
             addInsn(BC_ILOAD1);
             addInsn(BC_IADD);
             addInsn(BC_STOREIVAR);
-            addId(findVarLocal(node->var()->name()));
+            addId(localSlot(node->var()));
         }
         if (node->var()->type() == VT_DOUBLE) {
             addInsn(BC_LOADDVAR);
-            addId(findVarLocal(node->var()->name()));
+            addId(localSlot(node->var()));
             addInsn(BC_DLOAD1);
             addInsn(BC_DADD);
             addInsn(BC_STOREDVAR);
-            addId(findVarLocal(node->var()->name()));
+            addId(localSlot(node->var()));
         }
         addInsn(BC_JA);
         addJump(forConditionId);
 
-        setTrueJump(bodyBegin);
-        setFalseJump(current());
+        setJump(conditionTrueJump, bodyBegin);
+        setJump(conditionFalseJump, current());
         //        addInsn(BC_INVALID);
 
     }
@@ -431,6 +475,9 @@ namespace mathvm {
 
         uint16_t whileCondition = current();
         node->whileExpr()->visit(this);
+        // the body overwrites them
+        uint16_t conditionTrueJump = trueIdUnsettedPos;
+        uint16_t conditionFalseJump = falseIdUnsettedPos;
 
         uint16_t bodyBegin = current();
         node->loopBlock()->visit(this);
@@ -438,71 +485,41 @@ namespace mathvm {
         addId(0);
         setJump(current() - 2, whileCondition);
 
-        setTrueJump(bodyBegin);
-        setFalseJump(current());
+        setJump(conditionTrueJump, bodyBegin);
+        setJump(conditionFalseJump, current());
 
         typesStack.push(VT_VOID);
     }
 
     void BytecodeAstVisitor::visitIfNode_(IfNode* node) {
 
-        addInsn(BC_JA);
-        uint32_t ifBeginId = current();
-        addId(0);
-        node->thenBlock()->visit(this);
-        addInsn(BC_JA);
-        uint32_t thenEndId = current();
-        addId(0);
-        uint32_t elseBeginId = current();
-        if (node->elseBlock() != NULL)
-            node->elseBlock()->visit(this);
-        addInsn(BC_JA);
-        uint32_t elseEndId = current();
-        addId(0);
-
-        uint32_t ifExprBeginId = current();
-        setJump(ifBeginId, ifExprBeginId);
-
+        // condition first, so the then block follows its true jump
+        // and the peephole pass can make it a fall-through
         node->ifExpr()->visit(this);
-        setTrueJump(ifBeginId + 2);
-        setFalseJump(elseBeginId);
-
-        uint32_t ifExprEndId = current();
-        setJump(thenEndId, (uint16_t) ifExprEndId);
-        setJump(elseEndId, (uint16_t) ifExprEndId);
-        //        addInsn(BC_INVALID); // just idle
-
-    }
-
-    pair<uint16_t, uint16_t> BytecodeAstVisitor::findVar(const string& name, bool onlyCurrentContext) {
-
-        size_t stackI = contextsStack.size() - 1;
-
-        while (true) {
-            uint16_t cctx = contextsStack[stackI];
-            if (contextVarIds[cctx].find(name) != contextVarIds[cctx].end()) {
-                return make_pair(cctx, contextVarIds[cctx][name]);
-            }
-            if (functionParamIds[cctx].find(name) != functionParamIds[cctx].end()) {
-                return make_pair(cctx, functionParamIds[cctx][name]);
-            }
-
-            if (onlyCurrentContext)
-                break;
-
-            if (stackI == 0)
-                break;
+        uint16_t conditionTrueJump = trueIdUnsettedPos;
+        uint16_t conditionFalseJump = falseIdUnsettedPos;
 
-            stackI--;
+        setJump(conditionTrueJump, current());
+        node->thenBlock()->visit(this);
 
+        if (node->elseBlock() != NULL) {
+            addInsn(BC_JA);
+            uint32_t thenEndId = current();
+            addId(0);
+            setJump(conditionFalseJump, current());
+            node->elseBlock()->visit(this);
+            setJump(thenEndId, current());
+        } else {
+            setJump(conditionFalseJump, current());
         }
 
-        if (onlyCurrentContext)
-            throw logic_error("cant find name " + name + "[local]");
-        throw logic_error("cant find name " + name);
-
-        return make_pair(0, 0);
+    }
 
+    uint16_t BytecodeAstVisitor::localSlot(const AstVar* var) {
+        const VarBinding& binding = BytecodeResolver::bindingOf(var);
+        if (binding.depth != currentDepth())
+            throw logic_error("cant find name " + var->name() + "[local]");
+        return binding.slot;
     }
 
     void BytecodeAstVisitor::loadVar(const AstVar* var) {
@@ -510,30 +527,30 @@ namespace mathvm {
         //        cout << "load var " << var->name() << " :: " << (void*) var << endl;
         //        cout << "owner " << (void*) var->owner() << endl;
 
-        pair<uint16_t, uint16_t> ids = findVar(var->name());
+        const VarBinding& binding = BytecodeResolver::bindingOf(var);
 
         if (var->type() == VT_DOUBLE) {
-            if (ids.first != contextsStack.back())
+            if (binding.depth != currentDepth())
                 addInsn(BC_LOADCTXDVAR);
             else
                 addInsn(BC_LOADDVAR);
         }
         if (var->type() == VT_INT) {
-            if (ids.first != contextsStack.back())
+            if (binding.depth != currentDepth())
                 addInsn(BC_LOADCTXIVAR);
             else
                 addInsn(BC_LOADIVAR);
         }
         if (var->type() == VT_STRING) {
-            if (ids.first != contextsStack.back())
+            if (binding.depth != currentDepth())
                 addInsn(BC_LOADCTXSVAR);
             else
                 addInsn(BC_LOADSVAR);
         }
 
-        if (ids.first != contextsStack.back())
-            addId(ids.first);
-        addId(ids.second);
+        if (binding.depth != currentDepth())
+            addId(binding.depth);
+        addId(binding.slot);
 
         typesStack.push(var->type());
     }
@@ -544,36 +561,43 @@ namespace mathvm {
 
     void BytecodeAstVisitor::visitCallNode_(CallNode* node) {
 
-        TranslatedFunction* fun = code->functionByName(node->name());
-        if (fun == NULL) {
-            stringstream ss;
-            ss << "Undefined function call ";
-            ss << "with name " << node->name();
-            status = new Status(ss.str(), node->position());
-            return;
-        }
-        if (node->parametersNumber() != fun->parametersNumber()) {
-            stringstream ss;
-            ss << "Parameters number mismatch: " << node->parametersNumber()
-                    << " vs " << fun->parametersNumber();
-            status = new Status(ss.str());
-            return;
-        }
-        assert(fun);
+        BytecodeFunction* fun = BytecodeResolver::calleeOf(node);
 
         for (int i = node->parametersNumber() - 1; i >= 0; i--) {
             node->parameterAt(i)->visit(this);
             ensureType(fun->parameterType(i), trueIdUnsettedPos, falseIdUnsettedPos);
         }
-        addInsn(BC_CALL);
-        addId(fun->id());
+        if (fun->intrinsic() != BC_INVALID) {
+            addInsn(fun->intrinsic());
+        } else {
+            addInsn(BC_CALL);
+            addId(fun->id());
+        }
         typesStack.push(fun->returnType());
     }
 
-    // TODO: 
-
     void BytecodeAstVisitor::visitNativeCallNode_(NativeCallNode* node) {
-        typesStack.push(node->nativeSignature()[0].first);
+        // body of a native function: pass own parameters through
+        const Signature& signature = node->nativeSignature();
+        for (size_t i = signature.size() - 1; i > 0; i--) {
+            VarType type = signature[i].first;
+            // parameters take the first slots of their type, in order
+            uint16_t id = 0;
+            for (size_t j = 1; j < i; j++) {
+                if (signature[j].first == type)
+                    id++;
+            }
+            if (type == VT_DOUBLE)
+                addInsn(BC_LOADDVAR);
+            if (type == VT_INT)
+                addInsn(BC_LOADIVAR);
+            if (type == VT_STRING)
+                addInsn(BC_LOADSVAR);
+            addId(id);
+        }
+        addInsn(BC_CALLNATIVE);
+        addId(BytecodeResolver::idOf(node));
+        typesStack.push(signature[0].first);
     }
 
     void BytecodeAstVisitor::visitPrintNode_(PrintNode* node) {
@@ -608,7 +632,7 @@ namespace mathvm {
     }
 
     void BytecodeAstVisitor::visitStoreNode_(StoreNode* node) {
-        pair<uint16_t, uint16_t> ids = findVar(node->var()->name());
+        const VarBinding& binding = BytecodeResolver::bindingOf(node->var());
         node->value()->visit(this);
         if (node->op() == tINCRSET || node->op() == tDECRSET) {
             ensureType(topType(), node->var()->type(), trueIdUnsettedPos, falseIdUnsettedPos);
@@ -632,26 +656,26 @@ STORE_TO_VAR:
         ensureType(node->var()->type(), trueIdUnsettedPos, falseIdUnsettedPos);
         const AstVar* var = node->var();
         if (var->type() == VT_DOUBLE) {
-            if (ids.first != contextsStack.back())
+            if (binding.depth != currentDepth())
                 addInsn(BC_STORECTXDVAR);
             else
                 addInsn(BC_STOREDVAR);
         }
         if (var->type() == VT_INT) {
-            if (ids.first != contextsStack.back())
+            if (binding.depth != currentDepth())
                 addInsn(BC_STORECTXIVAR);
             else
                 addInsn(BC_STOREIVAR);
         }
         if (var->type() == VT_STRING) {
-            if (ids.first != contextsStack.back())
+            if (binding.depth != currentDepth())
                 addInsn(BC_STORECTXSVAR);
             else
                 addInsn(BC_STORESVAR);
         }
-        if (ids.first != contextsStack.back())
-            currentBytecode()->addInt16(ids.first);
-        currentBytecode()->addInt16(ids.second);
+        if (binding.depth != currentDepth())
+            currentBytecode()->addInt16(binding.depth);
+        currentBytecode()->addInt16(binding.slot);
     }
 
     void BytecodeAstVisitor::visitDoubleLiteralNode_(DoubleLiteralNode* node) {
@@ -668,8 +692,7 @@ STORE_TO_VAR:
 
     void BytecodeAstVisitor::visitStringLiteralNode_(StringLiteralNode* node) {
         addInsn(BC_SLOAD);
-        uint16_t strId = code->makeStringConstant(node->literal());
-        addId(strId);
+        addId(BytecodeResolver::idOf(node));
         typesStack.push(VT_STRING);
     }
 
@@ -704,5 +727,23 @@ STORE_TO_VAR:
         return true;
     }
 
+    uint32_t BytecodeAstVisitor::enterNode(AstNode* node) {
+        uint32_t outerOffset = sourceOffset;
+        if (parser != NULL) {
+            sourceOffset = parser->tokenIndexToOffset(node->position());
+            currentFunction->setPosition(current(), sourceOffset);
+        }
+        return outerOffset;
+    }
+
+    void BytecodeAstVisitor::leaveNode(uint32_t outerOffset) {
+        if (parser != NULL && sourceOffset != outerOffset) {
+            sourceOffset = outerOffset;
+            // the rest of the enclosing node, e.g. the operation after
+            // its operands
+            currentFunction->setPosition(current(), sourceOffset);
+        }
+    }
+
 }
 
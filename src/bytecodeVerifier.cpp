@@ -0,0 +1,310 @@
+#include "bytecodeVerifier.h"
+
+#include <sstream>
+
+namespace mathvm {
+
+    static const struct {
+        int8_t pops;
+        int8_t pushes;
+    } stackEffects[BC_LAST] = {
+#define STACK_EFFECT(b, d, l, o, u) {o, u},
+        FOR_BYTECODES(STACK_EFFECT)
+#undef STACK_EFFECT
+    };
+
+    Status* BytecodeVerifier::verify() {
+        callers.clear();
+        contextAccesses.clear();
+
+        Code::FunctionIterator fi(code);
+        while (fi.hasNext()) {
+            BytecodeFunction* fun = (BytecodeFunction*) fi.next();
+            // display[0] always is the top level frame
+            if ((fun->id() == 0) != (fun->depth() == 0)) {
+                return error(fun, 0, "bad lexical depth");
+            }
+            Status* status = verifyFunction(fun);
+            if (status != NULL) {
+                return status;
+            }
+        }
+        for (size_t i = 0; i < contextAccesses.size(); i++) {
+            Status* status = checkContextAccess(contextAccesses[i]);
+            if (status != NULL) {
+                return status;
+            }
+        }
+        return NULL;
+    }
+
+    Status* BytecodeVerifier::verifyFunction(BytecodeFunction* fun) {
+        const Bytecode* b = fun->bytecode();
+        uint32_t length = b->length();
+        int32_t maxHeight = 0;
+
+        heights.assign(length, -1);
+        marks.assign(length, 0);
+        worklist.clear();
+        if (callers.size() <= fun->id()) {
+            callers.resize(fun->id() + 1);
+        }
+
+        if (length == 0) {
+            return error(fun, 0, "empty function body");
+        }
+        heights[0] = 0;
+        marks[0] = INSN_START;
+        worklist.push_back(0);
+
+        while (!worklist.empty()) {
+            uint32_t bci = worklist.back();
+            worklist.pop_back();
+
+            Instruction insn = b->getInsn(bci);
+            if (insn >= BC_LAST) {
+                return error(fun, bci, "unknown instruction");
+            }
+            size_t insnLength;
+            bytecodeName(insn, &insnLength);
+            if (bci + insnLength > length) {
+                return error(fun, bci, "truncated instruction");
+            }
+            for (uint32_t i = 1; i < insnLength; i++) {
+                if (marks[bci + i] == INSN_START) {
+                    return error(fun, bci + i, "jump into the middle of instruction");
+                }
+                marks[bci + i] = INSN_OPERAND;
+            }
+
+            Status* status = checkOperands(fun, bci);
+            if (status != NULL) {
+                return status;
+            }
+            int32_t pops, pushes;
+            status = stackEffect(fun, bci, &pops, &pushes);
+            if (status != NULL) {
+                return status;
+            }
+            if (insn == BC_CALL) {
+                uint16_t callee = b->getUInt16(bci + 1);
+                if (callers.size() <= callee) {
+                    callers.resize(callee + 1);
+                }
+                callers[callee].push_back(fun->id());
+            }
+
+            int32_t height = heights[bci];
+            if (height < pops) {
+                return error(fun, bci, "operand stack underflow");
+            }
+            height += pushes - pops;
+            if (height > maxHeight) {
+                maxHeight = height;
+            }
+
+            if (insn == BC_RETURN || insn == BC_STOP) {
+                continue;
+            }
+            uint32_t offsetPos = Bytecode::jumpOffsetPos(insn);
+            if (offsetPos != 0) {
+                status = enqueue(fun, bci, (int64_t) bci + offsetPos
+                        + b->getInt16(bci + offsetPos), height);
+            }
+            if (status == NULL && insn != BC_JA) {
+                status = enqueue(fun, bci, bci + insnLength, height);
+            }
+            if (status != NULL) {
+                return status;
+            }
+        }
+
+        fun->maxStack = maxHeight;
+        return NULL;
+    }
+
+    Status* BytecodeVerifier::enqueue(const BytecodeFunction* fun, uint32_t from,
+            int64_t to, int32_t height) {
+        if (to < 0 || to >= (int64_t) heights.size()) {
+            return error(fun, from, "control leaves the function body");
+        }
+        if (marks[to] == INSN_OPERAND) {
+            return error(fun, from, "jump into the middle of instruction");
+        }
+        if (heights[to] == -1) {
+            heights[to] = height;
+            marks[to] = INSN_START;
+            worklist.push_back(to);
+            return NULL;
+        }
+        if (heights[to] != height) {
+            stringstream ss;
+            ss << "inconsistent stack height at " << to << ": "
+                    << heights[to] << " vs " << height;
+            return error(fun, from, ss.str());
+        }
+        return NULL;
+    }
+
+    Status* BytecodeVerifier::stackEffect(const BytecodeFunction* fun, uint32_t bci,
+            int32_t* pops, int32_t* pushes) {
+        const Bytecode* b = fun->bytecode();
+        Instruction insn = b->getInsn(bci);
+
+        if (insn == BC_CALL) {
+            const TranslatedFunction* callee = code->functionById(b->getUInt16(bci + 1));
+            if (callee == NULL) {
+                return error(fun, bci, "call of unknown function");
+            }
+            *pops = callee->parametersNumber();
+            *pushes = callee->returnType() == VT_VOID ? 0 : 1;
+            return NULL;
+        }
+        if (insn == BC_CALLNATIVE) {
+            const Signature* signature = NULL;
+            const string* name = NULL;
+            code->nativeById(b->getUInt16(bci + 1), &signature, &name);
+            if (signature == NULL) {
+                return error(fun, bci, "call of unknown native function");
+            }
+            *pops = signature->size() - 1;
+            *pushes = (*signature)[0].first == VT_VOID ? 0 : 1;
+            return NULL;
+        }
+        if (insn == BC_RETURN) {
+            *pops = fun->returnType() == VT_VOID ? 0 : 1;
+            *pushes = 0;
+            return NULL;
+        }
+
+        *pops = stackEffects[insn].pops;
+        *pushes = stackEffects[insn].pushes;
+        assert(*pops >= 0 && *pushes >= 0);
+        return NULL;
+    }
+
+    static size_t slotsOf(const BytecodeFunction* fun, VarType type) {
+        return type == VT_DOUBLE ? fun->sizeDoubles
+                : type == VT_INT ? fun->sizeInts : fun->sizeStrings;
+    }
+
+    // the variable instructions come in runs of double, int and string,
+    // see FOR_BYTECODES
+    static VarType typeInRun(uint32_t index) {
+        static const VarType types[] = {VT_DOUBLE, VT_INT, VT_STRING};
+        return types[index % 3];
+    }
+
+    Status* BytecodeVerifier::checkOperands(const BytecodeFunction* fun,
+            uint32_t bci) {
+        const Bytecode* b = fun->bytecode();
+        Instruction insn = b->getInsn(bci);
+
+        if (insn == BC_SLOAD) {
+            if (b->getUInt16(bci + 1) >= code->constantsNumber()) {
+                return error(fun, bci, "unknown string constant");
+            }
+            return NULL;
+        }
+        if (insn >= BC_LOADDVAR0 && insn <= BC_STORESVAR3) {
+            // four of each
+            uint32_t index = insn - BC_LOADDVAR0;
+            return checkSlot(fun, bci, fun, typeInRun(index / 4), index % 4);
+        }
+        if (insn >= BC_LOADDVAR && insn <= BC_STORESVAR) {
+            return checkSlot(fun, bci, fun, typeInRun(insn - BC_LOADDVAR),
+                    b->getUInt16(bci + 1));
+        }
+        if (insn >= BC_LOADCTXDVAR && insn <= BC_STORECTXSVAR) {
+            ContextAccess access;
+            access.function = fun->id();
+            access.bci = bci;
+            access.depth = b->getUInt16(bci + 1);
+            access.type = typeInRun(insn - BC_LOADCTXDVAR);
+            access.slot = b->getUInt16(bci + 3);
+            if (access.depth > fun->depth()) {
+                return error(fun, bci, "context deeper than the function");
+            }
+            if (access.depth == fun->depth()) {
+                return checkSlot(fun, bci, fun, access.type, access.slot);
+            }
+            // the callers are only known once all functions are through
+            contextAccesses.push_back(access);
+            return NULL;
+        }
+        if (insn >= BC_IFICMPNEVAR && insn <= BC_IFICMPLEVAR) {
+            Status* status = checkSlot(fun, bci, fun, VT_INT, b->getUInt16(bci + 1));
+            if (status == NULL) {
+                status = checkSlot(fun, bci, fun, VT_INT, b->getUInt16(bci + 3));
+            }
+            return status;
+        }
+        if (insn == BC_IINCVAR) {
+            return checkSlot(fun, bci, fun, VT_INT, b->getUInt16(bci + 1));
+        }
+        return NULL;
+    }
+
+    Status* BytecodeVerifier::checkSlot(const BytecodeFunction* fun,
+            uint32_t bci, const BytecodeFunction* owner, VarType type,
+            uint16_t slot) {
+        if (slot < slotsOf(owner, type)) {
+            return NULL;
+        }
+        stringstream ss;
+        ss << "no " << typeToName(type) << " variable " << slot
+                << " in the frame of " << owner->name();
+        return error(fun, bci, ss.str());
+    }
+
+    Status* BytecodeVerifier::checkContextAccess(const ContextAccess& access) {
+        const BytecodeFunction* fun =
+                (const BytecodeFunction*) code->functionById(access.function);
+        if (access.depth == 0) {
+            return checkSlot(fun, access.bci,
+                    (const BytecodeFunction*) code->functionById(0),
+                    access.type, access.slot);
+        }
+
+        // display[depth] holds the frame of the function of that depth
+        // entered last, so walk the callers back until one is reached
+        vector<bool> seen(callers.size(), false);
+        vector<uint16_t> pending(1, access.function);
+        seen[access.function] = true;
+        while (!pending.empty()) {
+            uint16_t id = pending.back();
+            pending.pop_back();
+            for (size_t i = 0; i < callers[id].size(); i++) {
+                uint16_t callerId = callers[id][i];
+                if (seen[callerId]) {
+                    continue;
+                }
+                seen[callerId] = true;
+                const BytecodeFunction* caller =
+                        (const BytecodeFunction*) code->functionById(callerId);
+                if (caller->depth() == access.depth) {
+                    Status* status = checkSlot(fun, access.bci, caller,
+                            access.type, access.slot);
+                    if (status != NULL) {
+                        return status;
+                    }
+                } else if (caller->depth() < access.depth) {
+                    return error(fun, access.bci, "no frame of the context"
+                            " on a path from " + caller->name());
+                } else {
+                    pending.push_back(callerId);
+                }
+            }
+        }
+        return NULL;
+    }
+
+    Status* BytecodeVerifier::error(const BytecodeFunction* fun, uint32_t bci,
+            const string& message) {
+        stringstream ss;
+        ss << "Bytecode verification failed in function " << fun->name()
+                << " at " << bci << ": " << message;
+        return new Status(ss.str());
+    }
+
+}
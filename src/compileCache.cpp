@@ -0,0 +1,300 @@
+#include "compileCache.h"
+
+#include "bytecodeFile.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string.h>
+#include <vector>
+
+namespace mathvm {
+
+    const uint64_t CompileCache::DEFAULT_SIZE_LIMIT;
+
+    static const char ENTRY_SUFFIX[] = ".mvmb";
+    static const char TEMP_SUFFIX[] = ".tmp";
+    static const char TOTALS_FILE[] = "totals";
+    // temporary files older than that were left by a crash
+    static const time_t STALE_TEMP_SECONDS = 3600;
+
+    // MurmurHash64A
+    static uint64_t hash64(const uint8_t* data, size_t length, uint64_t seed) {
+        const uint64_t m = 0xc6a4a7935bd1e995ULL;
+        const int r = 47;
+        uint64_t h = seed ^ (length * m);
+
+        const uint8_t* end = data + (length & ~(size_t) 7);
+        for (; data != end; data += 8) {
+            uint64_t k;
+            memcpy(&k, data, sizeof (k));
+            k *= m;
+            k ^= k >> r;
+            k *= m;
+            h ^= k;
+            h *= m;
+        }
+        size_t tail = length & 7;
+        if (tail != 0) {
+            // the last bytes as a little-endian word
+            for (size_t i = 0; i < tail; i++) {
+                h ^= (uint64_t) data[i] << (8 * i);
+            }
+            h *= m;
+        }
+        h ^= h >> r;
+        h *= m;
+        h ^= h >> r;
+        return h;
+    }
+
+    static bool endsWith(const string& str, const char* suffix) {
+        size_t length = strlen(suffix);
+        return str.size() > length
+                && str.compare(str.size() - length, length, suffix) == 0;
+    }
+
+    static void makeDirectories(const string& path) {
+        for (size_t at = path.find('/', 1); at != string::npos;
+                at = path.find('/', at + 1)) {
+            mkdir(path.substr(0, at).c_str(), 0777);
+        }
+        mkdir(path.c_str(), 0777);
+    }
+
+    CompileCache::CompileCache(const string& directory_, uint64_t sizeLimit_) :
+    directory(directory_), sizeLimit(sizeLimit_),
+    hits(0), misses(0), stores(0), evictions(0) {
+        if (!directory.empty() && directory[directory.size() - 1] == '/') {
+            directory.erase(directory.size() - 1);
+        }
+        makeDirectories(directory);
+    }
+
+    CompileCache::~CompileCache() {
+        addTotals();
+    }
+
+    string CompileCache::entryPath(const string& program, uint32_t options) const {
+        // what the bytecode depends on besides the source
+        struct {
+            uint32_t version;
+            uint32_t instructions;
+            uint32_t options;
+            uint64_t executableSize;
+            int64_t executableTime;
+            uint64_t executableInode;
+        } vm;
+        memset(&vm, 0, sizeof (vm));
+        vm.version = BytecodeFile::VERSION;
+        vm.instructions = BC_LAST;
+        vm.options = options;
+        struct stat executable;
+        if (stat("/proc/self/exe", &executable) == 0) {
+            vm.executableSize = executable.st_size;
+            vm.executableTime = executable.st_mtime;
+            vm.executableInode = executable.st_ino;
+        }
+
+        uint64_t seed = hash64((const uint8_t*) &vm, sizeof (vm), 0);
+        const uint8_t* text = (const uint8_t*) program.data();
+        char name[40];
+        snprintf(name, sizeof (name), "%016llx%016llx",
+                (unsigned long long) hash64(text, program.size(), seed),
+                (unsigned long long) hash64(text, program.size(), ~seed));
+        return directory + "/" + name + ENTRY_SUFFIX;
+    }
+
+    bool CompileCache::load(const string& entry, BytecodeCode* code) {
+        if (access(entry.c_str(), R_OK) != 0) {
+            misses++;
+            return false;
+        }
+        Status* status = BytecodeFile::load(entry, code);
+        if (status != NULL) {
+            delete status;
+            unlink(entry.c_str());
+            misses++;
+            return false;
+        }
+        // the modification time orders entries for eviction
+        utimensat(AT_FDCWD, entry.c_str(), NULL, 0);
+        hits++;
+        return true;
+    }
+
+    void CompileCache::store(const string& entry, const BytecodeCode* code) {
+        ostringstream temp;
+        temp << entry << '.' << getpid() << TEMP_SUFFIX;
+        Status* status = BytecodeFile::save(code, temp.str());
+        if (status != NULL) {
+            delete status;
+            unlink(temp.str().c_str());
+            return;
+        }
+        if (rename(temp.str().c_str(), entry.c_str()) != 0) {
+            unlink(temp.str().c_str());
+            return;
+        }
+        stores++;
+        if (sizeLimit != 0) {
+            evict();
+        }
+    }
+
+    struct CacheFile {
+        string path;
+        uint64_t size;
+        // nanoseconds, 0 for temporary files
+        int64_t used;
+
+        bool operator<(const CacheFile& other) const {
+            return used < other.used;
+        }
+    };
+
+    // entries, and with stale set the temporary files nobody will rename
+    static vector<CacheFile> listFiles(const string& directory, bool stale) {
+        vector<CacheFile> result;
+        DIR* dir = opendir(directory.c_str());
+        if (dir == NULL) {
+            return result;
+        }
+        time_t now = time(NULL);
+        while (struct dirent* item = readdir(dir)) {
+            string name(item->d_name);
+            bool temp = endsWith(name, TEMP_SUFFIX);
+            if (!endsWith(name, ENTRY_SUFFIX) && !temp) {
+                continue;
+            }
+            CacheFile file;
+            file.path = directory + "/" + name;
+            struct stat fileStat;
+            if (stat(file.path.c_str(), &fileStat) != 0) {
+                continue;
+            }
+            if (temp && !(stale && now - fileStat.st_mtime > STALE_TEMP_SECONDS)) {
+                continue;
+            }
+            file.size = fileStat.st_size;
+            file.used = temp ? 0 : fileStat.st_mtim.tv_sec * 1000000000LL
+                    + fileStat.st_mtim.tv_nsec;
+            result.push_back(file);
+        }
+        closedir(dir);
+        return result;
+    }
+
+    void CompileCache::evict() {
+        vector<CacheFile> files = listFiles(directory, true);
+        uint64_t total = 0;
+        for (size_t i = 0; i < files.size(); i++) {
+            total += files[i].size;
+        }
+        if (total <= sizeLimit) {
+            return;
+        }
+        sort(files.begin(), files.end());
+        for (size_t i = 0; i < files.size() && total > sizeLimit; i++) {
+            // another process may have got there first
+            if (unlink(files[i].path.c_str()) == 0 || errno == ENOENT) {
+                total -= files[i].size;
+            }
+            if (files[i].used != 0) {
+                evictions++;
+            }
+        }
+    }
+
+    static const char* const COUNTER_NAMES[] = {
+        "hits", "misses", "stores", "evictions"
+    };
+    static const size_t COUNTERS = sizeof (COUNTER_NAMES) / sizeof (COUNTER_NAMES[0]);
+
+    // reads the totals of fd, which is locked, 0 for those missing
+    static void readTotals(int fd, uint64_t* totals) {
+        fill(totals, totals + COUNTERS, 0);
+        string text;
+        char buffer[256];
+        ssize_t length;
+        lseek(fd, 0, SEEK_SET);
+        while ((length = read(fd, buffer, sizeof (buffer))) > 0) {
+            text.append(buffer, length);
+        }
+        istringstream in(text);
+        string name;
+        uint64_t value;
+        while (in >> name >> value) {
+            for (size_t i = 0; i < COUNTERS; i++) {
+                if (name == COUNTER_NAMES[i]) {
+                    totals[i] = value;
+                }
+            }
+        }
+    }
+
+    void CompileCache::addTotals() {
+        if (hits + misses + stores + evictions == 0) {
+            return;
+        }
+        string path = directory + "/" + TOTALS_FILE;
+        int fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+        if (fd < 0) {
+            return;
+        }
+        flock(fd, LOCK_EX);
+        uint64_t totals[COUNTERS];
+        readTotals(fd, totals);
+        totals[0] += hits;
+        totals[1] += misses;
+        totals[2] += stores;
+        totals[3] += evictions;
+        ostringstream out;
+        for (size_t i = 0; i < COUNTERS; i++) {
+            out << COUNTER_NAMES[i] << ' ' << totals[i] << endl;
+        }
+        string text = out.str();
+        if (ftruncate(fd, 0) == 0 && pwrite(fd, text.data(), text.size(), 0) > 0) {
+            hits = misses = stores = evictions = 0;
+        }
+        close(fd);
+    }
+
+    void CompileCache::report(ostream& out) {
+        addTotals();
+        uint64_t totals[COUNTERS];
+        fill(totals, totals + COUNTERS, 0);
+        string path = directory + "/" + TOTALS_FILE;
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            flock(fd, LOCK_SH);
+            readTotals(fd, totals);
+            close(fd);
+        }
+        for (size_t i = 0; i < COUNTERS; i++) {
+            out << "# TYPE mymathvm_compile_cache_" << COUNTER_NAMES[i]
+                    << "_total counter" << endl
+                    << "mymathvm_compile_cache_" << COUNTER_NAMES[i]
+                    << "_total " << totals[i] << endl;
+        }
+
+        vector<CacheFile> files = listFiles(directory, false);
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < files.size(); i++) {
+            bytes += files[i].size;
+        }
+        out << "# TYPE mymathvm_compile_cache_entries gauge" << endl
+                << "mymathvm_compile_cache_entries " << files.size() << endl
+                << "# TYPE mymathvm_compile_cache_bytes gauge" << endl
+                << "mymathvm_compile_cache_bytes " << bytes << endl;
+    }
+
+}
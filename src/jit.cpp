@@ -1,135 +1,2131 @@
 #include "jit.h"
 #include "mathvm.h"
-#include "parser.h"
-#include "visitors.h"
+#include "bytecodeInterpretator.h"
 
 #include <AsmJit/AsmJit.h>
 
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
 using namespace AsmJit;
 using namespace std;
 
 namespace mathvm {
 
-MachCodeImpl::MachCodeImpl() : _code(0) {
+// Called from compiled code, plain functions so they are easy to call.
+
+static FunctionContex* enterFunction(CompiledRuntime* rt,
+                                     const BytecodeFunction* fun) {
+  return rt->interpreter->enterCompiled(fun);
 }
 
-MachCodeImpl::~MachCodeImpl() {
-  MemoryManager::getGlobal()->free(_code);
+static void leaveFunction(CompiledRuntime* rt, const BytecodeFunction* fun,
+                          FunctionContex* context) {
+  rt->interpreter->leaveCompiled(fun, context);
+}
+
+static bool callInterpreted(CompiledRuntime* rt, uint16_t id) {
+  return rt->interpreter->callInterpreted(id);
+}
+
+static void printInt(CompiledRuntime* rt, int64_t value) {
+  rt->output->writeInt(value);
+}
+
+static void printDouble(CompiledRuntime* rt, double value) {
+  rt->output->writeDouble(value);
+}
+
+static void printString(CompiledRuntime* rt, StringHandle handle) {
+  rt->output->writeString(rt->interpreter->stringAt(handle));
+}
+
+static int64_t stringToInt(CompiledRuntime* rt, StringHandle handle) {
+  return (int64_t) strtoll(rt->interpreter->stringAt(handle), NULL, 0);
+}
+
+static bool callNative(CompiledRuntime* rt, uint16_t id) {
+  return rt->interpreter->callNative(id);
+}
+
+// a variable of the function at depth, type as in RegisterCodeGenerator
+static uint64_t capturedKey(uint16_t depth, char type, uint16_t id) {
+  return ((uint64_t) depth << 24) | ((uint64_t) type << 16) | id;
+}
+
+static int64_t divide(int64_t left, int64_t right) {
+  return left / right;
+}
+
+static int64_t modulo(int64_t left, int64_t right) {
+  return left % right;
 }
 
-Status* MachCodeImpl::execute(vector<Var*>& vars) {
-  int result = function_cast<int (*)()>(_code)();
-  cout << "returned " << result << endl;
-  return new Status();
+static double sine(double x) {
+  return sin(x);
 }
 
-MachCodeFunction* MachCodeImpl::functionByName(const string& name) {
-    return dynamic_cast<MachCodeFunction*>(Code::functionByName(name));
+static double cosine(double x) {
+  return cos(x);
 }
 
-MachCodeFunction* MachCodeImpl::functionById(uint16_t id) {
-    return dynamic_cast<MachCodeFunction*>(Code::functionById(id));
+static double power(double x, double y) {
+  return pow(x, y);
 }
 
-void MachCodeImpl::error(const char* format, ...) {
+static void hotFunction(MachCodeImpl* code, uint16_t id) {
+  code->tierUp(id);
 }
 
-class MachCodeGenerator : public AstVisitor {
-    AstFunction* _top;
-    MachCodeImpl* _code;
-    Assembler _;
+// One function, instruction by instruction. The operand stack stays in
+// memory; registers only cache pointers, all callee-saved:
+//   rbx  CompiledRuntime*
+//   r12  operand stack top, written back around calls that use it
+//   r13  own frame
+//   r14  display
+//   r15  operand stack top after the arguments were taken, RETURN
+//        drops to it
+class MachCodeGenerator {
+  const BytecodeFunction* _fun;
+  const Bytecode* _bc;
+  const CompiledFunction* _table;
+  // tiers the function up when it reaches the threshold, NULL if not
+  // counting
+  MachCodeImpl* _owner;
+  uint32_t* _counter;
+  uint32_t _threshold;
+  Assembler _;
+  vector<AsmJit::Label> _labels;
+  vector<bool> _targets;
+  AsmJit::Label _abort;
+  AsmJit::Label _exit;
+
+  void push(const GPReg& src) {
+    _.mov(qword_ptr(r12), src);
+    _.add(r12, imm(8));
+  }
+
+  void pop(const GPReg& dst) {
+    _.sub(r12, imm(8));
+    _.mov(dst, qword_ptr(r12));
+  }
+
+  void callHelper(void* helper) {
+    _.mov(rax, imm((sysint_t) helper));
+    _.call(rax);
+  }
+
+  void storeTop() {
+    _.mov(rax, qword_ptr(rbx, offsetof(CompiledRuntime, top)));
+    _.mov(qword_ptr(rax), r12);
+  }
+
+  void loadTop() {
+    _.mov(rax, qword_ptr(rbx, offsetof(CompiledRuntime, top)));
+    _.mov(r12, qword_ptr(rax));
+  }
+
+  Mem doubleVar(uint16_t id) {
+    return qword_ptr(r13, FunctionContex::doublesOffset(_fun) + id * 8);
+  }
+
+  Mem intVar(uint16_t id) {
+    return qword_ptr(r13, FunctionContex::intsOffset(_fun) + id * 8);
+  }
+
+  Mem stringVar(uint16_t id) {
+    return dword_ptr(r13, FunctionContex::stringsOffset(_fun) + id * 4);
+  }
+
+  // slot array of the display frame at depth into rcx
+  void outerSlots(uint16_t depth, size_t pointerOffset) {
+    _.mov(rcx, qword_ptr(r14, depth * 8));
+    _.mov(rcx, qword_ptr(rcx, pointerOffset));
+  }
+
+  void loadConst(int64_t bits) {
+    _.mov(rax, imm((sysint_t) bits));
+    push(rax);
+  }
+
+  void loadDoubleConst(double value) {
+    int64_t bits;
+    memcpy(&bits, &value, sizeof (bits));
+    loadConst(bits);
+  }
+
+  void jump(uint32_t bci, CONDITION cc) {
+    _.j(cc, _labels[_bc->jumpTarget(bci)]);
+  }
+
+  void prologue();
+  void epilogue();
+  void genCount();
+  void genCompareJump(uint32_t bci, Instruction insn);
+  void genDoubleCompareJump(uint32_t bci, Instruction insn);
+  void genCall(uint16_t id);
+  void genReturn();
+  bool genInsn(uint32_t bci, Instruction insn);
+
 public:
-    MachCodeGenerator(AstFunction* top,
-                      MachCodeImpl* code) :
-    _top(top), _code(code) {
-    }
+  MachCodeGenerator(const BytecodeFunction* fun,
+                    const CompiledFunction* table) :
+  _fun(fun), _bc(fun->bytecode()), _table(table),
+  _owner(NULL), _counter(NULL), _threshold(0) {
+  }
+
+  // count calls and backward jumps, tier up at threshold
+  void count(MachCodeImpl* owner, uint32_t* counter, uint32_t threshold) {
+    _owner = owner;
+    _counter = counter;
+    _threshold = threshold;
+  }
 
-    Status* generate();
+  static bool canCompile(const BytecodeFunction* fun);
 
-#define VISITOR_FUNCTION(type, name)            \
-    virtual void visit##type(type* node) {}
+  // false if some instruction isn't supported after all
+  bool generate();
 
-    FOR_NODES(VISITOR_FUNCTION)
-#undef VISITOR_FUNCTION
+  size_t codeSize() const {
+    return _.getCodeSize();
+  }
+
+  // copies the code to its final place
+  CompiledFunction relocate(void* dst) const {
+    _.relocCode(dst);
+    return function_cast<CompiledFunction>(dst);
+  }
 };
 
-Status* MachCodeGenerator::generate() {
-  // Prologue.
-  _.push(nbp);
-  _.mov(nbp, nsp);
+bool MachCodeGenerator::canCompile(const BytecodeFunction* fun) {
+  const Bytecode* bc = fun->bytecode();
+  for (uint32_t bci = 0; bci < bc->length();) {
+    Instruction insn = bc->getInsn(bci);
+    if (insn >= BC_LAST || insn == BC_DUMP) {
+      return false;
+    }
+    size_t length;
+    bytecodeName(insn, &length);
+    bci += length;
+  }
+  return true;
+}
+
+void MachCodeGenerator::prologue() {
+  // too deep for the native stack, the interpreter takes over;
+  // callInterpreted gets rdi and returns to our caller
+  AsmJit::Label room = _.newLabel();
+  _.cmp(rsp, qword_ptr(rdi, offsetof(CompiledRuntime, stackLimit)));
+  _.jae(room);
+  _.mov(esi, imm(_fun->id()));
+  _.mov(rax, imm((sysint_t) &callInterpreted));
+  _.jmp(rax);
+
+  _.bind(room);
+  _.push(rbp);
+  _.mov(rbp, rsp);
+  _.push(rbx);
+  _.push(r12);
+  _.push(r13);
+  _.push(r14);
+  _.push(r15);
+  // six pushes and the return address, keep rsp 16-byte aligned
+  _.sub(rsp, imm(8));
+
+  _.mov(rbx, rdi);
+  _.mov(rsi, imm((sysint_t) _fun));
+  callHelper((void*) &enterFunction);
+  _.test(rax, rax);
+  // no frame to leave
+  _.jz(_exit);
 
-  // Return value.
-  _.mov(nax, 239);
+  _.mov(r13, rax);
+  loadTop();
+  _.mov(r15, r12);
+  _.mov(r14, qword_ptr(rbx, offsetof(CompiledRuntime, display)));
+  genCount();
+}
+
+void MachCodeGenerator::epilogue() {
+  _.bind(_abort);
+  _.mov(rdi, rbx);
+  _.mov(rsi, imm((sysint_t) _fun));
+  _.mov(rdx, r13);
+  callHelper((void*) &leaveFunction);
+  _.xor_(eax, eax);
 
-  // Epilogue.
-  _.mov(nsp, nbp);
-  _.pop(nbp);
+  // eax is the result already
+  _.bind(_exit);
+  _.add(rsp, imm(8));
+  _.pop(r15);
+  _.pop(r14);
+  _.pop(r13);
+  _.pop(r12);
+  _.pop(rbx);
+  _.pop(rbp);
   _.ret();
+}
 
-  _code->setCode(_.make());
+// before anything sets flags; no value lives in a scratch register
+// between instructions
+void MachCodeGenerator::genCount() {
+  if (_counter == NULL) {
+    return;
+  }
+  AsmJit::Label cold = _.newLabel();
+  _.mov(rax, imm((sysint_t) _counter));
+  _.add(dword_ptr(rax), imm(1));
+  _.cmp(dword_ptr(rax), imm(_threshold));
+  _.jne(cold);
+  _.mov(rdi, imm((sysint_t) _owner));
+  _.mov(esi, imm(_fun->id()));
+  callHelper((void*) &hotFunction);
+  _.bind(cold);
+}
 
-  return 0;
+void MachCodeGenerator::genCompareJump(uint32_t bci, Instruction insn) {
+  CONDITION cc;
+  switch (insn) {
+    case BC_IFICMPNE: case BC_IFICMPNEVAR: cc = C_NOT_EQUAL; break;
+    case BC_IFICMPE: case BC_IFICMPEVAR: cc = C_EQUAL; break;
+    case BC_IFICMPG: case BC_IFICMPGVAR: cc = C_GREATER; break;
+    case BC_IFICMPGE: case BC_IFICMPGEVAR: cc = C_GREATER_EQUAL; break;
+    case BC_IFICMPL: case BC_IFICMPLVAR: cc = C_LESS; break;
+    default: cc = C_LESS_EQUAL; break;
+  }
+  if (Bytecode::jumpOffsetPos(insn) == 1) {
+    _.sub(r12, imm(16));
+    _.mov(rax, qword_ptr(r12));
+    _.cmp(rax, qword_ptr(r12, 8));
+  } else {
+    _.mov(rax, intVar(_bc->getUInt16(bci + 1)));
+    _.cmp(rax, intVar(_bc->getUInt16(bci + 3)));
+  }
+  jump(bci, cc);
 }
 
-Status* MachCodeTranslatorImpl::translateMachCode(const string& program,
-                                                  MachCodeImpl* *result) {
-  MachCodeImpl* code = 0;
-  Status* s = 0;
-  Parser parser;
+void MachCodeGenerator::genDoubleCompareJump(uint32_t bci, Instruction insn) {
+  _.sub(r12, imm(16));
+  _.movsd(xmm0, qword_ptr(r12));
+  _.ucomisd(xmm0, qword_ptr(r12, 8));
 
-  // Build an AST.
-  s = parser.parseProgram(program);
-  if (s == 0) {
-    code = new MachCodeImpl();
-    MachCodeGenerator codegen(parser.top(), code);
-    s = codegen.generate();
+  // unordered sets PF and counts as greater, as in the interpreter
+  AsmJit::Label skip = _.newLabel();
+  switch (insn) {
+    case BC_DIFCMPE:
+      _.jp(skip);
+      jump(bci, C_EQUAL);
+      break;
+    case BC_DIFCMPNE:
+      jump(bci, C_PARITY_EVEN);
+      jump(bci, C_NOT_EQUAL);
+      break;
+    case BC_DIFCMPG:
+      jump(bci, C_PARITY_EVEN);
+      jump(bci, C_ABOVE);
+      break;
+    case BC_DIFCMPGE:
+      jump(bci, C_PARITY_EVEN);
+      jump(bci, C_ABOVE_EQUAL);
+      break;
+    case BC_DIFCMPL:
+      _.jp(skip);
+      jump(bci, C_BELOW);
+      break;
+    default:
+      _.jp(skip);
+      jump(bci, C_BELOW_EQUAL);
+      break;
   }
+  _.bind(skip);
+}
+
+void MachCodeGenerator::genCall(uint16_t id) {
+  AsmJit::Label interpreted = _.newLabel();
+  AsmJit::Label done = _.newLabel();
+
+  storeTop();
+  // the table is filled once all functions are generated
+  _.mov(rax, imm((sysint_t) &_table[id]));
+  _.mov(rax, qword_ptr(rax));
+  _.test(rax, rax);
+  _.jz(interpreted);
+  _.mov(rdi, rbx);
+  _.call(rax);
+  _.jmp(done);
+
+  _.bind(interpreted);
+  _.mov(rdi, rbx);
+  _.mov(esi, imm(id));
+  callHelper((void*) &callInterpreted);
 
-  if (s != 0) {
-    delete code;
+  _.bind(done);
+  // the callee already left its frame, leave ours and stop too
+  _.test(al, al);
+  _.jz(_abort);
+  loadTop();
+}
+
+void MachCodeGenerator::genReturn() {
+  if (_fun->returnType() != VT_VOID) {
+    _.mov(rax, qword_ptr(r12, -8));
+    _.mov(qword_ptr(r15), rax);
+    _.lea(r12, qword_ptr(r15, 8));
   } else {
-    *result = code;
+    _.mov(r12, r15);
   }
-  return s;
+  storeTop();
+  _.mov(rdi, rbx);
+  _.mov(rsi, imm((sysint_t) _fun));
+  _.mov(rdx, r13);
+  callHelper((void*) &leaveFunction);
+  _.mov(eax, imm(1));
+  _.jmp(_exit);
 }
 
-MachCodeTranslatorImpl::MachCodeTranslatorImpl() {
+bool MachCodeGenerator::genInsn(uint32_t bci, Instruction insn) {
+  switch (insn) {
+    case BC_INVALID:
+    case BC_BREAK:
+      break;
+
+    case BC_I2D:
+      _.cvtsi2sd(xmm0, qword_ptr(r12, -8));
+      _.movsd(qword_ptr(r12, -8), xmm0);
+      break;
+    case BC_D2I:
+      _.cvttsd2si(rax, qword_ptr(r12, -8));
+      _.mov(qword_ptr(r12, -8), rax);
+      break;
+    case BC_S2I:
+      _.mov(esi, dword_ptr(r12, -8));
+      _.mov(rdi, rbx);
+      callHelper((void*) &stringToInt);
+      _.mov(qword_ptr(r12, -8), rax);
+      break;
+
+    case BC_DLOAD: loadDoubleConst(_bc->getDouble(bci + 1)); break;
+    case BC_ILOAD: loadConst(_bc->getInt64(bci + 1)); break;
+    case BC_SLOAD: loadConst(_bc->getUInt16(bci + 1)); break;
+    case BC_DLOAD0: loadDoubleConst(0.0); break;
+    case BC_ILOAD0: loadConst(0); break;
+    case BC_SLOAD0: loadConst(0); break;
+    case BC_DLOAD1: loadDoubleConst(1.0); break;
+    case BC_ILOAD1: loadConst(1); break;
+    case BC_DLOADM1: loadDoubleConst(-1.0); break;
+    case BC_ILOADM1: loadConst(-1); break;
+
+    case BC_LOADDVAR0: case BC_LOADDVAR1:
+    case BC_LOADDVAR2: case BC_LOADDVAR3:
+      _.mov(rax, doubleVar(insn - BC_LOADDVAR0));
+      push(rax);
+      break;
+    case BC_LOADIVAR0: case BC_LOADIVAR1:
+    case BC_LOADIVAR2: case BC_LOADIVAR3:
+      _.mov(rax, intVar(insn - BC_LOADIVAR0));
+      push(rax);
+      break;
+    case BC_LOADSVAR0: case BC_LOADSVAR1:
+    case BC_LOADSVAR2: case BC_LOADSVAR3:
+      _.mov(eax, stringVar(insn - BC_LOADSVAR0));
+      push(rax);
+      break;
+    case BC_LOADDVAR:
+      _.mov(rax, doubleVar(_bc->getUInt16(bci + 1)));
+      push(rax);
+      break;
+    case BC_LOADIVAR:
+      _.mov(rax, intVar(_bc->getUInt16(bci + 1)));
+      push(rax);
+      break;
+    case BC_LOADSVAR:
+      _.mov(eax, stringVar(_bc->getUInt16(bci + 1)));
+      push(rax);
+      break;
+
+    case BC_STOREDVAR0: case BC_STOREDVAR1:
+    case BC_STOREDVAR2: case BC_STOREDVAR3:
+      pop(rax);
+      _.mov(doubleVar(insn - BC_STOREDVAR0), rax);
+      break;
+    case BC_STOREIVAR0: case BC_STOREIVAR1:
+    case BC_STOREIVAR2: case BC_STOREIVAR3:
+      pop(rax);
+      _.mov(intVar(insn - BC_STOREIVAR0), rax);
+      break;
+    case BC_STORESVAR0: case BC_STORESVAR1:
+    case BC_STORESVAR2: case BC_STORESVAR3:
+      pop(rax);
+      _.mov(stringVar(insn - BC_STORESVAR0), eax);
+      break;
+    case BC_STOREDVAR:
+      pop(rax);
+      _.mov(doubleVar(_bc->getUInt16(bci + 1)), rax);
+      break;
+    case BC_STOREIVAR:
+      pop(rax);
+      _.mov(intVar(_bc->getUInt16(bci + 1)), rax);
+      break;
+    case BC_STORESVAR:
+      pop(rax);
+      _.mov(stringVar(_bc->getUInt16(bci + 1)), eax);
+      break;
+
+    case BC_LOADCTXDVAR:
+      outerSlots(_bc->getUInt16(bci + 1), FunctionContex::doublesPointerOffset());
+      _.mov(rax, qword_ptr(rcx, _bc->getUInt16(bci + 3) * 8));
+      push(rax);
+      break;
+    case BC_LOADCTXIVAR:
+      outerSlots(_bc->getUInt16(bci + 1), FunctionContex::intsPointerOffset());
+      _.mov(rax, qword_ptr(rcx, _bc->getUInt16(bci + 3) * 8));
+      push(rax);
+      break;
+    case BC_LOADCTXSVAR:
+      outerSlots(_bc->getUInt16(bci + 1), FunctionContex::stringsPointerOffset());
+      _.mov(eax, dword_ptr(rcx, _bc->getUInt16(bci + 3) * 4));
+      push(rax);
+      break;
+    case BC_STORECTXDVAR:
+      outerSlots(_bc->getUInt16(bci + 1), FunctionContex::doublesPointerOffset());
+      pop(rax);
+      _.mov(qword_ptr(rcx, _bc->getUInt16(bci + 3) * 8), rax);
+      break;
+    case BC_STORECTXIVAR:
+      outerSlots(_bc->getUInt16(bci + 1), FunctionContex::intsPointerOffset());
+      pop(rax);
+      _.mov(qword_ptr(rcx, _bc->getUInt16(bci + 3) * 8), rax);
+      break;
+    case BC_STORECTXSVAR:
+      outerSlots(_bc->getUInt16(bci + 1), FunctionContex::stringsPointerOffset());
+      pop(rax);
+      _.mov(dword_ptr(rcx, _bc->getUInt16(bci + 3) * 4), eax);
+      break;
+
+    case BC_JA:
+      _.jmp(_labels[_bc->jumpTarget(bci)]);
+      break;
+    case BC_IFICMPNE: case BC_IFICMPE: case BC_IFICMPG:
+    case BC_IFICMPGE: case BC_IFICMPL: case BC_IFICMPLE:
+    case BC_IFICMPNEVAR: case BC_IFICMPEVAR: case BC_IFICMPGVAR:
+    case BC_IFICMPGEVAR: case BC_IFICMPLVAR: case BC_IFICMPLEVAR:
+      genCompareJump(bci, insn);
+      break;
+    case BC_DIFCMPNE: case BC_DIFCMPE: case BC_DIFCMPG:
+    case BC_DIFCMPGE: case BC_DIFCMPL: case BC_DIFCMPLE:
+      genDoubleCompareJump(bci, insn);
+      break;
+    case BC_IINCVAR:
+      _.add(intVar(_bc->getUInt16(bci + 1)), imm(_bc->getInt16(bci + 3)));
+      break;
+
+    case BC_DADD: case BC_DSUB: case BC_DMUL: case BC_DDIV:
+      _.sub(r12, imm(8));
+      _.movsd(xmm0, qword_ptr(r12, -8));
+      if (insn == BC_DADD) _.addsd(xmm0, qword_ptr(r12));
+      if (insn == BC_DSUB) _.subsd(xmm0, qword_ptr(r12));
+      if (insn == BC_DMUL) _.mulsd(xmm0, qword_ptr(r12));
+      if (insn == BC_DDIV) _.divsd(xmm0, qword_ptr(r12));
+      _.movsd(qword_ptr(r12, -8), xmm0);
+      break;
+    case BC_DNEG:
+      _.mov(rax, imm((sysint_t) 1 << 63));
+      _.xor_(qword_ptr(r12, -8), rax);
+      break;
+    case BC_DSQRT:
+      _.sqrtsd(xmm0, qword_ptr(r12, -8));
+      _.movsd(qword_ptr(r12, -8), xmm0);
+      break;
+    case BC_DSIN: case BC_DCOS:
+      _.movsd(xmm0, qword_ptr(r12, -8));
+      callHelper((void*) (insn == BC_DSIN ? &sine : &cosine));
+      _.movsd(qword_ptr(r12, -8), xmm0);
+      break;
+    case BC_DPOW:
+      _.sub(r12, imm(8));
+      _.movsd(xmm0, qword_ptr(r12));
+      _.movsd(xmm1, qword_ptr(r12, -8));
+      callHelper((void*) &power);
+      _.movsd(qword_ptr(r12, -8), xmm0);
+      break;
+    case BC_DCMP: {
+      AsmJit::Label done = _.newLabel();
+      AsmJit::Label less = _.newLabel();
+      _.sub(r12, imm(8));
+      _.movsd(xmm0, qword_ptr(r12, -8));
+      _.ucomisd(xmm0, qword_ptr(r12));
+      _.mov(rcx, imm(1));
+      _.jp(done);
+      _.jb(less);
+      _.jne(done);
+      _.xor_(ecx, ecx);
+      _.jmp(done);
+      _.bind(less);
+      _.mov(rcx, imm(-1));
+      _.bind(done);
+      _.mov(qword_ptr(r12, -8), rcx);
+      break;
+    }
+
+    case BC_IADD: case BC_ISUB: case BC_IAAND: case BC_IAOR: case BC_IAXOR:
+      pop(rax);
+      if (insn == BC_IADD) _.add(qword_ptr(r12, -8), rax);
+      if (insn == BC_ISUB) _.sub(qword_ptr(r12, -8), rax);
+      if (insn == BC_IAAND) _.and_(qword_ptr(r12, -8), rax);
+      if (insn == BC_IAOR) _.or_(qword_ptr(r12, -8), rax);
+      if (insn == BC_IAXOR) _.xor_(qword_ptr(r12, -8), rax);
+      break;
+    case BC_IMUL:
+      pop(rcx);
+      _.mov(rax, qword_ptr(r12, -8));
+      _.imul(rax, rcx);
+      _.mov(qword_ptr(r12, -8), rax);
+      break;
+    case BC_IDIV: case BC_IMOD:
+      pop(rcx);
+      _.mov(rax, qword_ptr(r12, -8));
+      _.mov(rdx, rax);
+      _.sar(rdx, imm(63));
+      _.idiv(rcx);
+      _.mov(qword_ptr(r12, -8), insn == BC_IDIV ? rax : rdx);
+      break;
+    case BC_INEG:
+      _.neg(qword_ptr(r12, -8));
+      break;
+    case BC_ICMP:
+      pop(rcx);
+      _.xor_(eax, eax);
+      _.xor_(edx, edx);
+      _.cmp(qword_ptr(r12, -8), rcx);
+      _.setg(al);
+      _.setl(dl);
+      _.sub(rax, rdx);
+      _.mov(qword_ptr(r12, -8), rax);
+      break;
+
+    case BC_ISWAP: case BC_DSWAP: case BC_SSWAP:
+      _.mov(rax, qword_ptr(r12, -8));
+      _.mov(rcx, qword_ptr(r12, -16));
+      _.mov(qword_ptr(r12, -8), rcx);
+      _.mov(qword_ptr(r12, -16), rax);
+      break;
+    case BC_POP:
+      _.sub(r12, imm(8));
+      break;
+
+    case BC_IPRINT:
+      pop(rsi);
+      _.mov(rdi, rbx);
+      callHelper((void*) &printInt);
+      break;
+    case BC_DPRINT:
+      _.sub(r12, imm(8));
+      _.movsd(xmm0, qword_ptr(r12));
+      _.mov(rdi, rbx);
+      callHelper((void*) &printDouble);
+      break;
+    case BC_SPRINT:
+      _.sub(r12, imm(8));
+      _.mov(esi, dword_ptr(r12));
+      _.mov(rdi, rbx);
+      callHelper((void*) &printString);
+      break;
+
+    case BC_CALL:
+      genCall(_bc->getUInt16(bci + 1));
+      break;
+    case BC_CALLNATIVE:
+      // the interpreter pops the arguments and pushes the result
+      storeTop();
+      _.mov(rdi, rbx);
+      _.mov(esi, imm(_bc->getUInt16(bci + 1)));
+      callHelper((void*) &callNative);
+      _.test(al, al);
+      _.jz(_abort);
+      loadTop();
+      break;
+    case BC_RETURN:
+      genReturn();
+      break;
+    case BC_STOP:
+      _.jmp(_abort);
+      break;
+
+    default:
+      return false;
+  }
+  return true;
 }
 
-MachCodeTranslatorImpl::~MachCodeTranslatorImpl() {
+bool MachCodeGenerator::generate() {
+  uint32_t length = _bc->length();
+
+  _labels.resize(length + 1);
+  _targets.assign(length + 1, false);
+  for (uint32_t bci = 0; bci < length;) {
+    Instruction insn = _bc->getInsn(bci);
+    if (Bytecode::jumpOffsetPos(insn) != 0) {
+      uint32_t target = _bc->jumpTarget(bci);
+      if (!_targets[target]) {
+        _targets[target] = true;
+        _labels[target] = _.newLabel();
+      }
+    }
+    size_t insnLength;
+    bytecodeName(insn, &insnLength);
+    bci += insnLength;
+  }
+  _abort = _.newLabel();
+  _exit = _.newLabel();
+
+  prologue();
+  for (uint32_t bci = 0; bci < length;) {
+    Instruction insn = _bc->getInsn(bci);
+    if (_targets[bci]) {
+      _.bind(_labels[bci]);
+    }
+    // loops
+    if (Bytecode::jumpOffsetPos(insn) != 0 && _bc->jumpTarget(bci) <= bci) {
+      genCount();
+    }
+    if (!genInsn(bci, insn)) {
+      return false;
+    }
+    size_t insnLength;
+    bytecodeName(insn, &insnLength);
+    bci += insnLength;
+  }
+  // the verifier doesn't let code run off the end
+  epilogue();
+
+  return _.getError() == 0;
 }
 
-Status* MachCodeTranslatorImpl::translate(const string& program, Code* *result) {
-    MachCodeImpl* code = 0;
-    Status* status = 0;
+// Where the register tier calls a function: a stub that goes on to the
+// table's current code for it, or to the interpreter with esi = id.
+// Compiled code expects only rdi, esi is scratch to it.
+static void genCallStub(Assembler& _, uint16_t id,
+                        const CompiledFunction* entry) {
+  AsmJit::Label interpreted = _.newLabel();
+  _.mov(esi, imm(id));
+  _.mov(rax, imm((sysint_t) entry));
+  _.mov(rax, qword_ptr(rax));
+  _.test(rax, rax);
+  _.jz(interpreted);
+  _.jmp(rax);
+  _.bind(interpreted);
+  _.mov(rax, imm((sysint_t) &callInterpreted));
+  _.jmp(rax);
+}
+
+// Register tier, for functions that got hot in the baseline code. The
+// operand stack is resolved at compile time into values in virtual
+// registers, the function's own variables live in virtual registers
+// too, and AsmJit's Compiler picks the machine registers. Constants and
+// variable loads cost nothing until an instruction needs them in a
+// register. Frames, calls and helpers are the baseline's. Own variables
+// go back to the frame around calls only when a deeper function could
+// reach them through the display.
+class RegisterCodeGenerator {
+  // a value on the compile time operand stack
+  struct Value {
+    enum Kind {
+      REGISTER,
+      // int or string handle not loaded yet
+      CONST,
+      // still the register of own variable local
+      LOCAL
+    };
+
+    Kind kind;
+    // as in _types
+    char type;
+    GPVar gp;
+    XMMVar xmm;
+    int64_t constant;
+    uint16_t local;
+  };
+
+  const BytecodeFunction* _fun;
+  const Bytecode* _bc;
+  const Code* _code;
+  // call stubs by function id
+  void* const* _entries;
+  const set<uint64_t>* _captured;
+  // some own variable is reached from deeper functions
+  bool _sharedFrame;
+  Compiler _;
+  Assembler _out;
+
+  // operand stack before each instruction, a char per value:
+  // 'i' int, 'd' double, 's' string handle; empty where unreachable
+  vector<string> _types;
+  vector<bool> _reached;
+  vector<AsmJit::Label> _labels;
+  vector<bool> _targets;
+
+  vector<Value> _stack;
+  // registers the stack is in at jump targets, every way in agrees
+  map<uint32_t, vector<Value> > _entryStacks;
+
+  // own variables by slot
+  vector<GPVar> _ints;
+  vector<XMMVar> _doubles;
+  vector<GPVar> _strings;
+
+  GPVar _rt;
+  GPVar _frame;
+  // where the interpreter keeps the operand stack top
+  GPVar _topPtr;
+  // operand stack top after the arguments were taken
+  GPVar _base;
+  GPVar _display;
+  GPVar _result;
+  AsmJit::Label _abort;
+  AsmJit::Label _leave;
+  AsmJit::Label _exit;
+  // the Compiler can't bind a label nothing jumps to after a jump
+  bool _aborts;
+  bool _returns;
+
+  const BytecodeFunction* callee(uint16_t id) const {
+    return (const BytecodeFunction*) _code->functionById(id);
+  }
+
+  static char typeChar(VarType type) {
+    switch (type) {
+      case VT_DOUBLE: return 'd';
+      case VT_STRING: return 's';
+      default: return 'i';
+    }
+  }
+
+  Mem doubleSlot(uint16_t id) {
+    return qword_ptr(_frame, FunctionContex::doublesOffset(_fun) + id * 8);
+  }
+
+  Mem intSlot(uint16_t id) {
+    return qword_ptr(_frame, FunctionContex::intsOffset(_fun) + id * 8);
+  }
+
+  Mem stringSlot(uint16_t id) {
+    return dword_ptr(_frame, FunctionContex::stringsOffset(_fun) + id * 4);
+  }
+
+  GPVar& localGp(char type, uint16_t id) {
+    return type == 's' ? _strings[id] : _ints[id];
+  }
+
+  // CTX* instructions name a depth, their own one means own variables
+  bool isOwn(uint32_t bci) const {
+    return _bc->getUInt16(bci + 1) == _fun->depth();
+  }
+
+  bool isCaptured(char type, uint16_t id) const {
+    return _captured->count(capturedKey(_fun->depth(), type, id)) != 0;
+  }
+
+  static bool fitsImm(int64_t value) {
+    return value == (int32_t) value;
+  }
+
+  void jumpAbort() {
+    _.jmp(_abort);
+    _aborts = true;
+  }
+
+  void jumpAbortIf(CONDITION cc) {
+    _.j(cc, _abort);
+    _aborts = true;
+  }
+
+  // the Compiler passes only variables as call arguments, set them
+  // before the call
+  GPVar constant(sysint_t value) {
+    GPVar var = _.newGP();
+    _.mov(var, imm(value));
+    return var;
+  }
+
+  Value& top(size_t below = 0) {
+    return _stack[_stack.size() - 1 - below];
+  }
+
+  Value pop() {
+    Value value = _stack.back();
+    _stack.pop_back();
+    return value;
+  }
+
+  void push(Value::Kind kind, char type) {
+    Value value;
+    value.kind = kind;
+    value.type = type;
+    value.constant = 0;
+    value.local = 0;
+    _stack.push_back(value);
+  }
+
+  GPVar& pushGp(char type = 'i') {
+    push(Value::REGISTER, type);
+    top().gp = _.newGP();
+    return top().gp;
+  }
+
+  XMMVar& pushXmm() {
+    push(Value::REGISTER, 'd');
+    top().xmm = _.newXMM(VARIABLE_TYPE_XMM_1D);
+    return top().xmm;
+  }
+
+  void pushConst(int64_t constant, char type = 'i') {
+    push(Value::CONST, type);
+    top().constant = constant;
+  }
 
-    status = translateMachCode(program, &code);
-    if (status != 0) {
-        assert(code == 0);
-        *result = 0;
-        return status;
+  void pushLocal(uint16_t id, char type) {
+    push(Value::LOCAL, type);
+    top().local = id;
+  }
+
+  GPVar readGp(Value& value);
+  XMMVar readXmm(Value& value);
+  GPVar& ownGp(Value& value);
+  XMMVar& ownXmm(Value& value);
+  Operand source(Value& value);
+  void storeValue(const Mem& dst, Value& value);
+  void keepLocal(char type, uint16_t id);
+  void keepCaptured();
+
+  bool inferTypes();
+  bool effect(uint32_t bci, Instruction insn, string& stack) const;
+  bool merge(uint32_t bci, const string& stack, vector<uint32_t>& work);
+
+  bool edge(uint32_t target);
+  void enterTarget(uint32_t bci);
+  void loadLocals(bool capturedOnly);
+  void storeCaptured();
+  void loadOuter(GPVar& dst, uint32_t bci, size_t pointerOffset);
+  void loadDouble(const XMMVar& dst, double value);
+  bool genCompareJump(uint32_t bci, Instruction insn);
+  bool genDoubleCompareJump(uint32_t bci, Instruction insn);
+  void genStore(char type, uint16_t id);
+  void genIntOp(uint32_t code, bool commutative);
+  void genDoubleOp(uint32_t code, bool commutative);
+  void genCall(uint16_t id);
+  void genReturn();
+  bool genInsn(uint32_t bci, Instruction insn);
+  void leaveFrame();
+
+public:
+  RegisterCodeGenerator(const BytecodeFunction* fun, const Code* code,
+                        void* const* entries,
+                        const set<uint64_t>* captured) :
+  _fun(fun), _bc(fun->bytecode()), _code(code), _entries(entries),
+  _captured(captured), _sharedFrame(false), _aborts(false),
+  _returns(false) {
+  }
+
+  // false if the function has to stay in the baseline
+  bool generate();
+
+  size_t codeSize() const {
+    return _out.getCodeSize();
+  }
+
+  CompiledFunction relocate(void* dst) const {
+    _out.relocCode(dst);
+    return function_cast<CompiledFunction>(dst);
+  }
+};
+
+
+bool RegisterCodeGenerator::effect(uint32_t bci, Instruction insn,
+                                   string& stack) const {
+  // popped types, pushed types; 'x' pops any
+  const char* pops = "";
+  const char* pushes = "";
+  switch (insn) {
+    case BC_INVALID: case BC_BREAK: case BC_JA: case BC_IINCVAR:
+    case BC_STOP:
+    case BC_IFICMPNEVAR: case BC_IFICMPEVAR: case BC_IFICMPGVAR:
+    case BC_IFICMPGEVAR: case BC_IFICMPLVAR: case BC_IFICMPLEVAR:
+      break;
+
+    case BC_DLOAD: case BC_DLOAD0: case BC_DLOAD1: case BC_DLOADM1:
+    case BC_LOADDVAR0: case BC_LOADDVAR1: case BC_LOADDVAR2:
+    case BC_LOADDVAR3: case BC_LOADDVAR: case BC_LOADCTXDVAR:
+      pushes = "d";
+      break;
+    case BC_ILOAD: case BC_ILOAD0: case BC_ILOAD1: case BC_ILOADM1:
+    case BC_LOADIVAR0: case BC_LOADIVAR1: case BC_LOADIVAR2:
+    case BC_LOADIVAR3: case BC_LOADIVAR: case BC_LOADCTXIVAR:
+      pushes = "i";
+      break;
+    case BC_SLOAD: case BC_SLOAD0:
+    case BC_LOADSVAR0: case BC_LOADSVAR1: case BC_LOADSVAR2:
+    case BC_LOADSVAR3: case BC_LOADSVAR: case BC_LOADCTXSVAR:
+      pushes = "s";
+      break;
+
+    case BC_STOREDVAR0: case BC_STOREDVAR1: case BC_STOREDVAR2:
+    case BC_STOREDVAR3: case BC_STOREDVAR: case BC_STORECTXDVAR:
+    case BC_DPRINT:
+      pops = "d";
+      break;
+    case BC_STOREIVAR0: case BC_STOREIVAR1: case BC_STOREIVAR2:
+    case BC_STOREIVAR3: case BC_STOREIVAR: case BC_STORECTXIVAR:
+    case BC_IPRINT:
+      pops = "i";
+      break;
+    case BC_STORESVAR0: case BC_STORESVAR1: case BC_STORESVAR2:
+    case BC_STORESVAR3: case BC_STORESVAR: case BC_STORECTXSVAR:
+    case BC_SPRINT:
+      pops = "s";
+      break;
+    case BC_POP:
+      pops = "x";
+      break;
+
+    case BC_I2D: pops = "i"; pushes = "d"; break;
+    case BC_D2I: pops = "d"; pushes = "i"; break;
+    case BC_S2I: pops = "s"; pushes = "i"; break;
+
+    case BC_IFICMPNE: case BC_IFICMPE: case BC_IFICMPG:
+    case BC_IFICMPGE: case BC_IFICMPL: case BC_IFICMPLE:
+      pops = "ii";
+      break;
+    case BC_DIFCMPNE: case BC_DIFCMPE: case BC_DIFCMPG:
+    case BC_DIFCMPGE: case BC_DIFCMPL: case BC_DIFCMPLE:
+      pops = "dd";
+      break;
+
+    case BC_DADD: case BC_DSUB: case BC_DMUL: case BC_DDIV:
+      pops = "dd"; pushes = "d";
+      break;
+    case BC_DNEG: case BC_DSQRT: case BC_DSIN: case BC_DCOS:
+      pops = "d"; pushes = "d";
+      break;
+    case BC_DPOW: pops = "dd"; pushes = "d"; break;
+    case BC_DCMP: pops = "dd"; pushes = "i"; break;
+    case BC_IADD: case BC_ISUB: case BC_IMUL: case BC_IDIV: case BC_IMOD:
+    case BC_IAAND: case BC_IAOR: case BC_IAXOR: case BC_ICMP:
+      pops = "ii"; pushes = "i";
+      break;
+    case BC_INEG: pops = "i"; pushes = "i"; break;
+
+    case BC_ISWAP: case BC_DSWAP: case BC_SSWAP:
+      if (stack.size() < 2) {
+        return false;
+      }
+      swap(stack[stack.size() - 1], stack[stack.size() - 2]);
+      return true;
+
+    case BC_CALL: {
+      const BytecodeFunction* f = callee(_bc->getUInt16(bci + 1));
+      if (f == NULL || stack.size() < f->parametersNumber()) {
+        return false;
+      }
+      // the first parameter is on top
+      for (uint16_t i = 0; i < f->parametersNumber(); i++) {
+        if (stack[stack.size() - 1] != typeChar(f->parameterType(i))) {
+          return false;
+        }
+        stack.resize(stack.size() - 1);
+      }
+      if (f->returnType() != VT_VOID) {
+        stack += typeChar(f->returnType());
+      }
+      return true;
+    }
+    case BC_RETURN:
+      if (_fun->returnType() != VT_VOID) {
+        return !stack.empty()
+                && stack[stack.size() - 1] == typeChar(_fun->returnType());
+      }
+      return true;
+
+    default:
+      return false;
+  }
+  for (const char* p = pops; *p != 0; p++) {
+    if (stack.empty() || (*p != 'x' && stack[stack.size() - 1] != *p)) {
+      return false;
+    }
+    stack.resize(stack.size() - 1);
+  }
+  stack += pushes;
+  return true;
+}
+
+bool RegisterCodeGenerator::merge(uint32_t bci, const string& stack,
+                                  vector<uint32_t>& work) {
+  if (!_reached[bci]) {
+    _reached[bci] = true;
+    _types[bci] = stack;
+    work.push_back(bci);
+    return true;
+  }
+  // a depth has to keep its type, it names the register
+  return _types[bci] == stack;
+}
+
+bool RegisterCodeGenerator::inferTypes() {
+  uint32_t length = _bc->length();
+  _types.assign(length + 1, string());
+  _reached.assign(length + 1, false);
+  _targets.assign(length + 1, false);
+
+  vector<uint32_t> work;
+  merge(0, string(), work);
+  while (!work.empty()) {
+    uint32_t bci = work.back();
+    work.pop_back();
+
+    Instruction insn = _bc->getInsn(bci);
+    string stack = _types[bci];
+    if (!effect(bci, insn, stack)) {
+      return false;
+    }
+    if (Bytecode::jumpOffsetPos(insn) != 0) {
+      uint32_t target = _bc->jumpTarget(bci);
+      _targets[target] = true;
+      if (target >= length || !merge(target, stack, work)) {
+        return false;
+      }
+    }
+    if (insn != BC_JA && insn != BC_RETURN && insn != BC_STOP) {
+      size_t insnLength;
+      bytecodeName(insn, &insnLength);
+      if (bci + insnLength >= length
+              || !merge(bci + insnLength, stack, work)) {
+        return false;
+      }
     }
+  }
+  return true;
+}
 
-    //code->disassemble();
-    assert(code);
-    *result = code;
+// the value in a register, for reading only
+GPVar RegisterCodeGenerator::readGp(Value& value) {
+  switch (value.kind) {
+    case Value::LOCAL:
+      return localGp(value.type, value.local);
+    case Value::CONST:
+      return ownGp(value);
+    default:
+      return value.gp;
+  }
+}
 
-    return new Status();
+XMMVar RegisterCodeGenerator::readXmm(Value& value) {
+  if (value.kind == Value::LOCAL) {
+    return _doubles[value.local];
+  }
+  return value.xmm;
 }
 
-MachCodeFunction::MachCodeFunction(MachCodeImpl* owner, BytecodeFunction* bcfunc) :
-  TranslatedFunction(bcfunc->name(), bcfunc->signature()) {
+// the value in a register of its own, to compute in place
+GPVar& RegisterCodeGenerator::ownGp(Value& value) {
+  if (value.kind != Value::REGISTER) {
+    GPVar var = _.newGP();
+    if (value.kind == Value::CONST) {
+      _.mov(var, imm((sysint_t) value.constant));
+    } else {
+      _.mov(var, localGp(value.type, value.local));
+    }
+    value.kind = Value::REGISTER;
+    value.gp = var;
+  }
+  return value.gp;
 }
 
-MachCodeFunction::~MachCodeFunction() {
+XMMVar& RegisterCodeGenerator::ownXmm(Value& value) {
+  if (value.kind != Value::REGISTER) {
+    XMMVar var = _.newXMM(VARIABLE_TYPE_XMM_1D);
+    _.movsd(var, _doubles[value.local]);
+    value.kind = Value::REGISTER;
+    value.xmm = var;
+  }
+  return value.xmm;
 }
 
+// a source operand for an int instruction, an immediate if it fits
+Operand RegisterCodeGenerator::source(Value& value) {
+  if (value.kind == Value::CONST && fitsImm(value.constant)) {
+    return imm((sysint_t) value.constant);
+  }
+  return readGp(value);
+}
 
-Status* MachCodeFunction::execute(vector<Var*>* vars) {
-    return 0;
+// to a 64-bit operand stack slot
+void RegisterCodeGenerator::storeValue(const Mem& dst, Value& value) {
+  if (value.type == 'd') {
+    _.movsd(dst, readXmm(value));
+  } else {
+    Operand src = source(value);
+    _._emitInstruction(INST_MOV, &dst, &src);
+  }
 }
 
-void MachCodeFunction::disassemble(ostream& out) const {
+// the variable is about to change, values still in its register get
+// their own
+void RegisterCodeGenerator::keepLocal(char type, uint16_t id) {
+  for (size_t i = 0; i < _stack.size(); i++) {
+    Value& value = _stack[i];
+    if (value.kind == Value::LOCAL && value.type == type
+            && value.local == id) {
+      if (type == 'd') {
+        ownXmm(value);
+      } else {
+        ownGp(value);
+      }
+    }
+  }
+}
+
+void RegisterCodeGenerator::keepCaptured() {
+  for (size_t i = 0; i < _stack.size(); i++) {
+    Value& value = _stack[i];
+    if (value.kind == Value::LOCAL && isCaptured(value.type, value.local)) {
+      if (value.type == 'd') {
+        ownXmm(value);
+      } else {
+        ownGp(value);
+      }
+    }
+  }
+}
+
+// Puts the stack where the target expects it, the first way in decides.
+// Only movs, flags of a compare before a conditional jump survive.
+bool RegisterCodeGenerator::edge(uint32_t target) {
+  map<uint32_t, vector<Value> >::iterator it = _entryStacks.find(target);
+  if (it == _entryStacks.end()) {
+    vector<Value> entry(_stack);
+    for (size_t i = 0; i < entry.size(); i++) {
+      Value& value = entry[i];
+      if (value.kind == Value::REGISTER) {
+        continue;
+      }
+      if (value.type == 'd') {
+        value.xmm = _.newXMM(VARIABLE_TYPE_XMM_1D);
+        _.movsd(value.xmm, _doubles[value.local]);
+      } else {
+        value.gp = _.newGP();
+        if (value.kind == Value::CONST) {
+          _.mov(value.gp, imm((sysint_t) value.constant));
+        } else {
+          _.mov(value.gp, localGp(value.type, value.local));
+        }
+      }
+      value.kind = Value::REGISTER;
+    }
+    _entryStacks[target] = entry;
+    return true;
+  }
+
+  const vector<Value>& entry = it->second;
+  for (size_t i = 0; i < entry.size(); i++) {
+    Value& value = _stack[i];
+    // a register the target uses for another depth would be lost
+    for (size_t j = 0; j < _stack.size(); j++) {
+      const Value& other = _stack[j];
+      if (j == i || other.kind != Value::REGISTER
+              || (other.type == 'd') != (entry[i].type == 'd')) {
+        continue;
+      }
+      if (other.type == 'd' ? other.xmm.getId() == entry[i].xmm.getId()
+                            : other.gp.getId() == entry[i].gp.getId()) {
+        return false;
+      }
+    }
+    if (value.type == 'd') {
+      if (value.kind != Value::REGISTER
+              || value.xmm.getId() != entry[i].xmm.getId()) {
+        _.movsd(entry[i].xmm, readXmm(value));
+      }
+    } else if (value.kind != Value::REGISTER
+               || value.gp.getId() != entry[i].gp.getId()) {
+      Operand src = value.kind == Value::CONST
+              ? (Operand) imm((sysint_t) value.constant)
+              : (Operand) readGp(value);
+      _._emitInstruction(INST_MOV, &entry[i].gp, &src);
+    }
+  }
+  return true;
+}
+
+// at a jump target the stack is the agreed one, new registers if the
+// first way in is a backward jump still to come
+void RegisterCodeGenerator::enterTarget(uint32_t bci) {
+  map<uint32_t, vector<Value> >::iterator it = _entryStacks.find(bci);
+  if (it != _entryStacks.end()) {
+    _stack = it->second;
+    return;
+  }
+  _stack.clear();
+  const string& types = _types[bci];
+  for (size_t i = 0; i < types.size(); i++) {
+    if (types[i] == 'd') {
+      pushXmm();
+    } else {
+      pushGp(types[i]);
+    }
+  }
+  _entryStacks[bci] = _stack;
+}
+
+void RegisterCodeGenerator::loadLocals(bool capturedOnly) {
+  for (uint16_t i = 0; i < _doubles.size(); i++) {
+    if (!capturedOnly || isCaptured('d', i)) {
+      _.movsd(_doubles[i], doubleSlot(i));
+    }
+  }
+  for (uint16_t i = 0; i < _ints.size(); i++) {
+    if (!capturedOnly || isCaptured('i', i)) {
+      _.mov(_ints[i], intSlot(i));
+    }
+  }
+  for (uint16_t i = 0; i < _strings.size(); i++) {
+    if (!capturedOnly || isCaptured('s', i)) {
+      _.mov(_strings[i].r32(), stringSlot(i));
+    }
+  }
+}
+
+// for deeper functions to see
+void RegisterCodeGenerator::storeCaptured() {
+  for (uint16_t i = 0; i < _doubles.size(); i++) {
+    if (isCaptured('d', i)) {
+      _.movsd(doubleSlot(i), _doubles[i]);
+    }
+  }
+  for (uint16_t i = 0; i < _ints.size(); i++) {
+    if (isCaptured('i', i)) {
+      _.mov(intSlot(i), _ints[i]);
+    }
+  }
+  for (uint16_t i = 0; i < _strings.size(); i++) {
+    if (isCaptured('s', i)) {
+      _.mov(stringSlot(i), _strings[i].r32());
+    }
+  }
+}
+
+// dst = slot array of the display frame the instruction names
+void RegisterCodeGenerator::loadOuter(GPVar& dst, uint32_t bci,
+                                      size_t pointerOffset) {
+  _.mov(dst, qword_ptr(_display, _bc->getUInt16(bci + 1) * 8));
+  _.mov(dst, qword_ptr(dst, pointerOffset));
+}
+
+void RegisterCodeGenerator::loadDouble(const XMMVar& dst, double value) {
+  if (value == 0.0 && !signbit(value)) {
+    _.xorpd(dst, dst);
+    return;
+  }
+  int64_t bits;
+  memcpy(&bits, &value, sizeof (bits));
+  GPVar tmp = _.newGP();
+  _.mov(tmp, imm((sysint_t) bits));
+  _.movq(dst, tmp);
+}
+
+bool RegisterCodeGenerator::genCompareJump(uint32_t bci, Instruction insn) {
+  CONDITION cc;
+  switch (insn) {
+    case BC_IFICMPNE: case BC_IFICMPNEVAR: cc = C_NOT_EQUAL; break;
+    case BC_IFICMPE: case BC_IFICMPEVAR: cc = C_EQUAL; break;
+    case BC_IFICMPG: case BC_IFICMPGVAR: cc = C_GREATER; break;
+    case BC_IFICMPGE: case BC_IFICMPGEVAR: cc = C_GREATER_EQUAL; break;
+    case BC_IFICMPL: case BC_IFICMPLVAR: cc = C_LESS; break;
+    default: cc = C_LESS_EQUAL; break;
+  }
+  uint32_t target = _bc->jumpTarget(bci);
+  if (Bytecode::jumpOffsetPos(insn) == 1) {
+    Value right = pop();
+    Value left = pop();
+    GPVar reg = readGp(left);
+    Operand src = source(right);
+    _._emitInstruction(INST_CMP, &reg, &src);
+  } else {
+    _.cmp(_ints[_bc->getUInt16(bci + 1)], _ints[_bc->getUInt16(bci + 3)]);
+  }
+  if (!edge(target)) {
+    return false;
+  }
+  _.j(cc, _labels[target]);
+  return true;
+}
+
+bool RegisterCodeGenerator::genDoubleCompareJump(uint32_t bci,
+                                                 Instruction insn) {
+  uint32_t target = _bc->jumpTarget(bci);
+  const AsmJit::Label& label = _labels[target];
+  Value right = pop();
+  Value left = pop();
+  _.ucomisd(readXmm(left), readXmm(right));
+  if (!edge(target)) {
+    return false;
+  }
+
+  // unordered counts as greater, as in the interpreter
+  AsmJit::Label skip = _.newLabel();
+  switch (insn) {
+    case BC_DIFCMPE:
+      _.jp(skip);
+      _.je(label);
+      break;
+    case BC_DIFCMPNE:
+      _.jp(label);
+      _.jne(label);
+      break;
+    case BC_DIFCMPG:
+      _.jp(label);
+      _.ja(label);
+      break;
+    case BC_DIFCMPGE:
+      _.jp(label);
+      _.jae(label);
+      break;
+    case BC_DIFCMPL:
+      _.jp(skip);
+      _.jb(label);
+      break;
+    default:
+      _.jp(skip);
+      _.jbe(label);
+      break;
+  }
+  _.bind(skip);
+  return true;
+}
+
+void RegisterCodeGenerator::genCall(uint16_t id) {
+  const BytecodeFunction* f = callee(id);
+  size_t params = f->parametersNumber();
+  size_t first = _stack.size() - params;
+
+  // arguments go where the callee pops them, deepest first
+  for (size_t i = 0; i < params; i++) {
+    storeValue(qword_ptr(_base, i * 8), _stack[first + i]);
+  }
+  _stack.resize(first);
+  GPVar top = _.newGP();
+  _.lea(top, qword_ptr(_base, params * 8));
+  _.mov(qword_ptr(_topPtr), top);
+  if (_sharedFrame) {
+    // deeper functions may change the variables, values still in
+    // their registers keep what they were
+    keepCaptured();
+    storeCaptured();
+  }
+
+  // this Compiler mishandles calls through a variable, so the
+  // table is read by the entry stub
+  GPVar ok = _.newGP();
+  ECall* call = _.call(_entries[id]);
+  call->setPrototype(CALL_CONV_DEFAULT,
+                     FunctionBuilder1<uint8_t, CompiledRuntime*>());
+  call->setArgument(0, _rt);
+  call->setReturn(ok);
+
+  // the callee already left its frame, leave ours and stop too
+  _.test(ok.r8(), ok.r8());
+  jumpAbortIf(C_ZERO);
+
+  if (_sharedFrame) {
+    loadLocals(true);
+  }
+  if (f->returnType() == VT_DOUBLE) {
+    _.movsd(pushXmm(), qword_ptr(_base));
+  } else if (f->returnType() == VT_STRING) {
+    _.mov(pushGp('s').r32(), dword_ptr(_base));
+  } else if (f->returnType() != VT_VOID) {
+    _.mov(pushGp(), qword_ptr(_base));
+  }
+}
+
+void RegisterCodeGenerator::genReturn() {
+  GPVar top = _.newGP();
+  if (_fun->returnType() != VT_VOID) {
+    storeValue(qword_ptr(_base), this->top());
+    _.lea(top, qword_ptr(_base, 8));
+  } else {
+    _.mov(top, _base);
+  }
+  _.mov(qword_ptr(_topPtr), top);
+  _.mov(_result, imm(1));
+  _.jmp(_leave);
+  _returns = true;
+}
+
+void RegisterCodeGenerator::genStore(char type, uint16_t id) {
+  Value value = pop();
+  if (value.kind == Value::LOCAL && value.local == id) {
+    return;
+  }
+  keepLocal(type, id);
+  if (type == 'd') {
+    _.movsd(_doubles[id], readXmm(value));
+  } else {
+    Operand src = source(value);
+    _._emitInstruction(INST_MOV, &localGp(type, id), &src);
+  }
+}
+
+void RegisterCodeGenerator::genIntOp(uint32_t code, bool commutative) {
+  Value right = pop();
+  Value left = pop();
+  if (commutative && left.kind != Value::REGISTER
+          && right.kind == Value::REGISTER) {
+    swap(left, right);
+  }
+  GPVar& dst = ownGp(left);
+  // no immediate form worth having for imul
+  Operand src = code == INST_IMUL ? (Operand) readGp(right) : source(right);
+  _._emitInstruction(code, &dst, &src);
+  _stack.push_back(left);
+}
+
+void RegisterCodeGenerator::genDoubleOp(uint32_t code, bool commutative) {
+  Value right = pop();
+  Value left = pop();
+  if (commutative && left.kind != Value::REGISTER
+          && right.kind == Value::REGISTER) {
+    swap(left, right);
+  }
+  XMMVar& dst = ownXmm(left);
+  XMMVar src = readXmm(right);
+  _._emitInstruction(code, &dst, &src);
+  _stack.push_back(left);
+}
+
+bool RegisterCodeGenerator::genInsn(uint32_t bci, Instruction insn) {
+  switch (insn) {
+    case BC_INVALID:
+    case BC_BREAK:
+      break;
+    case BC_POP:
+      pop();
+      break;
+
+    case BC_I2D: {
+      Value value = pop();
+      GPVar src = readGp(value);
+      _.cvtsi2sd(pushXmm(), src);
+      break;
+    }
+    case BC_D2I: {
+      Value value = pop();
+      XMMVar src = readXmm(value);
+      _.cvttsd2si(pushGp(), src);
+      break;
+    }
+    case BC_S2I: {
+      Value value = pop();
+      GPVar id = readGp(value);
+      GPVar& result = pushGp();
+      ECall* call = _.call((void*) &stringToInt);
+      call->setPrototype(
+          CALL_CONV_DEFAULT,
+          FunctionBuilder2<int64_t, CompiledRuntime*, StringHandle>());
+      call->setArgument(0, _rt);
+      call->setArgument(1, id);
+      call->setReturn(result);
+      break;
+    }
+
+    case BC_DLOAD: loadDouble(pushXmm(), _bc->getDouble(bci + 1)); break;
+    case BC_DLOAD0: loadDouble(pushXmm(), 0.0); break;
+    case BC_DLOAD1: loadDouble(pushXmm(), 1.0); break;
+    case BC_DLOADM1: loadDouble(pushXmm(), -1.0); break;
+    case BC_ILOAD: pushConst(_bc->getInt64(bci + 1)); break;
+    case BC_SLOAD: pushConst(_bc->getUInt16(bci + 1), 's'); break;
+    case BC_ILOAD0: pushConst(0); break;
+    case BC_SLOAD0: pushConst(0, 's'); break;
+    case BC_ILOAD1: pushConst(1); break;
+    case BC_ILOADM1: pushConst(-1); break;
+
+    case BC_LOADDVAR0: case BC_LOADDVAR1:
+    case BC_LOADDVAR2: case BC_LOADDVAR3:
+      pushLocal(insn - BC_LOADDVAR0, 'd');
+      break;
+    case BC_LOADIVAR0: case BC_LOADIVAR1:
+    case BC_LOADIVAR2: case BC_LOADIVAR3:
+      pushLocal(insn - BC_LOADIVAR0, 'i');
+      break;
+    case BC_LOADSVAR0: case BC_LOADSVAR1:
+    case BC_LOADSVAR2: case BC_LOADSVAR3:
+      pushLocal(insn - BC_LOADSVAR0, 's');
+      break;
+    case BC_LOADDVAR: pushLocal(_bc->getUInt16(bci + 1), 'd'); break;
+    case BC_LOADIVAR: pushLocal(_bc->getUInt16(bci + 1), 'i'); break;
+    case BC_LOADSVAR: pushLocal(_bc->getUInt16(bci + 1), 's'); break;
+
+    case BC_STOREDVAR0: case BC_STOREDVAR1:
+    case BC_STOREDVAR2: case BC_STOREDVAR3:
+      genStore('d', insn - BC_STOREDVAR0);
+      break;
+    case BC_STOREIVAR0: case BC_STOREIVAR1:
+    case BC_STOREIVAR2: case BC_STOREIVAR3:
+      genStore('i', insn - BC_STOREIVAR0);
+      break;
+    case BC_STORESVAR0: case BC_STORESVAR1:
+    case BC_STORESVAR2: case BC_STORESVAR3:
+      genStore('s', insn - BC_STORESVAR0);
+      break;
+    case BC_STOREDVAR: genStore('d', _bc->getUInt16(bci + 1)); break;
+    case BC_STOREIVAR: genStore('i', _bc->getUInt16(bci + 1)); break;
+    case BC_STORESVAR: genStore('s', _bc->getUInt16(bci + 1)); break;
+
+    case BC_LOADCTXDVAR:
+      if (isOwn(bci)) {
+        pushLocal(_bc->getUInt16(bci + 3), 'd');
+      } else {
+        GPVar slots = _.newGP();
+        loadOuter(slots, bci, FunctionContex::doublesPointerOffset());
+        _.movsd(pushXmm(), qword_ptr(slots, _bc->getUInt16(bci + 3) * 8));
+      }
+      break;
+    case BC_LOADCTXIVAR:
+      if (isOwn(bci)) {
+        pushLocal(_bc->getUInt16(bci + 3), 'i');
+      } else {
+        GPVar slots = _.newGP();
+        loadOuter(slots, bci, FunctionContex::intsPointerOffset());
+        _.mov(pushGp(), qword_ptr(slots, _bc->getUInt16(bci + 3) * 8));
+      }
+      break;
+    case BC_LOADCTXSVAR:
+      if (isOwn(bci)) {
+        pushLocal(_bc->getUInt16(bci + 3), 's');
+      } else {
+        GPVar slots = _.newGP();
+        loadOuter(slots, bci, FunctionContex::stringsPointerOffset());
+        _.mov(pushGp('s').r32(),
+              dword_ptr(slots, _bc->getUInt16(bci + 3) * 4));
+      }
+      break;
+    case BC_STORECTXDVAR:
+    case BC_STORECTXIVAR:
+    case BC_STORECTXSVAR: {
+      char type = insn == BC_STORECTXDVAR ? 'd'
+              : insn == BC_STORECTXIVAR ? 'i' : 's';
+      uint16_t id = _bc->getUInt16(bci + 3);
+      if (isOwn(bci)) {
+        genStore(type, id);
+        break;
+      }
+      Value value = pop();
+      GPVar slots = _.newGP();
+      if (type == 'd') {
+        loadOuter(slots, bci, FunctionContex::doublesPointerOffset());
+        storeValue(qword_ptr(slots, id * 8), value);
+      } else if (type == 'i') {
+        loadOuter(slots, bci, FunctionContex::intsPointerOffset());
+        storeValue(qword_ptr(slots, id * 8), value);
+      } else {
+        GPVar src = readGp(value);
+        loadOuter(slots, bci, FunctionContex::stringsPointerOffset());
+        _.mov(dword_ptr(slots, id * 4), src.r32());
+      }
+      break;
+    }
+
+    case BC_JA: {
+      uint32_t target = _bc->jumpTarget(bci);
+      if (!edge(target)) {
+        return false;
+      }
+      _.jmp(_labels[target]);
+      break;
+    }
+    case BC_IFICMPNE: case BC_IFICMPE: case BC_IFICMPG:
+    case BC_IFICMPGE: case BC_IFICMPL: case BC_IFICMPLE:
+    case BC_IFICMPNEVAR: case BC_IFICMPEVAR: case BC_IFICMPGVAR:
+    case BC_IFICMPGEVAR: case BC_IFICMPLVAR: case BC_IFICMPLEVAR:
+      return genCompareJump(bci, insn);
+    case BC_DIFCMPNE: case BC_DIFCMPE: case BC_DIFCMPG:
+    case BC_DIFCMPGE: case BC_DIFCMPL: case BC_DIFCMPLE:
+      return genDoubleCompareJump(bci, insn);
+    case BC_IINCVAR: {
+      uint16_t id = _bc->getUInt16(bci + 1);
+      keepLocal('i', id);
+      _.add(_ints[id], imm(_bc->getInt16(bci + 3)));
+      break;
+    }
+
+    case BC_DADD: genDoubleOp(INST_ADDSD, true); break;
+    case BC_DSUB: genDoubleOp(INST_SUBSD, false); break;
+    case BC_DMUL: genDoubleOp(INST_MULSD, true); break;
+    case BC_DDIV: genDoubleOp(INST_DIVSD, false); break;
+    case BC_DNEG: {
+      GPVar bits = _.newGP();
+      XMMVar sign = _.newXMM(VARIABLE_TYPE_XMM_1D);
+      _.mov(bits, imm((sysint_t) 1 << 63));
+      _.movq(sign, bits);
+      _.xorpd(ownXmm(top()), sign);
+      break;
+    }
+    case BC_DSQRT: {
+      Value value = pop();
+      XMMVar src = readXmm(value);
+      _.sqrtsd(pushXmm(), src);
+      break;
+    }
+    case BC_DSIN: case BC_DCOS: {
+      Value value = pop();
+      XMMVar arg = readXmm(value);
+      XMMVar& result = pushXmm();
+      ECall* call = _.call((void*) (insn == BC_DSIN ? &sine : &cosine));
+      call->setPrototype(CALL_CONV_DEFAULT, FunctionBuilder1<double, double>());
+      call->setArgument(0, arg);
+      call->setReturn(result);
+      break;
+    }
+    case BC_DPOW: {
+      Value x = pop();
+      Value y = pop();
+      XMMVar base = readXmm(x);
+      XMMVar exponent = readXmm(y);
+      XMMVar& result = pushXmm();
+      ECall* call = _.call((void*) &power);
+      call->setPrototype(CALL_CONV_DEFAULT,
+                         FunctionBuilder2<double, double, double>());
+      call->setArgument(0, base);
+      call->setArgument(1, exponent);
+      call->setReturn(result);
+      break;
+    }
+    case BC_DCMP: {
+      // unordered gives 1, as in the interpreter
+      Value right = pop();
+      Value left = pop();
+      XMMVar a = readXmm(left);
+      XMMVar b = readXmm(right);
+      GPVar result = pushGp();
+      AsmJit::Label done = _.newLabel();
+      _.ucomisd(a, b);
+      _.mov(result, imm(1));
+      _.jp(done);
+      _.mov(result, imm(-1));
+      _.jb(done);
+      _.mov(result, imm(0));
+      _.je(done);
+      _.mov(result, imm(1));
+      _.bind(done);
+      break;
+    }
+
+    case BC_IADD: genIntOp(INST_ADD, true); break;
+    case BC_ISUB: genIntOp(INST_SUB, false); break;
+    case BC_IMUL: genIntOp(INST_IMUL, true); break;
+    case BC_IAAND: genIntOp(INST_AND, true); break;
+    case BC_IAOR: genIntOp(INST_OR, true); break;
+    case BC_IAXOR: genIntOp(INST_XOR, true); break;
+    case BC_IDIV: case BC_IMOD: {
+      // the Compiler's idiv loses values when rdx is taken, so the
+      // division is a call
+      Value right = pop();
+      Value left = pop();
+      GPVar dividend = readGp(left);
+      GPVar divisor = readGp(right);
+      GPVar& result = pushGp();
+      ECall* call = _.call(insn == BC_IDIV ? (void*) &divide
+                                           : (void*) &modulo);
+      call->setPrototype(CALL_CONV_DEFAULT,
+                         FunctionBuilder2<int64_t, int64_t, int64_t>());
+      call->setArgument(0, dividend);
+      call->setArgument(1, divisor);
+      call->setReturn(result);
+      break;
+    }
+    case BC_INEG:
+      _.neg(ownGp(top()));
+      break;
+    case BC_ICMP: {
+      Value right = pop();
+      Value left = pop();
+      GPVar a = readGp(left);
+      Operand b = source(right);
+      GPVar one = constant(1);
+      GPVar minusOne = constant(-1);
+      GPVar result = pushGp();
+      _.xor_(result, result);
+      _._emitInstruction(INST_CMP, &a, &b);
+      _.cmovg(result, one);
+      _.cmovl(result, minusOne);
+      break;
+    }
+
+    case BC_ISWAP: case BC_DSWAP: case BC_SSWAP:
+      swap(top(), top(1));
+      break;
+
+    case BC_IPRINT: {
+      Value value = pop();
+      GPVar arg = readGp(value);
+      ECall* call = _.call((void*) &printInt);
+      call->setPrototype(CALL_CONV_DEFAULT,
+                         FunctionBuilder2<Void, CompiledRuntime*, int64_t>());
+      call->setArgument(0, _rt);
+      call->setArgument(1, arg);
+      break;
+    }
+    case BC_DPRINT: {
+      Value value = pop();
+      XMMVar arg = readXmm(value);
+      ECall* call = _.call((void*) &printDouble);
+      call->setPrototype(CALL_CONV_DEFAULT,
+                         FunctionBuilder2<Void, CompiledRuntime*, double>());
+      call->setArgument(0, _rt);
+      call->setArgument(1, arg);
+      break;
+    }
+    case BC_SPRINT: {
+      Value value = pop();
+      GPVar arg = readGp(value);
+      ECall* call = _.call((void*) &printString);
+      call->setPrototype(
+          CALL_CONV_DEFAULT,
+          FunctionBuilder2<Void, CompiledRuntime*, StringHandle>());
+      call->setArgument(0, _rt);
+      call->setArgument(1, arg);
+      break;
+    }
+
+    case BC_CALL:
+      genCall(_bc->getUInt16(bci + 1));
+      break;
+    case BC_RETURN:
+      genReturn();
+      break;
+    case BC_STOP:
+      jumpAbort();
+      break;
+
+    default:
+      return false;
+  }
+  return true;
+}
+
+void RegisterCodeGenerator::leaveFrame() {
+  GPVar fun = constant((sysint_t) _fun);
+  ECall* leave = _.call((void*) &leaveFunction);
+  leave->setPrototype(CALL_CONV_DEFAULT,
+                      FunctionBuilder3<Void, CompiledRuntime*,
+                                       const BytecodeFunction*,
+                                       FunctionContex*>());
+  leave->setArgument(0, _rt);
+  leave->setArgument(1, fun);
+  leave->setArgument(2, _frame);
+}
+
+bool RegisterCodeGenerator::generate() {
+  if (!MachCodeGenerator::canCompile(_fun) || !inferTypes()) {
+    return false;
+  }
+  uint32_t length = _bc->length();
+
+  // the display only matters to functions reaching outer variables
+  bool outer = false;
+  _labels.resize(length + 1);
+  for (uint32_t bci = 0; bci < length;) {
+    Instruction insn = _bc->getInsn(bci);
+    if (_targets[bci]) {
+      _labels[bci] = _.newLabel();
+    }
+    if (insn >= BC_LOADCTXDVAR && insn <= BC_STORECTXSVAR && !isOwn(bci)) {
+      outer = true;
+    }
+    size_t insnLength;
+    bytecodeName(insn, &insnLength);
+    bci += insnLength;
+  }
+  _abort = _.newLabel();
+  _leave = _.newLabel();
+  _exit = _.newLabel();
+
+  _.newFunction(CALL_CONV_DEFAULT,
+                FunctionBuilder1<uint32_t, CompiledRuntime*>());
+  _rt = _.argGP(0);
+  _frame = _.newGP();
+  _result = _.newGP();
+  _topPtr = _.newGP();
+  _base = _.newGP();
+
+  // as in the baseline, the Compiler has no variable for rsp
+  AsmJit::Label room = _.newLabel();
+  Mem limit = qword_ptr(_rt, offsetof(CompiledRuntime, stackLimit));
+  _._emitInstruction(INST_CMP, &rsp, &limit);
+  _.jae(room);
+  GPVar id = constant(_fun->id());
+  ECall* deep = _.call((void*) &callInterpreted);
+  deep->setPrototype(CALL_CONV_DEFAULT,
+                     FunctionBuilder2<uint8_t, CompiledRuntime*, uint16_t>());
+  deep->setArgument(0, _rt);
+  deep->setArgument(1, id);
+  deep->setReturn(_result);
+  _.and_(_result, imm(0xff));
+  _.jmp(_exit);
+
+  _.bind(room);
+  GPVar fun = constant((sysint_t) _fun);
+  ECall* enter = _.call((void*) &enterFunction);
+  enter->setPrototype(CALL_CONV_DEFAULT,
+                      FunctionBuilder2<FunctionContex*, CompiledRuntime*,
+                                       const BytecodeFunction*>());
+  enter->setArgument(0, _rt);
+  enter->setArgument(1, fun);
+  enter->setReturn(_frame);
+  _.xor_(_result, _result);
+  _.test(_frame, _frame);
+  // no frame to leave
+  _.jz(_exit);
+
+  _.mov(_topPtr, qword_ptr(_rt, offsetof(CompiledRuntime, top)));
+  _.mov(_base, qword_ptr(_topPtr));
+  if (outer) {
+    _display = _.newGP();
+    _.mov(_display, qword_ptr(_rt, offsetof(CompiledRuntime, display)));
+  }
+  for (size_t i = 0; i < _fun->sizeDoubles; i++) {
+    _doubles.push_back(_.newXMM(VARIABLE_TYPE_XMM_1D));
+  }
+  for (size_t i = 0; i < _fun->sizeInts; i++) {
+    _ints.push_back(_.newGP());
+  }
+  for (size_t i = 0; i < _fun->sizeStrings; i++) {
+    _strings.push_back(_.newGP());
+  }
+  loadLocals(false);
+  for (uint16_t i = 0; i < _doubles.size(); i++) {
+    _sharedFrame = _sharedFrame || isCaptured('d', i);
+  }
+  for (uint16_t i = 0; i < _ints.size(); i++) {
+    _sharedFrame = _sharedFrame || isCaptured('i', i);
+  }
+  for (uint16_t i = 0; i < _strings.size(); i++) {
+    _sharedFrame = _sharedFrame || isCaptured('s', i);
+  }
+
+  // whether the previous instruction falls through
+  bool live = true;
+  for (uint32_t bci = 0; bci < length;) {
+    Instruction insn = _bc->getInsn(bci);
+    size_t insnLength;
+    bytecodeName(insn, &insnLength);
+    if (_targets[bci]) {
+      if (live && !edge(bci)) {
+        return false;
+      }
+      _.bind(_labels[bci]);
+      if (_reached[bci]) {
+        enterTarget(bci);
+      }
+    }
+    if (!_reached[bci]) {
+      live = false;
+      bci += insnLength;
+      continue;
+    }
+    if (!genInsn(bci, insn)) {
+      return false;
+    }
+    live = insn != BC_JA && insn != BC_RETURN && insn != BC_STOP;
+    bci += insnLength;
+
+    // the stack has to be what the types say
+    if (live) {
+      const string& types = _types[bci];
+      if (types.size() != _stack.size()) {
+        return false;
+      }
+      for (size_t i = 0; i < types.size(); i++) {
+        if (types[i] != _stack[i].type) {
+          return false;
+        }
+      }
+    }
+  }
+
+  if (_aborts) {
+    _.bind(_abort);
+    _.xor_(_result, _result);
+  }
+  if (_aborts || _returns) {
+    _.bind(_leave);
+    leaveFrame();
+  }
+  _.bind(_exit);
+  _.ret(_result);
+  _.endFunction();
+
+  _.serialize(_out);
+  return _.getError() == 0 && _out.getError() == 0;
+}
+
+MachCodeImpl::MachCodeImpl() : _hotThreshold(DEFAULT_HOT_THRESHOLD) {
+}
+
+MachCodeImpl::~MachCodeImpl() {
+  for (size_t i = 0; i < _blocks.size(); i++) {
+    VirtualMemory::free(_blocks[i].first, _blocks[i].second);
+  }
+}
+
+void* MachCodeImpl::allocate(size_t size) {
+  size_t allocated;
+  void* block = VirtualMemory::alloc(size, &allocated, true);
+  if (block != NULL) {
+    _blocks.push_back(make_pair(block, allocated));
+  }
+  return block;
+}
+
+void MachCodeImpl::findCaptured(const BytecodeFunction* fun) {
+  const Bytecode* bc = fun->bytecode();
+  for (uint32_t bci = 0; bci < bc->length();) {
+    Instruction insn = bc->getInsn(bci);
+    if (insn >= BC_LOADCTXDVAR && insn <= BC_STORECTXSVAR) {
+      uint16_t depth = bc->getUInt16(bci + 1);
+      char type = "dis"[(insn - BC_LOADCTXDVAR) % 3];
+      if (depth != fun->depth()) {
+        _captured.insert(capturedKey(depth, type, bc->getUInt16(bci + 3)));
+      }
+    }
+    size_t length;
+    bytecodeName(insn, &length);
+    bci += length;
+  }
+}
+
+size_t MachCodeImpl::compile() {
+  vector<BytecodeFunction*> functions;
+  FunctionIterator fi(this);
+  while (fi.hasNext()) {
+    functions.push_back((BytecodeFunction*) fi.next());
+  }
+
+  // compiled code reads these at run time, must not move from now on
+  _compiled.assign(functions.size(), NULL);
+  _counters.assign(functions.size(), 0);
+  _tieredUp.assign(functions.size(), false);
+  for (size_t i = 0; i < functions.size(); i++) {
+    findCaptured(functions[i]);
+  }
+
+  vector<MachCodeGenerator*> generators(functions.size(), NULL);
+  vector<Assembler*> stubs(functions.size(), NULL);
+  size_t size = 0;
+  if (_hotThreshold != 0) {
+    for (size_t i = 0; i < functions.size(); i++) {
+      stubs[i] = new Assembler();
+      genCallStub(*stubs[i], i, &_compiled[i]);
+      size += stubs[i]->getCodeSize();
+    }
+  }
+  for (size_t i = 0; i < functions.size(); i++) {
+    if (!MachCodeGenerator::canCompile(functions[i])) {
+      continue;
+    }
+    generators[i] = new MachCodeGenerator(functions[i], &_compiled[0]);
+    // the top level function runs once, nothing to win
+    if (_hotThreshold != 0 && i != 0) {
+      generators[i]->count(this, &_counters[i], _hotThreshold);
+    }
+    if (generators[i]->generate()) {
+      size += generators[i]->codeSize();
+    } else {
+      delete generators[i];
+      generators[i] = NULL;
+    }
+  }
+
+  // one executable block for the whole program
+  size_t count = 0;
+  uint8_t* dst = size != 0 ? (uint8_t*) allocate(size) : NULL;
+  _entries.assign(functions.size(), NULL);
+  for (size_t i = 0; i < functions.size(); i++) {
+    if (stubs[i] != NULL && dst != NULL) {
+      stubs[i]->relocCode(dst);
+      _entries[i] = dst;
+      dst += stubs[i]->getCodeSize();
+    }
+    delete stubs[i];
+  }
+  for (size_t i = 0; i < functions.size(); i++) {
+    if (generators[i] == NULL) {
+      continue;
+    }
+    if (dst != NULL) {
+      _compiled[i] = generators[i]->relocate(dst);
+      dst += generators[i]->codeSize();
+      count++;
+    }
+    delete generators[i];
+  }
+  return count;
+}
+
+void MachCodeImpl::tierUp(uint16_t id) {
+  // the counter wraps around to the threshold again
+  if (_tieredUp[id]) {
+    return;
+  }
+  _tieredUp[id] = true;
+
+  RegisterCodeGenerator generator(
+          (BytecodeFunction*) functionById(id), this, &_entries[0],
+          &_captured);
+  if (!generator.generate()) {
+    return;
+  }
+  void* dst = allocate(generator.codeSize());
+  if (dst != NULL) {
+    // the baseline code stays, frames still running it return there
+    _compiled[id] = generator.relocate(dst);
+  }
+}
+
+const CompiledFunction* MachCodeImpl::compiledFunctions() const {
+  return _compiled.empty() ? NULL : &_compiled[0];
+}
+
+MachCodeTranslatorImpl::MachCodeTranslatorImpl() :
+  _hotThreshold(MachCodeImpl::DEFAULT_HOT_THRESHOLD) {
+}
+
+MachCodeTranslatorImpl::~MachCodeTranslatorImpl() {
+}
+
+BytecodeCode* MachCodeTranslatorImpl::createCode() {
+  MachCodeImpl* code = new MachCodeImpl();
+  code->setHotThreshold(_hotThreshold);
+  return code;
+}
+
+Status* MachCodeTranslatorImpl::translate(const string& program, Code* *result) {
+  Status* status = BytecodeTranslator::translate(program, result);
+  if (status != NULL && status->isError()) {
+    return status;
+  }
+  ((MachCodeImpl*) *result)->compile();
+  return status;
+}
+
+Status* MachCodeTranslatorImpl::load(const string& path, Code* *result) {
+  Status* status = BytecodeTranslator::load(path, result);
+  if (status != NULL && status->isError()) {
+    return status;
+  }
+  ((MachCodeImpl*) *result)->compile();
+  return status;
 }
 
 }
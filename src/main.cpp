@@ -1,18 +1,69 @@
 #include "mathvm.h"
+#include "bytecodeTranslator.h"
+#include "bytecodeCode.h"
+#include "bytecodeFile.h"
+#include "compileCache.h"
+#include "jit.h"
+#include "sampler.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
 
 using namespace mathvm;
 using namespace std;
 
+static bool moreInstructions(const pair<uint16_t, FunctionProfile>& a,
+                             const pair<uint16_t, FunctionProfile>& b) {
+    return a.second.instructions > b.second.instructions;
+}
+
+// hottest first, on stderr to keep clear of the program's output
+static void dumpProfile(const BytecodeCode* code) {
+    const vector<FunctionProfile>& profile = code->profile();
+    vector<pair<uint16_t, FunctionProfile> > functions;
+    for (size_t id = 0; id < profile.size(); id++) {
+        if (profile[id].calls != 0) {
+            functions.push_back(make_pair((uint16_t) id, profile[id]));
+        }
+    }
+    stable_sort(functions.begin(), functions.end(), moreInstructions);
+
+    cerr << setw(14) << "instructions" << setw(12) << "calls"
+            << setw(12) << "loops" << "  function" << endl;
+    for (size_t i = 0; i < functions.size(); i++) {
+        const FunctionProfile& counts = functions[i].second;
+        cerr << setw(14) << counts.instructions << setw(12) << counts.calls
+                << setw(12) << counts.backEdges << "  "
+                << code->functionById(functions[i].first)->name() << endl;
+    }
+    cerr << "calls: " << code->callsCount() << ", frame chunk allocations: "
+            << code->frameAllocations() << endl;
+}
+
 int main(int argc, char** argv) {
 
     string impl = "";
+    bool optimize = true;
+    int64_t hotThreshold = -1;
+    bool profile = false;
+    bool sample = false;
+    // collapsed stacks go there when sampling
+    const char* stacksFile = NULL;
+    // the translated program goes there instead of running
+    const char* bytecodeFile = NULL;
+    // translated programs are kept there, see compileCache.h
+    const char* cacheDirectory = getenv("MATHVM_CACHE_DIR");
+    uint64_t cacheSize = CompileCache::DEFAULT_SIZE_LIMIT;
+    bool cacheStats = false;
+    // threads translating function bodies, 0 for one per CPU
+    uint32_t translateThreads = 0;
 #ifndef PROD
      const char* script = "tests/while.mvm";
 
@@ -23,18 +74,75 @@ int main(int argc, char** argv) {
     for (int32_t i = 1; i < argc; i++) {
         if (string(argv[i]) == "-j") {
             impl = "jit";
+        } else if (string(argv[i]) == "--no-opt") {
+            optimize = false;
+        } else if (string(argv[i]) == "--hot" && i + 1 < argc) {
+            // calls and loop iterations before the register tier, 0 is never
+            hotThreshold = atol(argv[++i]);
+        } else if (string(argv[i]) == "--profile") {
+            profile = true;
+        } else if (string(argv[i]) == "--sample") {
+            sample = true;
+        } else if (string(argv[i]) == "--stacks" && i + 1 < argc) {
+            sample = true;
+            stacksFile = argv[++i];
+        } else if (string(argv[i]) == "--emit-bytecode" && i + 1 < argc) {
+            bytecodeFile = argv[++i];
+        } else if (string(argv[i]) == "--cache" && i + 1 < argc) {
+            cacheDirectory = argv[++i];
+        } else if (string(argv[i]) == "--cache-size" && i + 1 < argc) {
+            // bytes, 0 is unlimited
+            cacheSize = strtoull(argv[++i], NULL, 10);
+        } else if (string(argv[i]) == "--cache-stats") {
+            cacheStats = true;
+        } else if (string(argv[i]) == "--translate-threads" && i + 1 < argc) {
+            translateThreads = atol(argv[++i]);
         } else {
             script = argv[i];
         }
     }
+    CompileCache* cache = NULL;
+    if (cacheDirectory != NULL && *cacheDirectory != '\0') {
+        cache = new CompileCache(cacheDirectory, cacheSize);
+    }
+    if (cacheStats) {
+        if (cache == NULL) {
+            printf("No cache directory, see --cache\n");
+            return 1;
+        }
+        cache->report(cout);
+        delete cache;
+        return 0;
+    }
+
     Translator* translator = Translator::create(impl);
+    BytecodeTranslator* bytecodeTranslator =
+            dynamic_cast<BytecodeTranslator*> (translator);
+    if (bytecodeTranslator != NULL) {
+        bytecodeTranslator->setOptimize(optimize);
+        bytecodeTranslator->setCache(cache);
+        if (translateThreads != 0) {
+            bytecodeTranslator->setThreads(translateThreads);
+        }
+    }
+    MachCodeTranslatorImpl* machCodeTranslator =
+            dynamic_cast<MachCodeTranslatorImpl*> (translator);
+    if (machCodeTranslator != NULL && hotThreshold >= 0) {
+        machCodeTranslator->setHotThreshold((uint32_t) hotThreshold);
+    }
 
     const char* expr = "double x; double y;"
             "x += 8.0; y = 2.0;"
             "print('Hello, x=',x,' y=',y,'\n');";
     bool isDefaultExpr = true;
+    // a file --emit-bytecode wrote, there is no source then
+    bool isBytecode = script != NULL && bytecodeTranslator != NULL
+            && BytecodeFile::isBytecodeFile(script);
 
-    if (script != NULL) {
+    if (isBytecode) {
+        expr = "";
+        isDefaultExpr = false;
+    } else if (script != NULL) {
         expr = loadFile(script);
         if (expr == 0) {
             printf("Cannot read file: %s\n", script);
@@ -48,8 +156,13 @@ int main(int argc, char** argv) {
     cout << expr << endl;
     cout << "-------------" << endl;
 #endif
-    Status* translateStatus = translator->translate(expr, &code);
-    if (translateStatus != NULL && translateStatus->isError()) {
+    Status* translateStatus = isBytecode
+            ? bytecodeTranslator->load(script, &code)
+            : translator->translate(expr, &code);
+    if (translateStatus != NULL && translateStatus->isError() && isBytecode) {
+        printf("Cannot load bytecode: error '%s'\n",
+                translateStatus->getError().c_str());
+    } else if (translateStatus != NULL && translateStatus->isError()) {
         uint32_t position = translateStatus->getPosition();
         uint32_t line = 0, offset = 0;
         positionToLineOffset(expr, position, line, offset);
@@ -57,6 +170,17 @@ int main(int argc, char** argv) {
                 "error '%s'\n",
                 line, offset,
                 translateStatus->getError().c_str());
+    } else if (bytecodeFile != NULL) {
+        BytecodeCode* bytecodeCode = dynamic_cast<BytecodeCode*> (code);
+        Status* saveStatus = bytecodeCode != NULL
+                ? BytecodeFile::save(bytecodeCode, bytecodeFile)
+                : new Status("Only bytecode can be saved");
+        if (saveStatus != NULL) {
+            printf("Cannot emit bytecode: error '%s'\n",
+                    saveStatus->getError().c_str());
+            delete saveStatus;
+        }
+        delete code;
     } else {
 
         assert(code != 0);
@@ -73,7 +197,26 @@ int main(int argc, char** argv) {
         code->disassemble();
         cout << "-------" << endl;
 #endif
+        BytecodeCode* bytecodeCode = dynamic_cast<BytecodeCode*> (code);
+        SamplingProfiler sampler;
+        if (profile && bytecodeCode != NULL) {
+            bytecodeCode->setProfiling(true);
+        }
+        if (sample && bytecodeCode != NULL) {
+            bytecodeCode->setSampler(&sampler);
+        }
         Status* execStatus = code->execute(vars);
+        if (profile && bytecodeCode != NULL) {
+            dumpProfile(bytecodeCode);
+        }
+        if (sample && bytecodeCode != NULL) {
+            bytecodeCode->setSampler(NULL);
+            sampler.reportFlat(cerr, *code, expr);
+            if (stacksFile != NULL) {
+                ofstream stacks(stacksFile);
+                sampler.reportCollapsed(stacks, *code, expr);
+            }
+        }
         if (execStatus != NULL && execStatus->isError()) {
             printf("Cannot execute expression: error: %s\n",
                     execStatus->getError().c_str());
@@ -90,8 +233,9 @@ int main(int argc, char** argv) {
     }
     if (translateStatus != NULL) delete translateStatus;
     if (translator != NULL) delete translator;
+    if (cache != NULL) delete cache;
 
-    if (!isDefaultExpr) {
+    if (!isDefaultExpr && !isBytecode) {
         delete [] expr;
     }
 
@@ -144,7 +144,7 @@ namespace mathvm {
 
     TranslatedFunction::TranslatedFunction(AstFunction* function) :
     _id(INVALID_ID),
-    sizeDoubles(0), sizeInts(0), sizeStrings(0),
+    sizeDoubles(0), sizeInts(0), sizeStrings(0), maxStack(0),
     _locals(0), _params(function->parametersNumber()),
     _name(function->name()) {
         _signature.push_back(SignatureElement(function->returnType(), "return"));
@@ -155,7 +155,8 @@ namespace mathvm {
 
     TranslatedFunction::TranslatedFunction(const string& name, const Signature& signature) :
     _id(INVALID_ID), _locals(0), _params(signature.size() - 1), _name(name),
-    _signature(signature) {
+    _signature(signature),
+    sizeDoubles(0), sizeInts(0), sizeStrings(0), maxStack(0) {
     }
 
     TranslatedFunction::~TranslatedFunction() {
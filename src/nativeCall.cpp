@@ -0,0 +1,155 @@
+#include "nativeCall.h"
+
+#include <AsmJit/AsmJit.h>
+
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include <map>
+
+using namespace AsmJit;
+
+namespace mathvm {
+
+    const void* resolveNative(const string& name) {
+        return dlsym(RTLD_DEFAULT, name.c_str());
+    }
+
+    // System V AMD64: the first six integer arguments in these, the first
+    // eight doubles in xmm0-xmm7, the rest on the stack in order.
+    static const GPReg* const intArguments[] = {&rdi, &rsi, &rdx, &rcx, &r8, &r9};
+    static const size_t INT_ARGUMENTS = 6;
+    static const size_t DOUBLE_ARGUMENTS = 8;
+
+    static XMMReg doubleArgument(size_t index) {
+        return xmm(index);
+    }
+
+    // rbx keeps result and r12 code across the call, r10 top and r11
+    // strings while the arguments are loaded.
+    static void loadArgument(Assembler& _, const Mem& slot, VarType type,
+            const GPReg& dst) {
+        if (type == VT_STRING) {
+            _.mov(eax, slot);
+            _.mov(dst, qword_ptr(r11, rax, 3));
+        } else {
+            _.mov(dst, slot);
+        }
+    }
+
+    static NativeTrampoline generate(const Signature& signature) {
+        size_t ints = 0;
+        size_t doubles = 0;
+        // parameter indices of those passed on the stack, in order
+        vector<size_t> spilled;
+        for (size_t i = 1; i < signature.size(); i++) {
+            VarType type = signature[i].first;
+            if (type == VT_DOUBLE) {
+                if (doubles++ >= DOUBLE_ARGUMENTS) {
+                    spilled.push_back(i);
+                }
+            } else if (type == VT_INT || type == VT_STRING) {
+                if (ints++ >= INT_ARGUMENTS) {
+                    spilled.push_back(i);
+                }
+            } else {
+                return NULL;
+            }
+        }
+
+        Assembler _;
+        _.push(rbp);
+        _.mov(rbp, rsp);
+        _.push(rbx);
+        _.push(r12);
+        _.mov(r12, rdi);
+        _.mov(r10, rsi);
+        _.mov(r11, rdx);
+        _.mov(rbx, rcx);
+
+        // four pushes so far keep rsp 16-byte aligned
+        size_t stackBytes = (spilled.size() * 8 + 15) & ~(size_t) 15;
+        if (stackBytes != 0) {
+            _.sub(rsp, imm(stackBytes));
+        }
+        for (size_t j = 0; j < spilled.size(); j++) {
+            size_t i = spilled[j];
+            sysint_t offset = -(sysint_t) (8 * i);
+            if (signature[i].first == VT_STRING) {
+                loadArgument(_, dword_ptr(r10, offset), VT_STRING, rax);
+            } else {
+                _.mov(rax, qword_ptr(r10, offset));
+            }
+            _.mov(qword_ptr(rsp, 8 * j), rax);
+        }
+
+        ints = 0;
+        doubles = 0;
+        for (size_t i = 1; i < signature.size(); i++) {
+            VarType type = signature[i].first;
+            // parameter i is the i-th slot below top
+            sysint_t offset = -(sysint_t) (8 * i);
+            if (type == VT_DOUBLE) {
+                if (doubles < DOUBLE_ARGUMENTS) {
+                    _.movsd(doubleArgument(doubles), qword_ptr(r10, offset));
+                }
+                doubles++;
+            } else {
+                if (ints < INT_ARGUMENTS) {
+                    loadArgument(_, type == VT_STRING
+                            ? dword_ptr(r10, offset) : qword_ptr(r10, offset),
+                            type, *intArguments[ints]);
+                }
+                ints++;
+            }
+        }
+
+        // vector registers used, for variadic callees such as printf
+        _.mov(eax, imm(doubles < DOUBLE_ARGUMENTS ? doubles : DOUBLE_ARGUMENTS));
+        _.call(r12);
+
+        VarType returnType = signature[0].first;
+        if (returnType == VT_DOUBLE) {
+            _.movsd(qword_ptr(rbx), xmm0);
+        } else if (returnType != VT_VOID) {
+            _.mov(qword_ptr(rbx), rax);
+        }
+
+        _.lea(rsp, qword_ptr(rbp, -16));
+        _.pop(r12);
+        _.pop(rbx);
+        _.pop(rbp);
+        _.ret();
+
+        return function_cast<NativeTrampoline>(_.make());
+    }
+
+    // one character per type, the return type first
+    static string shapeOf(const Signature& signature) {
+        string shape;
+        for (size_t i = 0; i < signature.size(); i++) {
+            shape += (char) ('0' + signature[i].first);
+        }
+        return shape;
+    }
+
+    static pthread_mutex_t trampolinesLock = PTHREAD_MUTEX_INITIALIZER;
+
+    NativeTrampoline nativeTrampoline(const Signature& signature) {
+        string shape = shapeOf(signature);
+        pthread_mutex_lock(&trampolinesLock);
+        static map<string, NativeTrampoline>* trampolines =
+                new map<string, NativeTrampoline>();
+        map<string, NativeTrampoline>::iterator it = trampolines->find(shape);
+        NativeTrampoline trampoline;
+        if (it != trampolines->end()) {
+            trampoline = it->second;
+        } else {
+            trampoline = generate(signature);
+            trampolines->insert(make_pair(shape, trampoline));
+        }
+        pthread_mutex_unlock(&trampolinesLock);
+        return trampoline;
+    }
+
+}
@@ -0,0 +1,92 @@
+#include "outputBuffer.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+namespace mathvm {
+
+    void FileWriter::write(const char* data, size_t length) {
+        fwrite(data, 1, length, file);
+    }
+
+    OutputBuffer::OutputBuffer(OutputWriter* writer_, size_t capacity_) :
+    writer(writer_), data(new char[capacity_]), used(0),
+    capacity(capacity_) {
+        assert(capacity >= NUMBER_SIZE);
+    }
+
+    OutputBuffer::~OutputBuffer() {
+        flush();
+        delete[] data;
+    }
+
+    // "00" to "99", two digits at a time halves the divisions
+    static const char digitPairs[] =
+            "0001020304050607080910111213141516171819"
+            "2021222324252627282930313233343536373839"
+            "4041424344454647484950515253545556575859"
+            "6061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+
+    void OutputBuffer::writeInt(int64_t value) {
+        char* out = reserve(NUMBER_SIZE);
+        // from the last digit backwards, then moved to out
+        char digits[NUMBER_SIZE];
+        char* end = digits + NUMBER_SIZE;
+        char* first = end;
+        uint64_t magnitude = value < 0 ? 0 - (uint64_t) value : value;
+        while (magnitude >= 100) {
+            const char* pair = digitPairs + magnitude % 100 * 2;
+            magnitude /= 100;
+            *--first = pair[1];
+            *--first = pair[0];
+        }
+        if (magnitude >= 10) {
+            const char* pair = digitPairs + magnitude * 2;
+            *--first = pair[1];
+            *--first = pair[0];
+        } else {
+            *--first = (char) ('0' + magnitude);
+        }
+        if (value < 0) {
+            *--first = '-';
+        }
+        memcpy(out, first, end - first);
+        used += end - first;
+    }
+
+    void OutputBuffer::writeDouble(double value) {
+        // %g prints whole numbers below 1e6 as their digits; -0 keeps
+        // its sign there
+        if (value > -1e6 && value < 1e6 && value == (double) (int64_t) value
+                && !(value == 0 && signbit(value))) {
+            writeInt((int64_t) value);
+            return;
+        }
+        char* out = reserve(NUMBER_SIZE);
+        used += snprintf(out, NUMBER_SIZE, "%g", value);
+    }
+
+    void OutputBuffer::writeString(const char* value) {
+        size_t length = strlen(value);
+        while (capacity - used < length) {
+            size_t part = capacity - used;
+            memcpy(data + used, value, part);
+            used += part;
+            value += part;
+            length -= part;
+            flush();
+        }
+        memcpy(data + used, value, length);
+        used += length;
+    }
+
+    OutputBuffer& OutputBuffer::standard() {
+        // destroyed in reverse, the buffer flushes to a live writer
+        static FileWriter writer(stdout);
+        static OutputBuffer buffer(&writer);
+        return buffer;
+    }
+
+}
@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 
 namespace mathvm {
 
@@ -13,7 +14,6 @@ Parser::Parser() : _top(0),  _currentScope(0),  _topmostScope(0) {
 }
 
 Parser::~Parser() {
-    delete _topmostScope;
 }
 
 Status* Parser::parseProgram(const string& code) {
@@ -47,12 +47,17 @@ TokenKind Parser::lookaheadToken(uint32_t count) {
     return _tokens.kindAt(_currentTokenIndex + count);
 }
 
-string Parser::currentTokenValue() {
+TokenValue Parser::currentTokenValue() {
     TokenKind kind = currentToken();
     if (kind == tIDENT || kind == tDOUBLE || kind == tINT || kind == tSTRING) {
         return _tokens.valueAt(_currentTokenIndex);
     }
-    return "";
+    return TokenValue();
+}
+
+Symbol Parser::currentTokenSymbol() {
+    TokenValue value = currentTokenValue();
+    return Symbols::intern(value.data(), value.length());
 }
 
 void Parser::consumeToken() {
@@ -68,9 +73,9 @@ void Parser::ensureToken(TokenKind token) {
   consumeToken();
 }
 
-void  Parser::ensureKeyword(const string& keyword) {
+void  Parser::ensureKeyword(const char* keyword) {
     if (currentToken() != tIDENT || currentTokenValue() != keyword) {
-        error("keyword '%s' expected", currentTokenValue().c_str());
+        error("keyword '%s' expected", currentTokenValue().str().c_str());
     }
     consumeToken();
 }
@@ -86,7 +91,7 @@ uint32_t Parser::tokenIndexToOffset(uint32_t tokenIndex) const {
 }
 
 void Parser::pushScope() {
-    Scope* newScope = new Scope(_currentScope);
+    Scope* newScope = new (_arena) Scope(_currentScope, _arena);
     _currentScope->addChildScope(newScope);
     _currentScope = newScope;
 }
@@ -101,7 +106,7 @@ Status* Parser::parseTopLevel() {
     BlockNode* topBlock = 0;
     _currentToken = tUNDEF;
     _currentTokenIndex = 0;
-    _topmostScope = _currentScope = new Scope(0);
+    _topmostScope = _currentScope = new (_arena) Scope(0, _arena);
     _top = 0;
     try {
         topBlock = parseBlock(false);
@@ -113,8 +118,8 @@ Status* Parser::parseTopLevel() {
     Signature signature;
     signature.push_back(SignatureElement(VT_VOID, "return"));
     _topmostScope->declareFunction(
-      new FunctionNode(0, AstFunction::top_name,
-                       signature, topBlock));
+      new (_arena) FunctionNode(0, AstFunction::top_name,
+                       signature, topBlock, _arena));
     _top = _topmostScope->lookupFunction(AstFunction::top_name);
     return 0;
 }
@@ -126,30 +131,32 @@ static inline bool isAssignment(TokenKind token) {
 }
 
 AstNode* Parser::parseStatement() {
-    if (isKeyword(currentTokenValue())) {
-      if (currentTokenValue() == "function") {
+    TokenValue word = currentTokenValue();
+    switch (keywordOf(word.data(), word.length())) {
+      case kNONE:
+          break;
+      case kFUNCTION:
           return parseFunction();
-      } else if (currentTokenValue() == "for") {
+      case kFOR:
           return parseFor();
-      } else if (currentTokenValue() == "if") {
+      case kIF:
           return parseIf();
-      } else if (currentTokenValue() == "while") {
+      case kWHILE:
           return parseWhile();
-      } else if (currentTokenValue() == "print") {
+      case kPRINT:
           return parsePrint();
-      } else if (currentTokenValue() == "int") {
+      case kINT:
           return parseDeclaration(VT_INT);
-      } else if (currentTokenValue() == "double") {
+      case kDOUBLE:
           return parseDeclaration(VT_DOUBLE);
-      } else if (currentTokenValue() == "string") {
+      case kSTRING:
           return parseDeclaration(VT_STRING);
-      } else if (currentTokenValue() == "return") {
+      case kRETURN:
           return parseReturn();
-      } else {
-          cout << "unhandled keyword " << currentTokenValue() << endl;
+      default:
+          cout << "unhandled keyword " << word.str() << endl;
           assert(false);
           return 0;
-      }
     }
     if (currentToken() == tLBRACE) {
        return parseBlock(true);
@@ -163,7 +170,7 @@ AstNode* Parser::parseStatement() {
 CallNode* Parser::parseCall() {
     uint32_t tokenIndex = _currentTokenIndex;
     assert(currentToken() == tIDENT);
-    const string& callee = currentTokenValue();
+    string callee = currentTokenValue().str();
     consumeToken();
     ensureToken(tLPAREN);
     vector<AstNode*> args;
@@ -177,14 +184,14 @@ CallNode* Parser::parseCall() {
     }
     ensureToken(tRPAREN);
 
-    return new CallNode(tokenIndex, callee, args);
+    return new (_arena) CallNode(tokenIndex, callee, args, _arena);
 }
 
 StoreNode* Parser::parseAssignment() {
     assert(currentToken() == tIDENT);
-    AstVar* lhs = _currentScope->lookupVariable(currentTokenValue());
+    AstVar* lhs = _currentScope->lookupVariable(currentTokenSymbol());
     if (lhs == 0) {
-        error("undeclared variable: %s", currentTokenValue().c_str());
+        error("undeclared variable: %s", currentTokenValue().str().c_str());
     }
     consumeToken();
 
@@ -197,7 +204,7 @@ StoreNode* Parser::parseAssignment() {
         error("assignment expected");
     }
 
-    StoreNode* result = new StoreNode(_currentTokenIndex,
+    StoreNode* result = new (_arena) StoreNode(_currentTokenIndex,
                                       lhs,
                                       parseExpression(),
                                       op);
@@ -209,14 +216,14 @@ StoreNode* Parser::parseAssignment() {
 }
 
 PrintNode* Parser::parsePrint() {
-    uint32_t token = _currentToken;
+    uint32_t token = _currentTokenIndex;
     ensureKeyword("print");
     ensureToken(tLPAREN);
 
-    PrintNode* result = new PrintNode(token);
+    PrintNode* result = new (_arena) PrintNode(token);
     while (currentToken() != tRPAREN) {
         AstNode* operand = parseExpression();
-        result->add(operand);
+        result->add(operand, _arena);
         if (currentToken() == tCOMMA) {
             consumeToken();
         }
@@ -226,14 +233,14 @@ PrintNode* Parser::parsePrint() {
     return result;
 }
 
-static inline AstNode* defaultReturnExpr(VarType type) {
+static inline AstNode* defaultReturnExpr(VarType type, AstArena& arena) {
     switch (type) {
         case VT_INT:
-            return new IntLiteralNode(0, 0);
+            return new (arena) IntLiteralNode(0, 0);
         case VT_DOUBLE:
-            return new DoubleLiteralNode(0, 0.0);
+            return new (arena) DoubleLiteralNode(0, 0.0);
         case VT_STRING:
-            return new StringLiteralNode(0, "");
+            return new (arena) StringLiteralNode(0, "", arena);
         case VT_VOID:
             return 0;
       default:
@@ -249,7 +256,7 @@ FunctionNode* Parser::parseFunction() {
     if (currentToken() != tIDENT) {
         error("identifier expected");
     }
-    const string& returnTypeName = currentTokenValue();
+    string returnTypeName = currentTokenValue().str();
     VarType returnType = nameToType(returnTypeName);
     if (returnType == VT_INVALID) {
       error("wrong return type");
@@ -259,7 +266,7 @@ FunctionNode* Parser::parseFunction() {
     if (currentToken() != tIDENT) {
         error("name expected");
     }
-    const string& name = currentTokenValue();
+    string name = currentTokenValue().str();
     consumeToken();
 
     Signature signature;
@@ -267,13 +274,13 @@ FunctionNode* Parser::parseFunction() {
 
     ensureToken(tLPAREN);
     while (currentToken() != tRPAREN) {
-        const string& parameterTypeName = currentTokenValue();
+        string parameterTypeName = currentTokenValue().str();
         VarType parameterType = nameToType(parameterTypeName);
         if (parameterType == VT_INVALID) {
             error("wrong parameter type");
         }
         consumeToken();
-        const string& parameterName = currentTokenValue();
+        string parameterName = currentTokenValue().str();
         if (currentToken() != tIDENT) {
             error("identifier expected");
         }
@@ -301,17 +308,21 @@ FunctionNode* Parser::parseFunction() {
           error("Native name expected, got %s", tokenStr(currentToken()));
       }
       pushScope();
-      body = new BlockNode(_currentTokenIndex, _currentScope);
-      body->add(new NativeCallNode(tokenIndex, currentTokenValue(), signature));
+      body = new (_arena) BlockNode(_currentTokenIndex, _currentScope);
+      body->add(new (_arena) NativeCallNode(tokenIndex,
+                                            currentTokenValue().str(),
+                                            signature, _arena),
+                _arena);
       consumeToken();
       ensureToken(tSEMICOLON);
-      body->add(new ReturnNode(0, 0));
+      body->add(new (_arena) ReturnNode(0, 0), _arena);
       popScope();
     } else {
       body = parseBlock(true);
       if (body->nodes() == 0 ||
           !(body->nodeAt(body->nodes() - 1)->isReturnNode())) {
-        body->add(new ReturnNode(0, defaultReturnExpr(returnType)));
+        body->add(new (_arena) ReturnNode(0, defaultReturnExpr(returnType, _arena)),
+                  _arena);
       }
     }
     popScope();
@@ -319,7 +330,8 @@ FunctionNode* Parser::parseFunction() {
     if (_currentScope->lookupFunction(name) != 0) {
         error("Function %s already defined", name.c_str());
     }
-    FunctionNode* result = new FunctionNode(tokenIndex, name, signature, body);
+    FunctionNode* result =
+        new (_arena) FunctionNode(tokenIndex, name, signature, body, _arena);
     _currentScope->declareFunction(result);
 
     // We don't add function node into AST.
@@ -335,7 +347,7 @@ ForNode* Parser::parseFor() {
         error("identifier expected");
     }
 
-    const string& varName = currentTokenValue();
+    Symbol varName = currentTokenSymbol();
     consumeToken();
 
     ensureKeyword("in");
@@ -346,7 +358,7 @@ ForNode* Parser::parseFor() {
     BlockNode* forBody = parseBlock(true);
     AstVar* forVar = forBody->scope()->lookupVariable(varName);
 
-    return new ForNode(token, forVar, inExpr, forBody);
+    return new (_arena) ForNode(token, forVar, inExpr, forBody);
 }
 
 WhileNode* Parser::parseWhile() {
@@ -358,7 +370,7 @@ WhileNode* Parser::parseWhile() {
 
     BlockNode* loopBlock = parseBlock(true);
 
-    return new WhileNode(token, whileExpr, loopBlock);
+    return new (_arena) WhileNode(token, whileExpr, loopBlock);
 }
 
 IfNode* Parser::parseIf() {
@@ -375,7 +387,7 @@ IfNode* Parser::parseIf() {
         elseBlock = parseBlock(true);
     }
 
-    return new IfNode(token, ifExpr, thenBlock, elseBlock);
+    return new (_arena) IfNode(token, ifExpr, thenBlock, elseBlock);
 }
 
 ReturnNode* Parser::parseReturn() {
@@ -386,7 +398,7 @@ ReturnNode* Parser::parseReturn() {
     if (currentToken() != tSEMICOLON) {
         returnExpr = parseExpression();
     }
-    return new ReturnNode(token, returnExpr);
+    return new (_arena) ReturnNode(token, returnExpr);
 }
 
 BlockNode* Parser::parseBlock(bool needBraces) {
@@ -396,7 +408,7 @@ BlockNode* Parser::parseBlock(bool needBraces) {
 
     pushScope();
 
-    BlockNode* block = new BlockNode(_currentTokenIndex,
+    BlockNode* block = new (_arena) BlockNode(_currentTokenIndex,
                                      _currentScope);
     TokenKind sentinel = needBraces ? tRBRACE : tEOF;
 
@@ -409,7 +421,7 @@ BlockNode* Parser::parseBlock(bool needBraces) {
          // Ignore statements that doesn't result in AST nodes, such
          // as variable or function declaration.
          if (statement != 0) {
-             block->add(statement);
+             block->add(statement, _arena);
          }
      }
 
@@ -425,9 +437,8 @@ BlockNode* Parser::parseBlock(bool needBraces) {
 AstNode* Parser::parseDeclaration(VarType type) {
     // Skip type.
     ensureToken(tIDENT);
-    const string& var = currentTokenValue();
-    if (!_currentScope->declareVariable(var, type)) {
-      error("Variable %s already declared", var.c_str());
+    if (!_currentScope->declareVariable(currentTokenSymbol(), type)) {
+      error("Variable %s already declared", currentTokenValue().str().c_str());
     }
 
     if (lookaheadToken(1) == tASSIGN) {
@@ -454,34 +465,34 @@ AstNode* Parser::parseUnary() {
     if (isUnaryOp(currentToken())) {
         TokenKind op = currentToken();
         consumeToken();
-        return new UnaryOpNode(_currentTokenIndex, op, parseUnary());
+        return new (_arena) UnaryOpNode(_currentTokenIndex, op, parseUnary());
     } else if (currentToken() == tIDENT && lookaheadToken(1) == tLPAREN) {
         AstNode* expr = parseCall();
         return expr;
     } else if (currentToken() == tIDENT) {
-        AstVar* var = _currentScope->lookupVariable(currentTokenValue());
+        AstVar* var = _currentScope->lookupVariable(currentTokenSymbol());
         if (var == 0) {
-            error("undeclared variable: %s", currentTokenValue().c_str());
+            error("undeclared variable: %s", currentTokenValue().str().c_str());
         }
-        LoadNode* result = new LoadNode(_currentTokenIndex, var);
+        LoadNode* result = new (_arena) LoadNode(_currentTokenIndex, var);
         consumeToken();
         return result;
     } else if (currentToken() == tDOUBLE) {
         DoubleLiteralNode* result =
-            new DoubleLiteralNode(_currentTokenIndex,
+            new (_arena) DoubleLiteralNode(_currentTokenIndex,
                                   parseDouble(currentTokenValue()));
         consumeToken();
         return result;
     } else if (currentToken() == tINT) {
         IntLiteralNode* result =
-            new IntLiteralNode(_currentTokenIndex,
+            new (_arena) IntLiteralNode(_currentTokenIndex,
                                parseInt(currentTokenValue()));
         consumeToken();
         return result;
     } else if (currentToken() == tSTRING) {
         StringLiteralNode* result =
-            new StringLiteralNode(_currentTokenIndex,
-                                  currentTokenValue());
+            new (_arena) StringLiteralNode(_currentTokenIndex,
+                                  currentTokenValue().str(), _arena);
         consumeToken();
         return result;
     } else if (currentToken() == tLPAREN) {
@@ -505,7 +516,7 @@ AstNode* Parser::parseBinary(int minPrecedence) {
             uint32_t op_pos = _currentTokenIndex;
             consumeToken();
             AstNode* right = parseBinary(precedence + 1);
-            left = new BinaryOpNode(op_pos, op, left, right);
+            left = new (_arena) BinaryOpNode(op_pos, op, left, right);
         }
         precedence--;
     }
@@ -516,16 +527,31 @@ AstNode* Parser::parseExpression() {
     return parseBinary(tokenPrecedence(tOR));
 }
 
-int64_t Parser::parseInt(const string& str) {
+// Number tokens are short, they are copied to the stack to end them.
+static const uint32_t MAX_NUMBER_LENGTH = 64;
+
+int64_t Parser::parseInt(const TokenValue& value) {
+    if (value.length() >= MAX_NUMBER_LENGTH) {
+        return strtoll(value.str().c_str(), 0, 10);
+    }
+    char buffer[MAX_NUMBER_LENGTH];
+    memcpy(buffer, value.data(), value.length());
+    buffer[value.length()] = '\0';
     char* p;
-    int64_t result = strtoll(str.c_str(), &p, 10);
+    int64_t result = strtoll(buffer, &p, 10);
     assert(*p == '\0');
     return result;
 }
 
-double Parser::parseDouble(const string& str) {
+double Parser::parseDouble(const TokenValue& value) {
+    if (value.length() >= MAX_NUMBER_LENGTH) {
+        return strtod(value.str().c_str(), 0);
+    }
+    char buffer[MAX_NUMBER_LENGTH];
+    memcpy(buffer, value.data(), value.length());
+    buffer[value.length()] = '\0';
     char* p;
-    double result = strtod(str.c_str(), &p);
+    double result = strtod(buffer, &p);
     assert(*p == '\0');
     return result;
 }
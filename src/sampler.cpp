@@ -0,0 +1,220 @@
+#include "sampler.h"
+
+#include <sys/time.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string.h>
+
+namespace mathvm {
+
+    // room for the samples, in words; a sample of depth n takes 2n + 1
+    static const size_t SAMPLE_WORDS = 1 << 22;
+
+    const uint32_t SamplingProfiler::DEFAULT_INTERVAL_US;
+    const size_t SamplingProfiler::MAX_DEPTH;
+
+    SamplingProfiler* SamplingProfiler::active = NULL;
+
+    SamplingProfiler::SamplingProfiler(uint32_t intervalUs) :
+    depth(0), interval(intervalUs), used(0), dropped(0), count(0) {
+    }
+
+    SamplingProfiler::~SamplingProfiler() {
+        stop();
+    }
+
+    bool SamplingProfiler::start() {
+        if (active != NULL) {
+            return false;
+        }
+        // the handler must not allocate
+        samples.assign(SAMPLE_WORDS, 0);
+        used = 0;
+        dropped = 0;
+        count = 0;
+        depth = 0;
+        active = this;
+
+        struct sigaction action;
+        memset(&action, 0, sizeof (action));
+        action.sa_handler = onSignal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPROF, &action, &previous);
+
+        struct itimerval timer;
+        timer.it_interval.tv_sec = interval / 1000000;
+        timer.it_interval.tv_usec = interval % 1000000;
+        timer.it_value = timer.it_interval;
+        if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+            sigaction(SIGPROF, &previous, NULL);
+            active = NULL;
+            return false;
+        }
+        return true;
+    }
+
+    void SamplingProfiler::stop() {
+        if (active != this) {
+            return;
+        }
+        struct itimerval timer;
+        memset(&timer, 0, sizeof (timer));
+        setitimer(ITIMER_PROF, &timer, NULL);
+        sigaction(SIGPROF, &previous, NULL);
+        active = NULL;
+    }
+
+    void SamplingProfiler::onSignal(int) {
+        if (active != NULL) {
+            active->record();
+        }
+    }
+
+    void SamplingProfiler::record() {
+        count++;
+        size_t frameCount = depth;
+        if (frameCount == 0) {
+            // outside the interpreter
+            return;
+        }
+        if (frameCount > MAX_DEPTH + 1) {
+            frameCount = MAX_DEPTH + 1;
+        }
+        if (used + 1 + 2 * frameCount > samples.size()) {
+            dropped++;
+            return;
+        }
+        size_t at = used;
+        samples[at++] = frameCount;
+        for (size_t i = 0; i < frameCount; i++) {
+            samples[at++] = frames[i].function;
+            samples[at++] = frames[i].bci;
+        }
+        used = at;
+    }
+
+    // "function:line", the line is 1-based, "?" where unknown or
+    // without the source, as for code loaded from a bytecode file
+    static string frameName(const Code& code, const string& source,
+            uint32_t function, uint32_t bci) {
+        const BytecodeFunction* fun =
+                (const BytecodeFunction*) code.functionById(function);
+        ostringstream name;
+        name << fun->name() << ':';
+        uint32_t position = fun->position(bci);
+        if (position == Status::INVALID_POSITION || position >= source.size()) {
+            name << '?';
+        } else {
+            // positionToLineOffset() counts lines from 1
+            uint32_t line = 0, offset = 0;
+            positionToLineOffset(source, position, line, offset);
+            name << line;
+        }
+        return name.str();
+    }
+
+    static bool moreSamples(const pair<string, size_t>& a,
+            const pair<string, size_t>& b) {
+        return a.second > b.second
+                || (a.second == b.second && a.first < b.first);
+    }
+
+    static vector<pair<string, size_t> > byCount(
+            const map<string, size_t>& counts) {
+        vector<pair<string, size_t> > result(counts.begin(), counts.end());
+        sort(result.begin(), result.end(), moreSamples);
+        return result;
+    }
+
+    void SamplingProfiler::reportFlat(ostream& out, const Code& code,
+            const string& source) const {
+        map<string, size_t> self;
+        map<string, size_t> total;
+        map<string, size_t> lines;
+        size_t inside = 0;
+        for (size_t at = 0; at < used;) {
+            size_t frameCount = samples[at++];
+            size_t leaf = at + 2 * (frameCount - 1);
+            uint32_t leafFunction = samples[leaf];
+            self[code.functionById(leafFunction)->name()]++;
+            lines[frameName(code, source, leafFunction, samples[leaf + 1])]++;
+
+            // recursion counts a function once per sample
+            vector<uint32_t> seen;
+            for (size_t i = 0; i < frameCount; i++) {
+                uint32_t function = samples[at + 2 * i];
+                if (find(seen.begin(), seen.end(), function) == seen.end()) {
+                    seen.push_back(function);
+                    total[code.functionById(function)->name()]++;
+                }
+            }
+            at += 2 * frameCount;
+            inside++;
+        }
+
+        out << count << " samples, " << inside << " in the interpreter";
+        if (dropped != 0) {
+            out << ", " << dropped << " dropped";
+        }
+        out << endl;
+        if (inside == 0) {
+            return;
+        }
+
+        out << setw(10) << "self" << setw(8) << "%" << setw(10) << "total"
+                << setw(8) << "%" << "  function" << endl;
+        vector<pair<string, size_t> > functions = byCount(self);
+        for (map<string, size_t>::const_iterator it = total.begin();
+                it != total.end(); ++it) {
+            if (self.find(it->first) == self.end()) {
+                functions.push_back(make_pair(it->first, 0));
+            }
+        }
+        for (size_t i = 0; i < functions.size(); i++) {
+            size_t all = total[functions[i].first];
+            out << setw(10) << functions[i].second
+                    << setw(7) << fixed << setprecision(1)
+                    << 100.0 * functions[i].second / inside << '%'
+                    << setw(10) << all
+                    << setw(7) << 100.0 * all / inside << '%'
+                    << "  " << functions[i].first << endl;
+        }
+
+        out << endl << setw(10) << "self" << setw(8) << "%" << "  line"
+                << endl;
+        vector<pair<string, size_t> > sorted = byCount(lines);
+        for (size_t i = 0; i < sorted.size(); i++) {
+            out << setw(10) << sorted[i].second
+                    << setw(7) << 100.0 * sorted[i].second / inside << '%'
+                    << "  " << sorted[i].first << endl;
+        }
+        out.unsetf(ios::floatfield);
+        out << setprecision(6);
+    }
+
+    void SamplingProfiler::reportCollapsed(ostream& out, const Code& code,
+            const string& source) const {
+        map<string, size_t> stacks;
+        for (size_t at = 0; at < used;) {
+            size_t frameCount = samples[at++];
+            string stack;
+            for (size_t i = 0; i < frameCount; i++) {
+                if (i != 0) {
+                    stack += ';';
+                }
+                stack += frameName(code, source, samples[at], samples[at + 1]);
+                at += 2;
+            }
+            stacks[stack]++;
+        }
+        for (map<string, size_t>::const_iterator it = stacks.begin();
+                it != stacks.end(); ++it) {
+            out << it->first << ' ' << it->second << endl;
+        }
+    }
+
+}
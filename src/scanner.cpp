@@ -6,10 +6,22 @@
 
 namespace mathvm {
 
+void TokenList::setSource(const string* source, size_t expectedTokens) {
+    _source = source;
+    _tokens.clear();
+    _tokens.reserve(expectedTokens);
+    _text.clear();
+}
+
+void TokenList::add(uint32_t position, TokenKind kind, uint32_t length) {
+    _tokens.push_back(TokenInfo(kind, position, length, IN_SOURCE));
+}
+
 void TokenList::add(uint32_t position,
                     TokenKind kind,
                     const string& value) {
-    _tokens.push_back(TokenInfo(kind, value, position));
+    _tokens.push_back(TokenInfo(kind, position, value.size(), _text.size()));
+    _text += value;
 }
 
 uint32_t TokenList::positionOf(uint32_t index) const {
@@ -19,24 +31,21 @@ uint32_t TokenList::positionOf(uint32_t index) const {
     return _tokens[index]._position;
 }
 
-TokenKind TokenList::kindAt(uint32_t index) {
+TokenValue TokenList::valueAt(uint32_t index) const {
     if (index >= _tokens.size()) {
-        return tEOF;
+        return TokenValue();
     }
-    return _tokens[index]._kind;
-}
-
-const string TokenList::valueAt(uint32_t index) {
-    if (index >= _tokens.size()) {
-        return "";
+    const TokenInfo& token = _tokens[index];
+    if (token._textOffset != IN_SOURCE) {
+        return TokenValue(_text.data() + token._textOffset, token._length);
     }
-    return _tokens[index]._value;
+    return TokenValue(_source->data() + token._position, token._length);
 }
 
 void TokenList::dump() {
     for (size_t i = 0; i < _tokens.size(); i++) {
         cout << i << ": " << tokenStr(kindAt(i))
-             << " " << valueAt(i) << endl;
+             << " " << valueAt(i).str() << endl;
     }
 }
 
@@ -76,8 +85,7 @@ void Scanner::scanIdent() {
     while (isLetter(_ch) || isDigit(_ch)) {
         readChar();
     }
-    size_t len = _position - tokenStart;
-    _tokens->add(tokenStart, tIDENT, _code->substr(tokenStart, len));
+    _tokens->add(tokenStart, tIDENT, _position - tokenStart);
     _position--;
 }
 
@@ -117,8 +125,7 @@ void Scanner::scanNumber() {
         }
         readChar();
     }
-    size_t len = _position - tokenStart;
-    _tokens->add(tokenStart, kind, _code->substr(tokenStart, len));
+    _tokens->add(tokenStart, kind, _position - tokenStart);
     _position--;
 }
 
@@ -140,19 +147,29 @@ char Scanner::unescape(char ch) {
 
 void Scanner::scanString() {
     int32_t tokenStart = _position + 1;
+    // the source spells the value until the first escape
+    bool escaped = false;
     string result;
     while (1) {
         readChar();
         if (_ch == '\\') {
+            if (!escaped) {
+                result.assign(*_code, tokenStart, _position - tokenStart);
+                escaped = true;
+            }
             readChar();
             result.append(1, unescape(_ch));
         } else if (_ch == '\'' || _ch == '\0') {
             break;
-        } else {
+        } else if (escaped) {
             result.append(1, _ch);
         }
     }
-    _tokens->add(tokenStart, tSTRING, result);
+    if (escaped) {
+        _tokens->add(tokenStart, tSTRING, result);
+    } else {
+        _tokens->add(tokenStart, tSTRING, _position - tokenStart);
+    }
 }
 
 Status* Scanner::scan(const string& code, TokenList& tokens) {
@@ -161,6 +178,7 @@ Status* Scanner::scan(const string& code, TokenList& tokens) {
     _maxPosition = code.size();
     _tokenStart = -1;
     _tokens = &tokens;
+    _tokens->setSource(&code, code.size() / BYTES_PER_TOKEN + 1);
 
     while (true) {
         readChar();
@@ -0,0 +1,164 @@
+#include "stringHeap.h"
+
+#include <string.h>
+
+namespace mathvm {
+
+    // FNV-1a
+    static uint32_t hashString(const char* str, size_t length) {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < length; i++) {
+            h ^= (uint8_t) str[i];
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    StringHeap::StringHeap() : cursor(NULL), left(0) {
+    }
+
+    StringHeap::~StringHeap() {
+        for (size_t i = 0; i < chunks.size(); i++) {
+            delete[] chunks[i];
+        }
+    }
+
+    void StringHeap::grow() {
+        rehash(slots.empty() ? 1024 : slots.size() * 2);
+    }
+
+    void StringHeap::rehash(size_t size) {
+        slots.assign(size, 0);
+        uint32_t mask = slots.size() - 1;
+        for (uint32_t i = 0; i < strings.size(); i++) {
+            if (!indexed[i]) {
+                continue;
+            }
+            uint32_t slot = hashes[i] & mask;
+            // adopted duplicates keep the slot of the first
+            while (slots[slot] != 0) {
+                if (hashes[slots[slot] - 1] == hashes[i]
+                        && strcmp(strings[slots[slot] - 1], strings[i]) == 0) {
+                    break;
+                }
+                slot = (slot + 1) & mask;
+            }
+            if (slots[slot] == 0) {
+                slots[slot] = i + 1;
+            }
+        }
+    }
+
+    uint32_t StringHeap::slotOf(const char* str, size_t length,
+            uint32_t hash) const {
+        uint32_t mask = slots.size() - 1;
+        uint32_t slot = hash & mask;
+        for (; slots[slot] != 0; slot = (slot + 1) & mask) {
+            StringHandle handle = slots[slot] - 1;
+            if (hashes[handle] == hash
+                    && strncmp(strings[handle], str, length) == 0
+                    && strings[handle][length] == '\0') {
+                break;
+            }
+        }
+        return slot;
+    }
+
+    StringHandle StringHeap::add(const char* str, uint32_t hash,
+            uint32_t slot) {
+        StringHandle handle = strings.size();
+        strings.push_back(str);
+        hashes.push_back(hash);
+        indexed.push_back(true);
+        if (slots[slot] == 0) {
+            slots[slot] = handle + 1;
+        }
+        return handle;
+    }
+
+    char* StringHeap::allocate(size_t size) {
+        if (size > CHUNK_SIZE / 4) {
+            // a chunk of its own, the current one stays in use
+            chunks.push_back(new char[size]);
+            return chunks.back();
+        }
+        if (left < size) {
+            chunks.push_back(new char[CHUNK_SIZE]);
+            cursor = chunks.back();
+            left = CHUNK_SIZE;
+        }
+        char* result = cursor;
+        cursor += size;
+        left -= size;
+        return result;
+    }
+
+    StringHandle StringHeap::adopt(const char* str) {
+        if (2 * (strings.size() + 1) > slots.size()) {
+            grow();
+        }
+        size_t length = strlen(str);
+        uint32_t hash = hashString(str, length);
+        return add(str, hash, slotOf(str, length, hash));
+    }
+
+    StringHandle StringHeap::intern(const char* str) {
+        if (2 * (strings.size() + 1) > slots.size()) {
+            grow();
+        }
+        size_t length = strlen(str);
+        uint32_t hash = hashString(str, length);
+        uint32_t slot = slotOf(str, length, hash);
+        if (slots[slot] != 0) {
+            return slots[slot] - 1;
+        }
+        char* copy = allocate(length + 1);
+        memcpy(copy, str, length + 1);
+        return add(copy, hash, slot);
+    }
+
+    StringHeap::Mark StringHeap::mark() const {
+        Mark mark;
+        mark.size = strings.size();
+        mark.chunks = chunks.size();
+        mark.cursor = cursor;
+        mark.left = left;
+        return mark;
+    }
+
+    void StringHeap::release(const Mark& mark) {
+        for (size_t i = mark.chunks; i < chunks.size(); i++) {
+            delete[] chunks[i];
+        }
+        chunks.resize(mark.chunks);
+        cursor = mark.cursor;
+        left = mark.left;
+
+        map<const char*, StringHandle>::iterator it = foreign.begin();
+        while (it != foreign.end()) {
+            if (it->second >= mark.size) {
+                foreign.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+        strings.resize(mark.size);
+        hashes.resize(mark.size);
+        indexed.resize(mark.size);
+        rehash(slots.size());
+    }
+
+    StringHandle StringHeap::wrap(const char* str) {
+        map<const char*, StringHandle>::iterator it = foreign.find(str);
+        if (it != foreign.end()) {
+            return it->second;
+        }
+        StringHandle handle = strings.size();
+        strings.push_back(str);
+        hashes.push_back(0);
+        indexed.push_back(false);
+        foreign.insert(make_pair(str, handle));
+        return handle;
+    }
+
+}
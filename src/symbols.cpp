@@ -0,0 +1,88 @@
+#include "symbols.h"
+
+#include <deque>
+#include <string.h>
+
+namespace mathvm {
+
+    // FNV-1a
+    static uint32_t hashBytes(const char* data, uint32_t length) {
+        uint32_t h = 2166136261u;
+        for (uint32_t i = 0; i < length; i++) {
+            h ^= (uint8_t) data[i];
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    class Interner {
+        // by symbol; a deque, as name() hands out references
+        deque<string> names;
+        vector<uint32_t> hashes;
+        // symbol + 1 per slot, 0 when free, at most half used
+        vector<uint32_t> slots;
+
+        void grow() {
+            slots.assign(slots.empty() ? 1024 : slots.size() * 2, 0);
+            uint32_t mask = slots.size() - 1;
+            for (uint32_t i = 0; i < names.size(); i++) {
+                uint32_t slot = hashes[i] & mask;
+                while (slots[slot] != 0) {
+                    slot = (slot + 1) & mask;
+                }
+                slots[slot] = i + 1;
+            }
+        }
+
+    public:
+
+        Symbol intern(const char* data, uint32_t length) {
+            if (2 * (names.size() + 1) > slots.size()) {
+                grow();
+            }
+            uint32_t h = hashBytes(data, length);
+            uint32_t mask = slots.size() - 1;
+            uint32_t slot = h & mask;
+            for (; slots[slot] != 0; slot = (slot + 1) & mask) {
+                Symbol symbol = slots[slot] - 1;
+                const string& name = names[symbol];
+                if (hashes[symbol] == h && name.size() == length
+                        && memcmp(name.data(), data, length) == 0) {
+                    return symbol;
+                }
+            }
+            Symbol symbol = names.size();
+            names.push_back(string(data, length));
+            hashes.push_back(h);
+            slots[slot] = symbol + 1;
+            return symbol;
+        }
+
+        const string& name(Symbol symbol) const {
+            return names[symbol];
+        }
+
+        uint32_t count() const {
+            return names.size();
+        }
+    };
+
+    // made on first use, whatever the order static objects start in
+    static Interner& interner() {
+        static Interner instance;
+        return instance;
+    }
+
+    Symbol Symbols::intern(const char* data, uint32_t length) {
+        return interner().intern(data, length);
+    }
+
+    const string& Symbols::name(Symbol symbol) {
+        return interner().name(symbol);
+    }
+
+    uint32_t Symbols::count() {
+        return interner().count();
+    }
+
+}
@@ -1,5 +1,6 @@
 #include "mathvm.h"
 #include "bytecodeTranslator.h"
+#include "jit.h"
 
 namespace mathvm {
     Translator* Translator::create(const string& impl) {
@@ -7,7 +8,7 @@ namespace mathvm {
             return new BytecodeTranslator();
         }
         if (impl == "jit") {
-            //return new MachCodeTranslatorImpl();
+            return new MachCodeTranslatorImpl();
         }
         assert(false);
         return 0;
@@ -90,7 +90,7 @@ const char* bytecodeName(Instruction insn, size_t* length) {
         Instruction insn;
         size_t length;
     } names[] = {
-#define BC_NAME(b, d, l) {#b, BC_##b, l},
+#define BC_NAME(b, d, l, o, u) {#b, BC_##b, l},
         FOR_BYTECODES(BC_NAME)
     };
 
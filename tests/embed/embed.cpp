@@ -0,0 +1,134 @@
+/*
+ * A host program running MyMathVm code through Program and
+ * ExecutionContext, once with each translator. Built and checked
+ * against embed.expect by
+ *
+ *   make embed
+ */
+
+#include "mathvm.h"
+
+#include <iostream>
+
+using namespace mathvm;
+using namespace std;
+
+static const char* SOURCE =
+        "int scale;\n"
+        "string tag;\n"
+        "scale = 1;\n"
+        "tag = 'top';\n"
+        "function int fib(int n) {\n"
+        "    if (n < 2) {\n"
+        "        return n;\n"
+        "    }\n"
+        "    return fib(n - 1) + fib(n - 2);\n"
+        "}\n"
+        "function double scaled(int a, double b) {\n"
+        "    return a * b * scale;\n"
+        "}\n"
+        "function string greet(string name) {\n"
+        "    print(tag, ' greets ', name, '\\n');\n"
+        "    return tag;\n"
+        "}\n"
+        "function int boom(int n) {\n"
+        "    return 1 + boom(n + 1);\n"
+        "}\n";
+
+static void report(const char* what, Status* status) {
+    if (status == NULL) {
+        cout << what << ": ok" << endl;
+    } else {
+        cout << what << ": " << status->getError() << endl;
+        delete status;
+    }
+}
+
+static void printIntGlobal(ExecutionContext* context, const string& name) {
+    Var var(VT_INT, name);
+    Status* status = context->getGlobal(&var);
+    if (status != NULL) {
+        report(("get " + name).c_str(), status);
+        return;
+    }
+    cout << name << " " << var.getIntValue() << endl;
+}
+
+static bool run(const string& impl) {
+    cout << "translator '" << impl << "'" << endl;
+    Program* program;
+    Status* status = Program::create(SOURCE, &program, impl);
+    if (status != NULL) {
+        report("create", status);
+        return false;
+    }
+    ExecutionContext* context = program->createContext();
+
+    report("execute", context->execute());
+    printIntGlobal(context, "scale");
+
+    // globals set from the host are seen by the next call
+    Var scale(VT_INT, "scale");
+    scale.setIntValue(3);
+    report("set scale", context->setGlobal(scale));
+    Var tag(VT_STRING, "tag");
+    tag.setStringValue("host");
+    report("set tag", context->setGlobal(tag));
+
+    Var a(VT_INT, "a");
+    Var b(VT_DOUBLE, "b");
+    Var product(VT_DOUBLE, "");
+    a.setIntValue(2);
+    b.setDoubleValue(1.5);
+    vector<Var*> args;
+    args.push_back(&a);
+    args.push_back(&b);
+    report("scaled", context->call("scaled", args, &product));
+    cout << "scaled(2, 1.5) " << product.getDoubleValue() << endl;
+
+    Var name(VT_STRING, "name");
+    Var greeting(VT_STRING, "");
+    name.setStringValue("guest");
+    vector<Var*> nameArgs(1, &name);
+    report("greet", context->call("greet", nameArgs, &greeting));
+    cout << "greet returned " << greeting.getStringValue() << endl;
+
+    // far past the hot threshold, so the JIT compiles fib again
+    const TranslatedFunction* fib = program->code()->functionByName("fib");
+    Var n(VT_INT, "n");
+    Var result(VT_INT, "");
+    vector<Var*> fibArgs(1, &n);
+    int64_t sum = 0;
+    for (int i = 0; i < 3000; i++) {
+        n.setIntValue(i % 15);
+        status = context->call(fib, fibArgs, &result);
+        if (status != NULL) {
+            report("fib", status);
+            break;
+        }
+        sum += result.getIntValue();
+    }
+    cout << "fib sum " << sum << endl;
+
+    // a run that fails resets the context, globals are zero again
+    report("boom", context->call("boom", fibArgs, &result));
+    printIntGlobal(context, "scale");
+    report("scaled", context->call("scaled", args, &product));
+    cout << "scaled(2, 1.5) " << product.getDoubleValue() << endl;
+
+    report("wrong arguments", context->call("fib", args, &result));
+    report("unknown function", context->call("nope", args, &result));
+
+    report("execute", context->execute());
+    context->reset();
+    printIntGlobal(context, "scale");
+
+    delete context;
+    delete program;
+    return true;
+}
+
+int main() {
+    bool ok = run("") && run("jit");
+    return ok ? 0 : 1;
+}
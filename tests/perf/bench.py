@@ -0,0 +1,90 @@
+#!/usr/bin/python
+#
+# Compare running times of several mymathvm builds on the same scripts.
+#
+# The dispatch loop is picked at build time, so to compare threaded and
+# switch dispatch build the second binary aside:
+#
+#   make CONF=Release build
+#   make CONF=Release CND_BUILDDIR=build-switch CND_DISTDIR=dist-switch \
+#        CXXFLAGS=-DMATHVM_SWITCH_DISPATCH build
+#   ./tests/perf/bench.py -e ./dist/Release/GNU-Linux-x86/mymathvm \
+#                         -e ./dist-switch/Release/GNU-Linux-x86/mymathvm
+
+from __future__ import print_function
+
+import optparse
+import os
+import subprocess
+import sys
+import time
+
+# lissajous.mvm and plot.mvm draw to a framebuffer through natives
+# (unsafe_video*, unsafe_setMem) this build doesn't provide
+defaultScripts = ['./tests/perf/prime.mvm',
+                  './tests/additional/ackermann.mvm']
+
+def buildOptions():
+    result = optparse.OptionParser(usage='%prog [options] [script.mvm ...]')
+    result.add_option('-e', '--executable',
+                      action='append', type='string', dest='executables',
+                      help='path to an executable, may be repeated')
+    result.add_option('-a', '--arg',
+                      action='append', type='string', dest='args', default=[],
+                      help='extra argument passed to every executable')
+    result.add_option('-r', '--runs',
+                      action='store', type='int', default=3,
+                      help='runs per script, best time is reported')
+    result.add_option('-t', '--timeout',
+                      action='store', type='float', default=300,
+                      help='seconds before a run is abandoned')
+    return result
+
+def timeRun(executable, args, script, timeout):
+    start = time.time()
+    # errors are reported on stdout, communicate() keeps draining it so
+    # a script printing a lot doesn't block on a full pipe
+    pipe = subprocess.Popen([executable] + args + [script],
+                            stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    try:
+        out, _ = pipe.communicate(timeout=timeout)
+    except subprocess.TimeoutExpired:
+        pipe.kill()
+        pipe.communicate()
+        return None, 'timeout'
+    elapsed = time.time() - start
+    out = out.decode('utf-8', 'replace')
+    if pipe.returncode != 0 or out.startswith('Cannot'):
+        return None, out.strip().split('\n')[-1] or 'exit %d' % pipe.returncode
+    return elapsed, None
+
+def main(argv):
+    options, scripts = buildOptions().parse_args(argv[1:])
+    if not options.executables:
+        options.executables = ['./dist/Release/GNU-Linux-x86/mymathvm']
+    if not scripts:
+        scripts = defaultScripts
+
+    width = max(len(os.path.basename(s)) for s in scripts) + 2
+    print(''.ljust(width) + ''.join(('[%d]' % i).rjust(12)
+                                    for i in range(len(options.executables))))
+    for script in scripts:
+        line = os.path.basename(script).ljust(width)
+        for executable in options.executables:
+            best, error = None, None
+            for run in range(options.runs):
+                elapsed, error = timeRun(executable, options.args, script,
+                                         options.timeout)
+                if error is not None:
+                    break
+                if best is None or elapsed < best:
+                    best = elapsed
+            line += ('%.3fs' % best if error is None else 'failed').rjust(12)
+            if error is not None:
+                print('  ' + executable + ': ' + error, file=sys.stderr)
+        print(line)
+    for i, executable in enumerate(options.executables):
+        print('[%d] %s' % (i, executable))
+
+if __name__ == '__main__':
+    main(sys.argv)
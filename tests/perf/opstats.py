@@ -0,0 +1,111 @@
+#!/usr/bin/python
+#
+# Merge the dynamic opcode and opcode pair counts of many scripts, to see
+# which superinstructions would pay off.
+#
+# The counting is built in only on request, so build a binary aside:
+#
+#   make opstats
+#
+# or by hand
+#
+#   make CONF=Release CND_BUILDDIR=build-opstats CND_DISTDIR=dist-opstats \
+#        CXXFLAGS=-DMATHVM_OPCODE_STATS build
+#   ./tests/perf/opstats.py -e ./dist-opstats/Release/GNU-Linux-x86/mymathvm
+#
+# Without script arguments every .mvm under tests/ is run.
+
+from __future__ import print_function
+
+import optparse
+import os
+import subprocess
+import sys
+import time
+
+def buildOptions():
+    result = optparse.OptionParser(usage='%prog [options] [script.mvm ...]')
+    result.add_option('-e', '--executable',
+                      action='store', type='string',
+                      default='./dist-opstats/Release/GNU-Linux-x86/mymathvm',
+                      help='mymathvm built with -DMATHVM_OPCODE_STATS')
+    result.add_option('-n', '--top',
+                      action='store', type='int', default=30,
+                      help='lines per table')
+    result.add_option('-t', '--timeout',
+                      action='store', type='float', default=60,
+                      help='seconds before a run is abandoned')
+    return result
+
+def allScripts(root):
+    result = []
+    for directory, subdirectories, files in os.walk(root):
+        subdirectories.sort()
+        for name in sorted(files):
+            if name.endswith('.mvm'):
+                result.append(os.path.join(directory, name))
+    return result
+
+# returns the report lines the run wrote on stderr, None if it didn't end
+def runScript(executable, script, timeout):
+    # the counts come on stderr; communicate() drains it as it goes, so
+    # a script printing a lot doesn't block on a full pipe
+    pipe = subprocess.Popen([executable, script],
+                            stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    try:
+        _, err = pipe.communicate(timeout=timeout)
+    except subprocess.TimeoutExpired:
+        pipe.kill()
+        pipe.communicate()
+        return None
+    return err.decode('utf-8', 'replace').split('\n')
+
+def merge(lines, opcodes, pairs):
+    for line in lines:
+        fields = line.split()
+        if len(fields) == 3 and fields[0] == 'opcode':
+            opcodes[fields[1]] = opcodes.get(fields[1], 0) + int(fields[2])
+        elif len(fields) == 4 and fields[0] == 'pair':
+            key = fields[1] + ' ' + fields[2]
+            pairs[key] = pairs.get(key, 0) + int(fields[3])
+
+def printTable(title, counts, top):
+    total = sum(counts.values())
+    print('%s, %d executed' % (title, total))
+    ordered = sorted(counts.items(), key=lambda item: (-item[1], item[0]))
+    for key, count in ordered[:top]:
+        print('%14d %6.2f%%  %s' % (count, 100.0 * count / total, key))
+    print()
+
+def main(argv):
+    options, scripts = buildOptions().parse_args(argv[1:])
+    if not os.path.exists(options.executable):
+        print(options.executable + ' not found, see make opstats',
+              file=sys.stderr)
+        return 1
+    if not scripts:
+        scripts = allScripts('./tests')
+
+    opcodes = {}
+    pairs = {}
+    counted = 0
+    for script in scripts:
+        lines = runScript(options.executable, script, options.timeout)
+        if lines is None:
+            print('  ' + script + ': timeout', file=sys.stderr)
+            continue
+        merge(lines, opcodes, pairs)
+        counted += 1
+    if not opcodes:
+        print('no counts, was it built with -DMATHVM_OPCODE_STATS?',
+              file=sys.stderr)
+        return 1
+
+    print('%d scripts' % counted)
+    print()
+    printTable('Opcodes', opcodes, options.top)
+    printTable('Pairs', pairs, options.top)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,77 @@
+#!/usr/bin/python
+#
+# Check that --sample and --stacks attribute samples to the source line
+# the time is spent on: a script whose only hot loop is on line 4 has to
+# report <top>:4 and fib's recursion the line of its return.
+#
+#   ./tests/sample_lines.py [-e ./dist/Release/GNU-Linux-x86/mymathvm]
+
+from __future__ import print_function
+
+import optparse
+import os
+import subprocess
+import sys
+import tempfile
+
+# (script, frame expected to take most samples)
+CASES = [
+    ("int i;\n"
+     "int s;\n"
+     "s = 0;\n"
+     "for (i in 0..20000000) { s = s + i % 7; }\n"
+     "print(s, '\\n');\n",
+     '<top>:4'),
+    ("function int fib(int n) {\n"
+     "    if (n < 2) {\n"
+     "        return n;\n"
+     "    }\n"
+     "    return fib(n - 1) + fib(n - 2);\n"
+     "}\n"
+     "print(fib(30), '\\n');\n",
+     'fib:5'),
+]
+
+def hottestFrames(executable, source):
+    directory = tempfile.mkdtemp()
+    script = os.path.join(directory, 'script.mvm')
+    stacks = os.path.join(directory, 'stacks.txt')
+    try:
+        with open(script, 'w') as f:
+            f.write(source)
+        subprocess.check_call([executable, '--sample', '--stacks', stacks,
+                               script],
+                              stdout=subprocess.DEVNULL,
+                              stderr=subprocess.DEVNULL)
+        counts = {}
+        with open(stacks) as f:
+            for line in f:
+                stack, count = line.rsplit(' ', 1)
+                leaf = stack.split(';')[-1]
+                counts[leaf] = counts.get(leaf, 0) + int(count)
+        return counts
+    finally:
+        for name in (script, stacks):
+            if os.path.exists(name):
+                os.remove(name)
+        os.rmdir(directory)
+
+def main(argv):
+    parser = optparse.OptionParser()
+    parser.add_option('-e', '--executable', action='store', type='string',
+                      default='./dist/Release/GNU-Linux-x86/mymathvm')
+    options, _ = parser.parse_args(argv[1:])
+
+    failed = False
+    for source, expected in CASES:
+        counts = hottestFrames(options.executable, source)
+        hottest = max(counts, key=counts.get) if counts else None
+        if hottest != expected:
+            print('FAIL: expected %s, got %s' % (expected, counts))
+            failed = True
+        else:
+            print('ok: %s' % expected)
+    return 1 if failed else 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))